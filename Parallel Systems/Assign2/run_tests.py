@@ -1,8 +1,11 @@
 #!/usr/bin/env python3
 import os
+import csv
+import json
 from subprocess import check_output
 import re
 import pickle
+import random
 from time import sleep
 
 def make_dir(dir_name):
@@ -27,13 +30,36 @@ def extract_variables(output):
         'thrust_io_time': r'thrust_io_time:\s+([\d.]+)\s+ms',
         'thrust_percent_spent_in_io': r'thrust_percent_spent_in_io:\s+([\d.]+)',
         'main_per_iteration': r'main_per_iteration:\s+([\d.]+)\s+ms',
-        'main_total': r'main_total:\s+([\d.]+)\s+ms'
+        'main_total': r'main_total:\s+([\d.]+)\s+ms',
+        'init_time': r'init_time:\s+([\d.]+)\s+ms',
+        'ingest_time': r'ingest_time:\s+([\d.]+)\s+ms',
+        'mpi_allreduce_time': r'mpi_allreduce_time:\s+([\d.]+)\s+ms',
+        'predict_throughput': r'predict_throughput:\s+([\d.]+)\s+points/s',
+        'predict_p50_latency': r'predict_p50_latency:\s+([\d.]+)\s+ms',
+        'predict_p99_latency': r'predict_p99_latency:\s+([\d.]+)\s+ms',
+        'multirun_throughput': r'multirun_throughput:\s+([\d.]+)\s+points/s',
+        'partial_dims_evaluated_fraction': r'partial_dims_evaluated_fraction:\s+([\d.]+)',
+        'storage_assignment_agreement': r'storage_assignment_agreement:\s+([\d.]+)',
+        'storage_inertia_ratio': r'storage_inertia_ratio:\s+([\d.]+)',
+        'kdtree_build_time': r'kdtree_build_time:\s+([\d.]+)\s+ms',
+        'ivf_exact_fraction': r'ivf_exact_fraction:\s+([\d.]+)',
+        'ivf_assign_speedup': r'ivf_assign_speedup:\s+([\d.]+)',
+        'bisect_time': r'bisect_time:\s+([\d.]+)\s+ms',
+        'bisect_sse': r'bisect_sse:\s+([\d.]+)',
+        'bisect_refine_iterations': r'bisect_refine_iterations:\s+(\d+)',
+        'layout_time': r'layout_time:\s+([\d.]+)\s+ms',
+        'warm_start_points': r'warm_start_points:\s+(\d+)',
+        'assign_l1d_misses': r'assign_l1d_misses:\s+(-?\d+)',
+        'assign_llc_misses': r'assign_llc_misses:\s+(-?\d+)',
+        'assign_tile_points': r'assign_tile_points:\s+(\d+)',
+        'assign_tile_centroids': r'assign_tile_centroids:\s+(\d+)',
+        'iterations': r'^(\d+),[\d.]+$'
     }
     
     extracted_data = {}
     
     for var_name, regex in variables.items():
-        match = re.search(regex, output)
+        match = re.search(regex, output, re.MULTILINE)
         if match:
             if 'cuda_' in var_name:
                 var_name = var_name.replace('cuda_', '')
@@ -41,6 +67,10 @@ def extract_variables(output):
                 var_name = var_name.replace('thrust_', '')
             extracted_data[var_name] = float(match.group(1))
     
+    skipped = re.findall(r'(?:elkan|hamerly|yinyang|kdtree)_iteration:\s+(\d+)\s+skipped_fraction:\s+([\d.]+)', output)
+    if skipped:
+        extracted_data['skipped_fraction'] = [float(fraction) for _, fraction in skipped]
+
     return extracted_data
 
 
@@ -80,9 +110,9 @@ def default(trial_id=0, alternate=False):
             for num_threads in threads:
                 print(f"executing {algo_name} with threads={num_threads}")
                 if alternate:
-                    cmd = f"./bin/kmeans -k {num_clusters} -d {dims} -i input/{file_name}.txt -m {max_iters} -s {seed} -t {threshold} -a {algorithm} -c -h {num_threads} -f"
+                    cmd = f"./bin/kmeans -k {num_clusters} -d {dims} -i input/{file_name}.txt -m {max_iters} -s {seed} -t {threshold} -a {algorithm} -c -r -h {num_threads} -f"
                 else:
-                    cmd = f"./bin/kmeans -k {num_clusters} -d {dims} -i input/{file_name}.txt -m {max_iters} -s {seed} -t {threshold} -a {algorithm} -c -h {num_threads}"
+                    cmd = f"./bin/kmeans -k {num_clusters} -d {dims} -i input/{file_name}.txt -m {max_iters} -s {seed} -t {threshold} -a {algorithm} -c -r -h {num_threads}"
                 out = check_output(cmd, shell=True, start_new_session=True).decode("ascii")
                 variables = extract_variables(out)
                 variables['algo_name'] = algo_name
@@ -95,6 +125,490 @@ def default(trial_id=0, alternate=False):
 
     return all_results
 
+def bounded(trial_id=0, num_workers=1):
+    # sweeps k on the largest input to compare the bounded cpu algorithms against the exhaustive scan
+    file_name = "random-n65536-d32-c16"
+    dims = 32
+    seed = 8675309
+    threshold = 0.000001
+    max_iters = 30
+    algorithms = {
+        0 : 'sequential',
+        4 : 'elkan',
+        5 : 'hamerly',
+        6 : 'yinyang',
+    }
+    cluster_counts = [16, 64, 256, 1024, 4096]
+    # elkan keeps n*k lower bounds, 2GB at k=4096
+    elkan_max_clusters = 1024
+
+    all_results = []
+
+    for num_clusters in cluster_counts:
+        for algorithm, algo_name in algorithms.items():
+            if algorithm == 4 and num_clusters > elkan_max_clusters:
+                continue
+            print(f"executing {algo_name} with k={num_clusters} workers={num_workers}")
+            cmd = f"./bin/kmeans -k {num_clusters} -d {dims} -i input/{file_name}.txt -m {max_iters} -s {seed} -t {threshold} -a {algorithm} -c -r -w {num_workers}"
+            out = check_output(cmd, shell=True, start_new_session=True).decode("ascii")
+            variables = extract_variables(out)
+            variables['algo_name'] = algo_name
+            variables['file_name'] = file_name
+            variables['num_clusters'] = num_clusters
+            variables['num_workers'] = num_workers
+            variables['trial_id'] = trial_id
+            print(variables)
+            all_results.append(variables)
+            sleep(0.5)
+
+    return all_results
+
+def save_bounded_results(num_trials = 3, workers=(1, 4)):
+    for trial_id in range(0, num_trials):
+        for num_workers in workers:
+            save_data(bounded(trial_id, num_workers), f"bounded_w{num_workers}_{trial_id}")
+
+def seeding(trial_id=0, num_workers=1):
+    # total time (seeding + clustering) and iteration count for each --init on every input
+    FILES = {
+        "random-n2048-d16-c16" : 16,
+        "random-n16384-d24-c16" : 24,
+        "random-n65536-d32-c16" : 32,
+    }
+    seed = 8675309
+    threshold = 0.000001
+    max_iters = 150
+    inits = ['random', 'kmeans++', 'kmeans||']
+    cluster_counts = [16, 64]
+
+    all_results = []
+
+    for file_name, dims in FILES.items():
+        for num_clusters in cluster_counts:
+            for init in inits:
+                print(f"seeding {file_name} with {init} k={num_clusters}")
+                cmd = f"./bin/kmeans -k {num_clusters} -d {dims} -i input/{file_name}.txt -m {max_iters} -s {seed} -t {threshold} -a 0 -c -r -w {num_workers} -n '{init}'"
+                out = check_output(cmd, shell=True, start_new_session=True).decode("ascii")
+                variables = extract_variables(out)
+                variables['total_with_init'] = variables.get('main_total', 0) + variables.get('init_time', 0)
+                variables['init'] = init
+                variables['file_name'] = file_name
+                variables['num_clusters'] = num_clusters
+                variables['num_workers'] = num_workers
+                variables['trial_id'] = trial_id
+                print(variables)
+                all_results.append(variables)
+                sleep(0.5)
+
+    return all_results
+
+def save_seeding_results(num_trials = 3, workers=(1, 4)):
+    for trial_id in range(0, num_trials):
+        for num_workers in workers:
+            save_data(seeding(trial_id, num_workers), f"seeding_w{num_workers}_{trial_id}")
+
+def thrust_host(trial_id=0):
+    # thrust on the OpenMP device system (make thrust-omp) against the sequential backend of the same binary;
+    # see the note on thrust-omp in the Makefile
+    FILES = {
+        "random-n2048-d16-c16" : 16,
+        "random-n16384-d24-c16" : 24,
+        "random-n65536-d32-c16" : 32,
+    }
+    num_clusters = 16
+    seed = 8675309
+    threshold = 0.000001
+    max_iters = 150
+    algorithms = {
+        0 : 'sequential',
+        3 : 'thrust_omp',
+    }
+    thread_counts = [1, 2, 4, 8]
+
+    all_results = []
+
+    for file_name, dims in FILES.items():
+        for algorithm, algo_name in algorithms.items():
+            for num_threads in thread_counts:
+                # the sequential backend ignores the thread count, one run is enough
+                if algorithm == 0 and num_threads > 1:
+                    continue
+                print(f"executing {algo_name} on {file_name} with OMP_NUM_THREADS={num_threads}")
+                cmd = f"OMP_NUM_THREADS={num_threads} ./bin/kmeans_thrust_omp -k {num_clusters} -d {dims} -i input/{file_name}.txt -m {max_iters} -s {seed} -t {threshold} -a {algorithm} -c -r"
+                out = check_output(cmd, shell=True, start_new_session=True).decode("ascii")
+                variables = extract_variables(out)
+                variables['algo_name'] = algo_name
+                variables['file_name'] = file_name
+                variables['num_threads'] = num_threads
+                variables['trial_id'] = trial_id
+                print(variables)
+                all_results.append(variables)
+                sleep(0.5)
+
+    return all_results
+
+def save_thrust_host_results(num_trials = 3):
+    for trial_id in range(0, num_trials):
+        save_data(thrust_host(trial_id), f"thrust_omp_{trial_id}")
+
+def make_blobs(file_name, num_points, dims, num_centers, seed=1):
+    # gaussian blobs in the usual text format, for the low-dimensional runs
+    path = f"input/{file_name}.txt"
+    if os.path.exists(path):
+        return
+    rng = random.Random(seed)
+    centers = [[rng.uniform(0.1, 0.9) for _ in range(dims)] for _ in range(num_centers)]
+    with open(path, "w") as f:
+        f.write(f"{num_points}\n")
+        for i in range(num_points):
+            center = centers[rng.randrange(num_centers)]
+            f.write(f"{i + 1} " + " ".join("%.6f" % min(0.999999, max(0.0, rng.gauss(v, 0.05))) for v in center) + "\n")
+
+def kdtree(trial_id=0, num_workers=1):
+    # kd-tree filtering against the brute-force scan on low-dimensional inputs
+    FILES = {
+        "blobs-n1000000-d2-c16" : 2,
+        "blobs-n1000000-d4-c16" : 4,
+        "blobs-n1000000-d8-c16" : 8,
+    }
+    seed = 8675309
+    threshold = 0.000001
+    max_iters = 100
+    algorithms = {
+        0 : 'sequential',
+        12 : 'kdtree',
+    }
+    cluster_counts = [16, 64, 256]
+
+    all_results = []
+
+    for file_name, dims in FILES.items():
+        make_blobs(file_name, 1000000, dims, 16)
+        for num_clusters in cluster_counts:
+            for algorithm, algo_name in algorithms.items():
+                print(f"executing {algo_name} on {file_name} with k={num_clusters} workers={num_workers}")
+                cmd = f"./bin/kmeans -k {num_clusters} -d {dims} -i input/{file_name}.txt -m {max_iters} -s {seed} -t {threshold} -a {algorithm} -c -r -w {num_workers}"
+                out = check_output(cmd, shell=True, start_new_session=True).decode("ascii")
+                variables = extract_variables(out)
+                variables['algo_name'] = algo_name
+                variables['file_name'] = file_name
+                variables['num_clusters'] = num_clusters
+                variables['num_workers'] = num_workers
+                variables['trial_id'] = trial_id
+                print(variables)
+                all_results.append(variables)
+                sleep(0.5)
+
+    return all_results
+
+def save_kdtree_results(num_trials = 3, workers=(1, 4)):
+    for trial_id in range(0, num_trials):
+        for num_workers in workers:
+            save_data(kdtree(trial_id, num_workers), f"kdtree_w{num_workers}_{trial_id}")
+
+def ivf(trial_id=0, num_workers=1):
+    # index-searched assignment for large k: recall and speedup over nprobe, against the fused full scan
+    file_name = "blobs-n100000-d32-c256"
+    dims = 32
+    seed = 8675309
+    threshold = 0.000001
+    max_iters = 30
+    cluster_counts = [1024, 4096, 16384]
+    nprobes = [1, 2, 4, 8, 16]
+
+    make_blobs(file_name, 100000, dims, 256)
+    all_results = []
+
+    for num_clusters in cluster_counts:
+        runs = [(7, 'fused', None)] + [(13, 'ivf', nprobe) for nprobe in nprobes]
+        for algorithm, algo_name, nprobe in runs:
+            print(f"executing {algo_name} on {file_name} with k={num_clusters} nprobe={nprobe}")
+            cmd = f"./bin/kmeans -k {num_clusters} -d {dims} -i input/{file_name}.txt -m {max_iters} -s {seed} -t {threshold} -a {algorithm} -c -r -w {num_workers}"
+            if nprobe is not None:
+                cmd += f" -N {nprobe}"
+            out = check_output(cmd, shell=True, start_new_session=True).decode("ascii")
+            variables = extract_variables(out)
+            variables['algo_name'] = algo_name
+            variables['file_name'] = file_name
+            variables['num_clusters'] = num_clusters
+            variables['nprobe'] = nprobe
+            variables['num_workers'] = num_workers
+            variables['trial_id'] = trial_id
+            print(variables)
+            all_results.append(variables)
+            sleep(0.5)
+
+    return all_results
+
+def save_ivf_results(num_trials = 3, num_workers = 4):
+    for trial_id in range(0, num_trials):
+        save_data(ivf(trial_id, num_workers), f"ivf_{trial_id}")
+
+def bisect(trial_id=0, num_workers=1):
+    # bisecting k-means, with and without the flat refinement, against flat sequential k-means
+    file_name = "blobs-n100000-d32-c256"
+    dims = 32
+    seed = 8675309
+    threshold = 0.000001
+    max_iters = 150
+    cluster_counts = [256, 1024, 4096]
+    runs = {
+        'sequential' : "-a 0",
+        'bisect_largest' : "-a 14 -B largest",
+        'bisect_sse' : "-a 14 -B sse",
+        'bisect_largest_refined' : "-a 14 -B largest -F",
+        'bisect_sse_refined' : "-a 14 -B sse -F",
+    }
+
+    make_blobs(file_name, 100000, dims, 256)
+    all_results = []
+
+    for num_clusters in cluster_counts:
+        for algo_name, args in runs.items():
+            print(f"executing {algo_name} on {file_name} with k={num_clusters} workers={num_workers}")
+            cmd = f"./bin/kmeans -k {num_clusters} -d {dims} -i input/{file_name}.txt -m {max_iters} -s {seed} -t {threshold} {args} -c -r -w {num_workers}"
+            out = check_output(cmd, shell=True, start_new_session=True).decode("ascii")
+            variables = extract_variables(out)
+            variables['algo_name'] = algo_name
+            variables['file_name'] = file_name
+            variables['num_clusters'] = num_clusters
+            variables['num_workers'] = num_workers
+            variables['trial_id'] = trial_id
+            print(variables)
+            all_results.append(variables)
+            sleep(0.5)
+
+    return all_results
+
+def save_bisect_results(num_trials = 3, workers=(1, 4)):
+    for trial_id in range(0, num_trials):
+        for num_workers in workers:
+            save_data(bisect(trial_id, num_workers), f"bisect_w{num_workers}_{trial_id}")
+
+def layout(trial_id=0, num_workers=1):
+    # dimension-blocked against row-major points in the direct (non-gemm) kernels, across d
+    dims_list = [2, 4, 8, 16, 32, 64, 128]
+    seed = 8675309
+    threshold = 0.000001
+    max_iters = 50
+    num_clusters = 64
+    runs = {
+        'fused_rows' : "-a 7 -L rows",
+        'fused_blocked' : "-a 7 -L blocked",
+        'sequential_partial' : "-a 0 -p",
+        'sequential_blocked' : "-a 0 -L blocked",
+    }
+
+    all_results = []
+
+    for dims in dims_list:
+        file_name = f"blobs-n100000-d{dims}-c16"
+        make_blobs(file_name, 100000, dims, 16)
+        for algo_name, args in runs.items():
+            print(f"executing {algo_name} on {file_name} with k={num_clusters} workers={num_workers}")
+            cmd = f"./bin/kmeans -k {num_clusters} -d {dims} -i input/{file_name}.txt -m {max_iters} -s {seed} -t {threshold} {args} -c -r -w {num_workers}"
+            out = check_output(cmd, shell=True, start_new_session=True).decode("ascii")
+            variables = extract_variables(out)
+            variables['algo_name'] = algo_name
+            variables['file_name'] = file_name
+            variables['dims'] = dims
+            variables['num_clusters'] = num_clusters
+            variables['num_workers'] = num_workers
+            variables['trial_id'] = trial_id
+            print(variables)
+            all_results.append(variables)
+            sleep(0.5)
+
+    return all_results
+
+def save_layout_results(num_trials = 3, workers=(1, 4)):
+    for trial_id in range(0, num_trials):
+        for num_workers in workers:
+            save_data(layout(trial_id, num_workers), f"layout_w{num_workers}_{trial_id}")
+
+def tiling(trial_id=0, num_workers=1):
+    # cache-tiled against untiled direct assignment as k outgrows L1; the misses are only
+    # there when perf_event_open is allowed
+    clusters_list = [16, 64, 256, 1024, 4096]
+    dims = 128
+    seed = 8675309
+    threshold = 0.000001
+    max_iters = 10
+    runs = {
+        'fused_rows' : "-a 7",
+        'fused_tiled' : "-a 7 -G",
+        'sequential_partial' : "-a 0 -p",
+        'sequential_tiled' : "-a 0 -G",
+    }
+
+    all_results = []
+
+    file_name = f"blobs-n100000-d{dims}-c16"
+    make_blobs(file_name, 100000, dims, 16)
+    for num_clusters in clusters_list:
+        for algo_name, args in runs.items():
+            print(f"executing {algo_name} on {file_name} with k={num_clusters} workers={num_workers}")
+            cmd = f"./bin/kmeans -k {num_clusters} -d {dims} -i input/{file_name}.txt -m {max_iters} -s {seed} -t {threshold} {args} -c -r -w {num_workers}"
+            out = check_output(cmd, shell=True, start_new_session=True).decode("ascii")
+            variables = extract_variables(out)
+            variables['algo_name'] = algo_name
+            variables['file_name'] = file_name
+            variables['dims'] = dims
+            variables['num_clusters'] = num_clusters
+            variables['num_workers'] = num_workers
+            variables['trial_id'] = trial_id
+            print(variables)
+            all_results.append(variables)
+            sleep(0.5)
+
+    return all_results
+
+def save_tiling_results(num_trials = 3, workers=(1, 4)):
+    for trial_id in range(0, num_trials):
+        for num_workers in workers:
+            save_data(tiling(trial_id, num_workers), f"tiling_w{num_workers}_{trial_id}")
+
+def perturb_points(src_name, dst_name, fraction, seed=1):
+    # moves a random fraction of the points by gaussian noise, standing in for a day of changes
+    dst = f"input/{dst_name}.txt"
+    if os.path.exists(dst):
+        return
+    with open(f"input/{src_name}.txt") as f:
+        lines = f.read().splitlines()
+    rng = random.Random(seed)
+    num_points = int(lines[0])
+    for i in rng.sample(range(num_points), int(num_points * fraction)):
+        fields = lines[i + 1].split()
+        moved = [min(0.999999, max(0.0, float(v) + rng.gauss(0, 0.05))) for v in fields[1:]]
+        lines[i + 1] = fields[0] + " " + " ".join("%.6f" % v for v in moved)
+    with open(dst, "w") as f:
+        f.write("\n".join(lines) + "\n")
+
+def warm_start(trial_id=0, num_workers=1):
+    # reclustering a dataset with 1% of its points moved: cold seeding against --init-from the
+    # previous model, with and without the previous assignments
+    base_name = "blobs-n200000-d16-c64"
+    changed_name = "blobs-n200000-d16-c64-moved1"
+    dims = 16
+    num_clusters = 64
+    seed = 8675309
+    threshold = 0.000001
+    max_iters = 300
+    algorithms = {
+        0 : 'sequential',
+        4 : 'elkan',
+        5 : 'hamerly',
+        6 : 'yinyang',
+        7 : 'fused',
+    }
+
+    make_blobs(base_name, 200000, dims, 64)
+    perturb_points(base_name, changed_name, 0.01)
+    make_dir("output")
+    model = "output/warm_model.bin"
+    assignments = "output/warm_assignments.txt"
+    cmd = f"./bin/kmeans -k {num_clusters} -d {dims} -i input/{base_name}.txt -m {max_iters} -s {seed} -t {threshold} -a 7 -w {num_workers} -M {model} > {assignments}"
+    check_output(cmd, shell=True, start_new_session=True)
+
+    starts = {
+        'cold' : "",
+        'warm' : f"-I {model}",
+        'warm_assignments' : f"-I {model} -A {assignments}",
+    }
+    all_results = []
+
+    for algorithm, algo_name in algorithms.items():
+        for start, args in starts.items():
+            print(f"executing {algo_name} on {changed_name} with a {start} start workers={num_workers}")
+            cmd = f"./bin/kmeans -k {num_clusters} -d {dims} -i input/{changed_name}.txt -m {max_iters} -s {seed} -t {threshold} -a {algorithm} {args} -c -r -w {num_workers}"
+            out = check_output(cmd, shell=True, start_new_session=True).decode("ascii")
+            variables = extract_variables(out)
+            variables['algo_name'] = algo_name
+            variables['start'] = start
+            variables['file_name'] = changed_name
+            variables['num_clusters'] = num_clusters
+            variables['num_workers'] = num_workers
+            variables['trial_id'] = trial_id
+            print(variables)
+            all_results.append(variables)
+            sleep(0.5)
+
+    return all_results
+
+def save_warm_start_results(num_trials = 3, workers=(1, 4)):
+    for trial_id in range(0, num_trials):
+        for num_workers in workers:
+            save_data(warm_start(trial_id, num_workers), f"warm_start_w{num_workers}_{trial_id}")
+
+def read_telemetry(path):
+    # one dict per iteration, as written by --telemetry
+    with open(path) as f:
+        return [json.loads(line) for line in f if line.strip()]
+
+def convergence(trial_id=0, num_workers=1):
+    # per-iteration phase times, reassignments, distance counts and inertia of each backend,
+    # from the --telemetry lines of one fit
+    file_name = "blobs-n200000-d16-c64"
+    dims = 16
+    num_clusters = 64
+    seed = 8675309
+    threshold = 0.000001
+    max_iters = 300
+    algorithms = {
+        0 : 'sequential',
+        4 : 'elkan',
+        5 : 'hamerly',
+        6 : 'yinyang',
+        7 : 'fused',
+        12 : 'kdtree',
+        13 : 'ivf',
+    }
+
+    make_blobs(file_name, 200000, dims, 64)
+    make_dir("output")
+    telemetry = "output/telemetry.jsonl"
+    all_results = []
+
+    for algorithm, algo_name in algorithms.items():
+        print(f"executing {algo_name} on {file_name} with telemetry workers={num_workers}")
+        cmd = f"./bin/kmeans -k {num_clusters} -d {dims} -i input/{file_name}.txt -m {max_iters} -s {seed} -t {threshold} -a {algorithm} -c -r -w {num_workers} -T {telemetry}"
+        out = check_output(cmd, shell=True, start_new_session=True).decode("ascii")
+        variables = extract_variables(out)
+        variables['algo_name'] = algo_name
+        variables['file_name'] = file_name
+        variables['num_clusters'] = num_clusters
+        variables['num_workers'] = num_workers
+        variables['trial_id'] = trial_id
+        variables['telemetry'] = read_telemetry(telemetry)
+        print({k: v for k, v in variables.items() if k != 'telemetry'})
+        all_results.append(variables)
+        sleep(0.5)
+
+    return all_results
+
+def save_convergence_results(num_trials = 3, workers=(1, 4)):
+    for trial_id in range(0, num_trials):
+        for num_workers in workers:
+            save_data(convergence(trial_id, num_workers), f"convergence_w{num_workers}_{trial_id}")
+
+def bench(trial_id=0, num_workers=1):
+    # the in-process benchmark (make bench) over generated blobs, one row per dataset and backend
+    make_dir("output")
+    csv_file = f"output/bench_w{num_workers}_{trial_id}.csv"
+    cmd = f"./bin/bench_kmeans -n 10000,100000,1000000 -d 2,16,128 -k 4,64,1024 -S 2,8 -W 1 -R 3 -w {num_workers} -o {csv_file}"
+    print(f"executing bench workers={num_workers}")
+    check_output(cmd, shell=True, start_new_session=True)
+    with open(csv_file) as f:
+        rows = list(csv.DictReader(f))
+    for row in rows:
+        row['trial_id'] = trial_id
+    return rows
+
+def save_bench_results(num_trials = 1, workers=(1, 4)):
+    for trial_id in range(0, num_trials):
+        for num_workers in workers:
+            save_data(bench(trial_id, num_workers), f"bench_w{num_workers}_{trial_id}")
+
 def save_results(num_trials = 3, alternate=False):
     for trial_id in range(0, num_trials):
         all_results = default(trial_id, alternate=alternate)
@@ -105,4 +619,17 @@ def save_results(num_trials = 3, alternate=False):
         save_data(all_results, file_name)
 
 save_results(3)
-save_results(3, True)
\ No newline at end of file
+save_results(3, True)
+save_bounded_results(3)
+save_seeding_results(3)
+save_kdtree_results(3)
+save_ivf_results(3)
+save_bisect_results(3)
+save_layout_results(3)
+save_tiling_results(3)
+save_warm_start_results(3)
+save_convergence_results(3)
+if os.path.exists("./bin/kmeans_thrust_omp"):
+    save_thrust_host_results(3)
+if os.path.exists("./bin/bench_kmeans"):
+    save_bench_results(1)
\ No newline at end of file
@@ -1,4 +1,43 @@
 #include <argparse.h>
+#include "seed.h"
+#include "kmeans_minibatch.h"
+#include "point_storage.h"
+#include "point_blocks.h"
+#include "distance_metric.h"
+#include "kmeans_bisect.h"
+
+extern bool timer_debug;
+
+void set_default_opts(struct options_t *opts)
+{
+    opts->show_centroids = false;
+    opts->algorithm = 0;
+    opts->avoid_floating_point_convergence = false;
+    opts->threads = 512;
+    opts->workers = 1;
+    opts->delta_update = 0;
+    opts->init = INIT_RANDOM;
+    opts->init_from = NULL;
+    opts->init_assignments = NULL;
+    opts->telemetry = NULL;
+    opts->batch_size = 1024;
+    opts->batch_order = BATCH_ORDER_SEQUENTIAL;
+    opts->epochs = 1;
+    opts->save_model = NULL;
+    opts->predict_model = NULL;
+    opts->restarts = 1;
+    opts->cluster_counts = NULL;
+    opts->partial_distance = false;
+    opts->storage = STORAGE_FP32;
+    opts->layout = LAYOUT_ROWS;
+    opts->metric = METRIC_EUCLIDEAN;
+    opts->tiled = false;
+    opts->nprobe = 8;
+    opts->exact_every = 10;
+    opts->bisect_split = BISECT_SPLIT_LARGEST;
+    opts->refine = false;
+    opts->context = NULL;
+}
 
 void get_opts(int argc,
               char **argv,
@@ -19,15 +58,46 @@ void get_opts(int argc,
         std::cout << "\t\t 1 = cuda" << std::endl;
         std::cout << "\t\t 2 = cuda_shared_mem" << std::endl;
         std::cout << "\t\t 3 = thrust" << std::endl;
+        std::cout << "\t\t 4 = elkan (triangle-inequality bounded)" << std::endl;
+        std::cout << "\t\t 5 = hamerly (one lower bound per point)" << std::endl;
+        std::cout << "\t\t 6 = yinyang (one lower bound per centroid group)" << std::endl;
+        std::cout << "\t\t 7 = fused (single-pass assign and accumulate)" << std::endl;
+        std::cout << "\t\t 8 = minibatch (streams the input from disk, -m caps the number of batches)" << std::endl;
+        std::cout << "\t\t 9 = mpi (make mpi, then mpirun -np <ranks> bin/kmeans_mpi ...; each rank clusters its shard)" << std::endl;
+        std::cout << "\t\t10 = multirun (--restarts seeds for each of --ks in lock-step, keeps the lowest inertia)" << std::endl;
+        std::cout << "\t\t11 = sparse (CSR input, see sparse_points.h; dense inputs are converted; -w workers)" << std::endl;
+        std::cout << "\t\t12 = kdtree (filtering over a kd-tree of the points, for low dims)" << std::endl;
+        std::cout << "\t\t13 = ivf (approximate assignment through an inverted index over the centroids, for large k)" << std::endl;
+        std::cout << "\t\t14 = bisect (repeated 2-means splits of one cluster until there are k, ignores --init)" << std::endl;
         std::cout << "\t[Optional flag] --avoid_floating_point_convergence or -f (defaults to false)" << std::endl;
         std::cout << "\t[Optional] --threads or -h (defaults to 512)" << std::endl;
+        std::cout << "\t[Optional] --workers or -w CPU worker threads for algorithms 4-7, 10-14 and per rank for 9 (defaults to 1)" << std::endl;
+        std::cout << "\t[Optional] --delta_update or -u <n> incremental centroid updates for algorithms 0 and 7, full recompute every n iterations (defaults to 0 = off)" << std::endl;
+        std::cout << "\t[Optional flag] --partial_distance or -p early-terminating distance search for algorithm 0 (replaces the gemm path)" << std::endl;
+        std::cout << "\t[Optional] --storage or -S fp32|fp16|bf16|int8 point storage for algorithm 7, decoded on the fly (defaults to fp32)" << std::endl;
+        std::cout << "\t[Optional] --layout or -L rows|blocked point layout for algorithms 0 and 7, blocked stores " << POINT_BLOCK << " points dimension-major (defaults to rows)" << std::endl;
+        std::cout << "\t[Optional] --metric or -D euclidean|cosine|l1|mahalanobis distance for algorithms 0 and 7: cosine runs spherical k-means, l1 k-medians, mahalanobis weighs each dimension by its inverse variance (defaults to euclidean)" << std::endl;
+        std::cout << "\t[Optional flag] --tiled or -G assign tiles of points against tiles of centroids sized to the detected L2 and L1 (algorithms 0 and 7)" << std::endl;
+        std::cout << "\t[Optional] --nprobe or -N <n> index lists searched per point by algorithm 13, more is slower and more exact (defaults to 8)" << std::endl;
+        std::cout << "\t[Optional] --exact_every or -E <n> full scan every n-th iteration of algorithm 13, starting with the first (defaults to 10, 0 = never)" << std::endl;
+        std::cout << "\t[Optional] --split or -B largest|sse cluster that algorithm 14 splits next, most points or highest squared error (defaults to largest)" << std::endl;
+        std::cout << "\t[Optional flag] --refine or -F flat k-means (algorithm 7) from the centroids algorithm 14 ends with" << std::endl;
+        std::cout << "\t[Optional] --init or -n random|kmeans++|kmeans|| centroid seeding (defaults to random)" << std::endl;
+        std::cout << "\t[Optional] --init-from or -I <model> start from the centroids of a --save-model file instead of seeding (algorithms 0-7, 12, 13)" << std::endl;
+        std::cout << "\t[Optional] --init-assignments or -A <file> with --init-from, first move each centroid to the mean of the points a previous run's printed clusters gave it" << std::endl;
+        std::cout << "\t[Optional] --batch_size or -b points per mini-batch (defaults to 1024)" << std::endl;
+        std::cout << "\t[Optional] --batch_order or -o sequential|random (defaults to sequential)" << std::endl;
+        std::cout << "\t[Optional] --epochs or -e max passes over the input in minibatch mode (defaults to 1)" << std::endl;
+        std::cout << "\t[Optional] --restarts or -R <n> seeds per k in multirun mode, seed, seed+1, ... (defaults to 1)" << std::endl;
+        std::cout << "\t[Optional] --ks or -K <k1,k2,..> cluster counts to try in multirun mode (defaults to -k)" << std::endl;
+        std::cout << "\t[Optional] --save-model or -M <file> write the final centroids as a binary model" << std::endl;
+        std::cout << "\t[Optional] --predict or -P <model> assign -i to the model's centroids in batches of -b points instead of training" << std::endl;
+        std::cout << "\t[Optional] --telemetry or -T <file> write one JSON line per iteration: phase times, points reassigned, distances, inertia (algorithms 0, 4-7, 12, 13)" << std::endl;
+        std::cout << "\t[Optional flag] --report or -r (print timers and per-iteration stats)" << std::endl;
         exit(0);
     }
 
-    opts->show_centroids = false;
-    opts->algorithm = 0;
-    opts->avoid_floating_point_convergence = false;
-    opts->threads = 512;
+    set_default_opts(opts);
 
     struct option l_opts[] = {
         {"num_clusters", required_argument, NULL, 'k'},
@@ -40,10 +110,34 @@ void get_opts(int argc,
         {"algorithm", optional_argument, NULL, 'a'},
         {"floating_point_convergence", no_argument, NULL, 'f'},
         {"threads", optional_argument, NULL, 'h'},
+        {"report", no_argument, NULL, 'r'},
+        {"workers", required_argument, NULL, 'w'},
+        {"delta_update", required_argument, NULL, 'u'},
+        {"init", required_argument, NULL, 'n'},
+        {"init-from", required_argument, NULL, 'I'},
+        {"init-assignments", required_argument, NULL, 'A'},
+        {"telemetry", required_argument, NULL, 'T'},
+        {"batch_size", required_argument, NULL, 'b'},
+        {"batch_order", required_argument, NULL, 'o'},
+        {"epochs", required_argument, NULL, 'e'},
+        {"save-model", required_argument, NULL, 'M'},
+        {"predict", required_argument, NULL, 'P'},
+        {"restarts", required_argument, NULL, 'R'},
+        {"ks", required_argument, NULL, 'K'},
+        {"partial_distance", no_argument, NULL, 'p'},
+        {"storage", required_argument, NULL, 'S'},
+        {"layout", required_argument, NULL, 'L'},
+        {"metric", required_argument, NULL, 'D'},
+        {"tiled", no_argument, NULL, 'G'},
+        {"nprobe", required_argument, NULL, 'N'},
+        {"exact_every", required_argument, NULL, 'E'},
+        {"split", required_argument, NULL, 'B'},
+        {"refine", no_argument, NULL, 'F'},
+        {0, 0, 0, 0}
     };
 
     int ind, c;
-    while ((c = getopt_long(argc, argv, "k:d:i:m:t:cs:a:fh:", l_opts, &ind)) != -1)
+    while ((c = getopt_long(argc, argv, "k:d:i:m:t:cs:a:fh:rw:u:n:I:A:T:b:o:e:M:P:R:K:pS:L:D:GN:E:B:F", l_opts, &ind)) != -1)
     {
         switch (c)
         {
@@ -79,9 +173,148 @@ void get_opts(int argc,
             case 'h':
                 opts->threads = atoi((char *)optarg);
                 break;
+            case 'r':
+                timer_debug = true;
+                break;
+            case 'w':
+                opts->workers = atoi((char *)optarg);
+                if (opts->workers < 1) {
+                    std::cerr << argv[0] << ": --workers needs at least 1 worker" << std::endl;
+                    exit(1);
+                }
+                break;
+            case 'u':
+                opts->delta_update = atoi((char *)optarg);
+                break;
+            case 'n':
+                if (strcmp(optarg, "kmeans++") == 0)
+                    opts->init = INIT_KMEANS_PLUS_PLUS;
+                else if (strcmp(optarg, "kmeans||") == 0)
+                    opts->init = INIT_KMEANS_PARALLEL;
+                else if (strcmp(optarg, "random") == 0)
+                    opts->init = INIT_RANDOM;
+                else {
+                    std::cerr << argv[0] << ": unknown --init " << optarg << std::endl;
+                    exit(1);
+                }
+                break;
+            case 'b':
+                opts->batch_size = atoi((char *)optarg);
+                break;
+            case 'o':
+                if (strcmp(optarg, "random") == 0)
+                    opts->batch_order = BATCH_ORDER_RANDOM;
+                else if (strcmp(optarg, "sequential") == 0)
+                    opts->batch_order = BATCH_ORDER_SEQUENTIAL;
+                else {
+                    std::cerr << argv[0] << ": unknown --batch_order " << optarg << std::endl;
+                    exit(1);
+                }
+                break;
+            case 'e':
+                opts->epochs = atoi((char *)optarg);
+                break;
+            case 'M':
+                opts->save_model = (char *)optarg;
+                break;
+            case 'P':
+                opts->predict_model = (char *)optarg;
+                break;
+            case 'R':
+                opts->restarts = atoi((char *)optarg);
+                break;
+            case 'K':
+                opts->cluster_counts = (char *)optarg;
+                break;
+            case 'p':
+                opts->partial_distance = true;
+                break;
+            case 'S':
+                opts->storage = parse_storage_format(optarg);
+                if (opts->storage < 0) {
+                    std::cerr << argv[0] << ": unknown --storage " << optarg << std::endl;
+                    exit(1);
+                }
+                break;
+            case 'I':
+                opts->init_from = (char *)optarg;
+                break;
+            case 'A':
+                opts->init_assignments = (char *)optarg;
+                break;
+            case 'T':
+                opts->telemetry = (char *)optarg;
+                break;
+            case 'L':
+                opts->layout = parse_point_layout(optarg);
+                if (opts->layout < 0) {
+                    std::cerr << argv[0] << ": unknown --layout " << optarg << std::endl;
+                    exit(1);
+                }
+                break;
+            case 'D':
+                opts->metric = parse_metric(optarg);
+                if (opts->metric < 0) {
+                    std::cerr << argv[0] << ": unknown --metric " << optarg << std::endl;
+                    exit(1);
+                }
+                break;
+            case 'G':
+                opts->tiled = true;
+                break;
+            case 'N':
+                opts->nprobe = atoi((char *)optarg);
+                break;
+            case 'E':
+                opts->exact_every = atoi((char *)optarg);
+                break;
+            case 'B':
+                opts->bisect_split = parse_bisect_split(optarg);
+                if (opts->bisect_split < 0) {
+                    std::cerr << argv[0] << ": unknown --split " << optarg << std::endl;
+                    exit(1);
+                }
+                break;
+            case 'F':
+                opts->refine = true;
+                break;
             case ':':
                 std::cerr << argv[0] << ": option -" << (char)optopt << "requires an argument." << std::endl;
                 exit(1);
         }
     }
+
+    if (opts->layout == LAYOUT_BLOCKED && (opts->algorithm != 0 && opts->algorithm != 7)) {
+        std::cerr << argv[0] << ": --layout blocked needs algorithm 0 or 7" << std::endl;
+        exit(1);
+    }
+    // the other drivers do their own seeding, and bisect ignores it
+    if (opts->init_from && ((opts->algorithm >= 8 && opts->algorithm <= 11) || opts->algorithm == 14)) {
+        std::cerr << argv[0] << ": --init-from needs one of algorithms 0-7, 12, 13" << std::endl;
+        exit(1);
+    }
+    if (opts->init_assignments && !opts->init_from) {
+        std::cerr << argv[0] << ": --init-assignments needs --init-from" << std::endl;
+        exit(1);
+    }
+    if (opts->telemetry && !(opts->algorithm == 0 || (opts->algorithm >= 4 && opts->algorithm <= 7) || opts->algorithm == 12 ||
+                             opts->algorithm == 13)) {
+        std::cerr << argv[0] << ": --telemetry needs one of algorithms 0, 4-7, 12, 13" << std::endl;
+        exit(1);
+    }
+    // the bounds, trees and indexes of the other backends are built on euclidean geometry
+    if (opts->metric != METRIC_EUCLIDEAN && ((opts->algorithm != 0 && opts->algorithm != 7) || opts->partial_distance ||
+                                             opts->delta_update > 0 || opts->layout == LAYOUT_BLOCKED)) {
+        std::cerr << argv[0] << ": --metric " << metric_name(opts->metric) << " needs algorithm 0 or 7 without -p, -u or --layout blocked" << std::endl;
+        exit(1);
+    }
+    if (opts->tiled && ((opts->algorithm != 0 && opts->algorithm != 7) || opts->layout == LAYOUT_BLOCKED ||
+                        opts->storage != STORAGE_FP32 || opts->metric != METRIC_EUCLIDEAN)) {
+        std::cerr << argv[0] << ": --tiled needs algorithm 0 or 7 with the rows layout, fp32 storage and the euclidean metric" << std::endl;
+        exit(1);
+    }
+    if (opts->layout == LAYOUT_BLOCKED && opts->storage != STORAGE_FP32) {
+        std::cerr << argv[0] << ": --layout blocked needs --storage fp32" << std::endl;
+        exit(1);
+    }
 }
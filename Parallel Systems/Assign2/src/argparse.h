@@ -3,6 +3,9 @@
 #include <getopt.h>
 #include <stdlib.h>
 #include <iostream>
+#include <cstring>
+
+struct kmeans_context_t;
 
 struct options_t {
     int num_clusters;
@@ -15,6 +18,33 @@ struct options_t {
     int algorithm;
     bool avoid_floating_point_convergence;
     int threads;
+    int workers;
+    int delta_update;
+    int init;
+    char *init_from;
+    char *init_assignments;
+    char *telemetry;
+    int batch_size;
+    int batch_order;
+    int epochs;
+    char *save_model;
+    char *predict_model;
+    int restarts;
+    char *cluster_counts;
+    bool partial_distance;
+    int storage;
+    int layout;
+    int metric;
+    bool tiled;
+    int nprobe;
+    int exact_every;
+    int bisect_split;
+    bool refine;
+    struct kmeans_context_t *context;   // workspaces for the backends, see kmeans_context.h
 };
 
+// every optional setting at the default get_opts gives it; k, dims, the input, the iteration
+// limit, the threshold and the seed are left to the caller
+void set_default_opts(struct options_t *opts);
+
 void get_opts(int argc, char **argv, struct options_t *opts);
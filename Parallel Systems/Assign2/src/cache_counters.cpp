@@ -0,0 +1,93 @@
+#include "cache_counters.h"
+
+#include <cstdio>
+
+#ifdef __linux__
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int open_cache_miss_counter(int cache) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long read_counter(int fd) {
+    long long value;
+    if (fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value))
+        return -1;
+    return (long)value;
+}
+
+bool open_cache_counters(cache_counters_t *counters) {
+    counters->l1d_fd = open_cache_miss_counter(PERF_COUNT_HW_CACHE_L1D);
+    counters->llc_fd = open_cache_miss_counter(PERF_COUNT_HW_CACHE_LL);
+    return counters->l1d_fd >= 0 || counters->llc_fd >= 0;
+}
+
+void start_cache_counters(cache_counters_t *counters) {
+    if (counters->l1d_fd >= 0)
+        ioctl(counters->l1d_fd, PERF_EVENT_IOC_ENABLE, 0);
+    if (counters->llc_fd >= 0)
+        ioctl(counters->llc_fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+void stop_cache_counters(cache_counters_t *counters) {
+    if (counters->l1d_fd >= 0)
+        ioctl(counters->l1d_fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (counters->llc_fd >= 0)
+        ioctl(counters->llc_fd, PERF_EVENT_IOC_DISABLE, 0);
+}
+
+long l1d_read_misses(cache_counters_t *counters) {
+    return read_counter(counters->l1d_fd);
+}
+
+long llc_read_misses(cache_counters_t *counters) {
+    return read_counter(counters->llc_fd);
+}
+
+void close_cache_counters(cache_counters_t *counters) {
+    if (counters->l1d_fd >= 0)
+        close(counters->l1d_fd);
+    if (counters->llc_fd >= 0)
+        close(counters->llc_fd);
+    counters->l1d_fd = counters->llc_fd = -1;
+}
+
+#else
+
+bool open_cache_counters(cache_counters_t *counters) {
+    counters->l1d_fd = counters->llc_fd = -1;
+    return false;
+}
+
+void start_cache_counters(cache_counters_t *counters) {}
+
+void stop_cache_counters(cache_counters_t *counters) {}
+
+long l1d_read_misses(cache_counters_t *counters) { return -1; }
+
+long llc_read_misses(cache_counters_t *counters) { return -1; }
+
+void close_cache_counters(cache_counters_t *counters) {}
+
+#endif
+
+void print_cache_misses(cache_counters_t *counters) {
+    if (!counters) {
+        printf("assign_cache_counters: unavailable \n");
+        return;
+    }
+    printf("assign_l1d_misses: %ld assign_llc_misses: %ld \n", l1d_read_misses(counters), llc_read_misses(counters));
+}
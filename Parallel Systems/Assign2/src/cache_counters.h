@@ -0,0 +1,26 @@
+#pragma once
+
+// L1 data and last-level cache read misses of this process (threads started after the open
+// included), counted in user space through perf_event_open while the counters are running.
+// Where the kernel or the CPU doesn't allow one of them its fd stays -1 and it reads as -1.
+struct cache_counters_t {
+    int l1d_fd;
+    int llc_fd;
+};
+
+// opens both counters stopped; returns false when neither could be opened
+bool open_cache_counters(cache_counters_t *counters);
+
+void start_cache_counters(cache_counters_t *counters);
+
+void stop_cache_counters(cache_counters_t *counters);
+
+// total while running so far
+long l1d_read_misses(cache_counters_t *counters);
+
+long llc_read_misses(cache_counters_t *counters);
+
+void close_cache_counters(cache_counters_t *counters);
+
+// the -r lines for the counters; NULL when they could not be opened
+void print_cache_misses(cache_counters_t *counters);
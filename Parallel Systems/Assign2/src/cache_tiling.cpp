@@ -0,0 +1,105 @@
+#include "cache_tiling.h"
+#include "kmeans_sequential.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <unistd.h>
+
+using namespace std;
+
+// size of the first data or unified cache at this level in sysfs, 0 when there is none
+static long sysfs_cache_size(int level) {
+    char path[128];
+    for (int index = 0; index < 8; index++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", index);
+        FILE *f = fopen(path, "r");
+        if (!f)
+            break;
+        int cache_level = 0;
+        bool ok = fscanf(f, "%d", &cache_level) == 1;
+        fclose(f);
+        if (!ok || cache_level != level)
+            continue;
+
+        char type[32] = "";
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", index);
+        f = fopen(path, "r");
+        if (f) {
+            ok = fscanf(f, "%31s", type) == 1;
+            fclose(f);
+        }
+        if (strcmp(type, "Instruction") == 0)
+            continue;
+
+        long size = 0;
+        char unit = 'K';
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+        f = fopen(path, "r");
+        if (f) {
+            if (fscanf(f, "%ld%c", &size, &unit) < 1)
+                size = 0;
+            fclose(f);
+        }
+        return unit == 'M' ? size << 20 : unit == 'K' ? size << 10 : size;
+    }
+    return 0;
+}
+
+static long cache_size(int level, long fallback) {
+    long size = 0;
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+    const int names[] = {_SC_LEVEL1_DCACHE_SIZE, _SC_LEVEL2_CACHE_SIZE, _SC_LEVEL3_CACHE_SIZE};
+    size = sysconf(names[level - 1]);
+#endif
+    if (size <= 0)
+        size = sysfs_cache_size(level);
+    return size > 0 ? size : fallback;
+}
+
+void detect_cache_sizes(cache_sizes_t *caches) {
+    caches->l1d = cache_size(1, 32L << 10);
+    caches->l2 = cache_size(2, 1L << 20);
+    long l3 = cache_size(3, 0);
+    caches->llc = l3 > 0 ? l3 : max(caches->l2, 8L << 20);
+}
+
+void choose_assignment_tiles(int num_clusters, int dims, const cache_sizes_t *caches, assignment_tiles_t *tiles) {
+    long row_bytes = (long)dims * sizeof(real);
+    tiles->centroids = (int)max(1L, min((long)num_clusters, caches->l1d / 2 / row_bytes));
+    // each point also carries its best distance and centroid across the centroid tiles
+    tiles->points = (int)max(1L, caches->l2 / 2 / (row_bytes + (long)sizeof(real) + (long)sizeof(int)));
+}
+
+void nearest_in_tile(int num_clusters, int dims, int count, const real *points, const real *centroids,
+                     const assignment_tiles_t *tiles, int *best_centroid, real *best_distance) {
+    for (int p = 0; p < count; p++) {
+        best_centroid[p] = -1;
+        best_distance[p] = DBL_MAX;
+    }
+    for (int first = 0; first < num_clusters; first += tiles->centroids) {
+        int last = min(num_clusters, first + tiles->centroids);
+        for (int p = 0; p < count; p++) {
+            const real *point = &points[(long)p * dims];
+            int best = best_centroid[p];
+            real nearest = best_distance[p];
+            for (int c = first; c < last; c++) {
+                real distance = squared_distance(point, &centroids[(long)c * dims], dims);
+                if (distance < nearest) {
+                    nearest = distance;
+                    best = c;
+                }
+            }
+            best_centroid[p] = best;
+            best_distance[p] = nearest;
+        }
+    }
+}
+
+void assign_points_to_clusters_tiled(int num_clusters, int dims, int num_points, real *points, int *cluster_id_of_points,
+                                     real *centroids, const assignment_tiles_t *tiles, real *best_distance) {
+    for (int first = 0; first < num_points; first += tiles->points) {
+        int count = min(tiles->points, num_points - first);
+        nearest_in_tile(num_clusters, dims, count, &points[(long)first * dims], centroids, tiles, &cluster_id_of_points[first],
+                        best_distance);
+    }
+}
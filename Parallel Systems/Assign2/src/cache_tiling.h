@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstring>
+#include <cfloat>
+#include <cstdlib>
+
+#include "helpers.h"
+
+// data cache sizes in bytes
+struct cache_sizes_t {
+    long l1d;
+    long l2;
+    long llc;
+};
+
+// From sysconf, then /sys/devices/system/cpu/cpu0/cache, then 32KB / 1MB / 8MB for whatever
+// neither reports.
+void detect_cache_sizes(cache_sizes_t *caches);
+
+// A tile of points is swept against one tile of centroids at a time. The centroid tile takes
+// half of L1, so it stays there while every point of the tile goes past it; the point tile
+// takes half of L2, so each centroid tile re-reads it from there rather than from memory.
+struct assignment_tiles_t {
+    int points;
+    int centroids;
+};
+
+void choose_assignment_tiles(int num_clusters, int dims, const cache_sizes_t *caches, assignment_tiles_t *tiles);
+
+// Nearest centroid of each of the count points at points, one centroid tile after another,
+// carrying every point's best distance and centroid across tiles. Distances are summed in
+// dimension order and the first centroid wins ties, so the result is assign_points_to_clusters'.
+// best_distance is tiles->points reals of scratch.
+void nearest_in_tile(int num_clusters, int dims, int count, const real *points, const real *centroids,
+                     const assignment_tiles_t *tiles, int *best_centroid, real *best_distance);
+
+// assign_points_to_clusters a point tile at a time
+void assign_points_to_clusters_tiled(int num_clusters, int dims, int num_points, real *points, int *cluster_id_of_points,
+                                     real *centroids, const assignment_tiles_t *tiles, real *best_distance);
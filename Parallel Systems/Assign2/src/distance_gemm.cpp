@@ -0,0 +1,174 @@
+#include "distance_gemm.h"
+#include "kmeans_sequential.h"
+
+#include <cmath>
+
+using namespace std;
+
+// register tile: MR points x NR centroids of accumulators
+#define GEMM_MR 4
+#define GEMM_NR 8
+// cache blocks: a KC x NC centroid block (256KB) stays in L2, an MC x KC point block in L1/L2
+#define GEMM_MC 64
+#define GEMM_NC 256
+#define GEMM_KC 256
+// Rounding slack of the expansion against squared_distance, in units of FLT_EPSILON per
+// accumulated term of (||x|| + max ||c||)^2. Both sums are within (dims + 2) * FLT_EPSILON / 2
+// of the exact distance, so twice that for each side, doubled again for safety.
+#define GEMM_RESCORE_SLACK 4
+
+bool use_gemm_assignment(int dims, int num_clusters) {
+    return dims >= GEMM_MIN_DIMS && num_clusters >= GEMM_MIN_CLUSTERS;
+}
+
+void compute_squared_norms(int num_rows, int dims, real *rows, real *norms) {
+    for (int i = 0; i < num_rows; i++) {
+        real norm = 0.0;
+        for (int d = 0; d < dims; d++)
+            norm += rows[i * dims + d] * rows[i * dims + d];
+        norms[i] = norm;
+    }
+}
+
+// Packs rows [row_begin, row_begin + num_rows) into panels of `panel` rows, each stored
+// dimension-major ([dims][panel]) so the micro-kernel reads both operands contiguously.
+// Rows past the end are zero padded.
+static void pack_panels(real *rows, int dims, int row_begin, int num_rows, int panel, real *packed) {
+    int num_panels = (num_rows + panel - 1) / panel;
+    for (int p = 0; p < num_panels; p++) {
+        real *dst = &packed[(long)p * dims * panel];
+        for (int r = 0; r < panel; r++) {
+            int row = p * panel + r;
+            if (row < num_rows) {
+                real *src = &rows[(long)(row_begin + row) * dims];
+                for (int d = 0; d < dims; d++)
+                    dst[d * panel + r] = src[d];
+            } else {
+                for (int d = 0; d < dims; d++)
+                    dst[d * panel + r] = 0.0;
+            }
+        }
+    }
+}
+
+// acc[MR][NR] (+)= A_panel[kc][MR] * B_panel[kc][NR]
+static inline void micro_kernel(int kc, const real *a, const real *b, real *tile, int tile_stride, bool accumulate) {
+    real acc[GEMM_MR][GEMM_NR];
+    for (int r = 0; r < GEMM_MR; r++)
+        for (int j = 0; j < GEMM_NR; j++)
+            acc[r][j] = accumulate ? tile[r * tile_stride + j] : 0.0f;
+
+    for (int p = 0; p < kc; p++) {
+        const real *b_row = &b[p * GEMM_NR];
+        for (int r = 0; r < GEMM_MR; r++) {
+            real a_value = a[p * GEMM_MR + r];
+            for (int j = 0; j < GEMM_NR; j++)
+                acc[r][j] += a_value * b_row[j];
+        }
+    }
+
+    for (int r = 0; r < GEMM_MR; r++)
+        for (int j = 0; j < GEMM_NR; j++)
+            tile[r * tile_stride + j] = acc[r][j];
+}
+
+// each piece of the workspace starts on a cache line
+static long workspace_piece(long reals) {
+    return (reals + 15) / 16 * 16;
+}
+
+long gemm_workspace_size(int num_clusters, int dims) {
+    int padded_clusters = (num_clusters + GEMM_NR - 1) / GEMM_NR * GEMM_NR;
+    return workspace_piece((long)padded_clusters * dims) + workspace_piece((long)GEMM_MC * dims) +
+           workspace_piece(num_clusters) + workspace_piece((long)GEMM_MC * padded_clusters);
+}
+
+void assign_points_to_clusters_gemm(int num_clusters, int dims, int num_points, real *points, real *point_norms,
+                                    int *cluster_id_of_points, real *centroids, real *workspace) {
+    int padded_clusters = (num_clusters + GEMM_NR - 1) / GEMM_NR * GEMM_NR;
+
+    real *packed_centroids = workspace;
+    real *packed_points = packed_centroids + workspace_piece((long)padded_clusters * dims);
+    real *centroid_norms = packed_points + workspace_piece((long)GEMM_MC * dims);
+    real *tile = centroid_norms + workspace_piece(num_clusters);
+    real best_distance[GEMM_MC];
+    int best_centroid[GEMM_MC];
+
+    pack_panels(centroids, dims, 0, num_clusters, GEMM_NR, packed_centroids);
+    compute_squared_norms(num_clusters, dims, centroids, centroid_norms);
+    real max_centroid_norm = 0.0f;
+    for (int c = 0; c < num_clusters; c++)
+        max_centroid_norm = max(max_centroid_norm, centroid_norms[c]);
+    real max_centroid_length = sqrt(max_centroid_norm);
+
+    for (int ic = 0; ic < num_points; ic += GEMM_MC) {
+        int mc = min(GEMM_MC, num_points - ic);
+        int mc_panels = (mc + GEMM_MR - 1) / GEMM_MR;
+        pack_panels(points, dims, ic, mc, GEMM_MR, packed_points);
+
+        for (int r = 0; r < mc; r++) {
+            best_distance[r] = FLT_MAX;
+            best_centroid[r] = -1;
+        }
+
+        for (int jc = 0; jc < num_clusters; jc += GEMM_NC) {
+            int nc = min(GEMM_NC, num_clusters - jc);
+            int nc_panels = (nc + GEMM_NR - 1) / GEMM_NR;
+
+            for (int pc = 0; pc < dims; pc += GEMM_KC) {
+                int kc = min(GEMM_KC, dims - pc);
+                for (int jp = 0; jp < nc_panels; jp++) {
+                    const real *b = &packed_centroids[(long)(jc / GEMM_NR + jp) * dims * GEMM_NR + pc * GEMM_NR];
+                    for (int ip = 0; ip < mc_panels; ip++) {
+                        const real *a = &packed_points[(long)ip * dims * GEMM_MR + pc * GEMM_MR];
+                        micro_kernel(kc, a, b, &tile[(long)ip * GEMM_MR * padded_clusters + jc + jp * GEMM_NR], padded_clusters,
+                                     pc > 0);
+                    }
+                }
+            }
+
+            // epilogue: turn the dot products of this tile into distances in place and fold them into the running argmin
+            for (int r = 0; r < mc; r++) {
+                real point_norm = point_norms[ic + r];
+                real *distances = &tile[(long)r * padded_clusters + jc];
+                for (int j = 0; j < nc; j++) {
+                    real distance = point_norm - 2.0f * distances[j] + centroid_norms[jc + j];
+                    distances[j] = distance;
+                    if (distance < best_distance[r]) {
+                        best_distance[r] = distance;
+                        best_centroid[r] = jc + j;
+                    }
+                }
+            }
+        }
+
+        // The expansion can misorder centroids whose distances are within its rounding error,
+        // so every centroid that close to the best is re-scored with squared_distance, first one
+        // winning ties. A lone candidate is the answer as is.
+        for (int r = 0; r < mc; r++) {
+            const real *point = &points[(long)(ic + r) * dims];
+            const real *distances = &tile[(long)r * padded_clusters];
+            real scale = sqrt(max(point_norms[ic + r], 0.0f)) + max_centroid_length;
+            real margin = GEMM_RESCORE_SLACK * (dims + 2) * FLT_EPSILON * scale * scale;
+            real limit = best_distance[r] + margin;
+
+            int candidates = 0;
+            for (int c = 0; c < num_clusters && candidates < 2; c++)
+                if (distances[c] <= limit)
+                    candidates++;
+            if (candidates > 1) {
+                real nearest = FLT_MAX;
+                for (int c = 0; c < num_clusters; c++) {
+                    if (distances[c] > limit)
+                        continue;
+                    real distance = squared_distance(point, &centroids[(long)c * dims], dims);
+                    if (distance < nearest) {
+                        nearest = distance;
+                        best_centroid[r] = c;
+                    }
+                }
+            }
+            cluster_id_of_points[ic + r] = best_centroid[r];
+        }
+    }
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstring>
+#include <cfloat>
+#include <cstdlib>
+#include <algorithm>
+
+#include "helpers.h"
+
+// kmeans_sequential switches to the gemm assignment once both dims and num_clusters reach these
+#define GEMM_MIN_DIMS 64
+#define GEMM_MIN_CLUSTERS 32
+
+bool use_gemm_assignment(int dims, int num_clusters);
+
+// ||row||^2 for every row of a row-major num_rows x dims matrix
+void compute_squared_norms(int num_rows, int dims, real *rows, real *norms);
+
+// Assigns each point to the centroid minimising ||x||^2 - 2 x.c + ||c||^2. The x.c products come
+// from a cache-blocked, register-tiled matrix multiply of the points against the centroids, and
+// the argmin is taken in the epilogue of each tile, so only an MC x k block of distances exists
+// at a time. Centroids within the expansion's rounding error of the best are re-scored with
+// squared_distance, so the assignment is assign_points_to_clusters'.
+// point_norms must hold compute_squared_norms() of the points, and workspace
+// gemm_workspace_size() reals (cache-line aligned for the packed panels).
+void assign_points_to_clusters_gemm(int num_clusters, int dims, int num_points, real *points, real *point_norms,
+                                    int *cluster_id_of_points, real *centroids, real *workspace);
+
+// reals of scratch assign_points_to_clusters_gemm needs for these sizes
+long gemm_workspace_size(int num_clusters, int dims);
@@ -0,0 +1,66 @@
+#include "distance_metric.h"
+#include "parallel.h"
+
+using namespace std;
+
+int parse_metric(const char *name) {
+    if (strcmp(name, "euclidean") == 0)
+        return METRIC_EUCLIDEAN;
+    if (strcmp(name, "cosine") == 0)
+        return METRIC_COSINE;
+    if (strcmp(name, "l1") == 0)
+        return METRIC_L1;
+    if (strcmp(name, "mahalanobis") == 0)
+        return METRIC_MAHALANOBIS;
+    return -1;
+}
+
+const char *metric_name(int metric) {
+    switch (metric) {
+        case METRIC_COSINE: return "cosine";
+        case METRIC_L1: return "l1";
+        case METRIC_MAHALANOBIS: return "mahalanobis";
+    }
+    return "euclidean";
+}
+
+void diagonal_mahalanobis_weights(int num_points, int dims, real *points, real *weights, double *scratch, int num_workers) {
+    // each worker's sums, then its squared deviations; parallel_for may leave the last workers without a range
+    memset(scratch, 0, (size_t)num_workers * 2 * dims * sizeof(double));
+    parallel_for(num_workers, num_points, [&](int begin, int end, int worker) {
+        double *sums = &scratch[(long)worker * 2 * dims];
+        for (int i = begin; i < end; i++) {
+            const real *point = &points[(long)i * dims];
+            for (int d = 0; d < dims; d++)
+                sums[d] += point[d];
+        }
+    });
+
+    // kept where worker 0's sums were
+    double *means = scratch;
+    for (int d = 0; d < dims; d++) {
+        double sum = 0.0;
+        for (int w = 0; w < num_workers; w++)
+            sum += scratch[(long)w * 2 * dims + d];
+        means[d] = sum / num_points;
+    }
+
+    parallel_for(num_workers, num_points, [&](int begin, int end, int worker) {
+        double *deviations = &scratch[(long)worker * 2 * dims + dims];
+        for (int i = begin; i < end; i++) {
+            const real *point = &points[(long)i * dims];
+            for (int d = 0; d < dims; d++) {
+                double diff = point[d] - means[d];
+                deviations[d] += diff * diff;
+            }
+        }
+    });
+
+    for (int d = 0; d < dims; d++) {
+        double deviations = 0.0;
+        for (int w = 0; w < num_workers; w++)
+            deviations += scratch[(long)w * 2 * dims + dims + d];
+        double variance = deviations / num_points;
+        weights[d] = variance > 0 ? 1.0 / variance : 1.0;
+    }
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstring>
+#include <cmath>
+#include <cstdlib>
+
+#include "helpers.h"
+
+#define METRIC_EUCLIDEAN 0
+#define METRIC_COSINE 1
+#define METRIC_L1 2
+#define METRIC_MAHALANOBIS 3
+
+// what a metric needs besides the two vectors
+struct metric_params_t {
+    real *weights;      // mahalanobis only: 1 / variance of each dimension over the fitted points
+};
+
+// returns one of the METRIC_* values, or -1 for an unknown name
+int parse_metric(const char *name);
+
+const char *metric_name(int metric);
+
+// weights[d] = 1 / variance of dimension d, or 1 where a dimension does not vary. The variance
+// is taken in two passes, around the mean found by the first. scratch is 2 * dims doubles per worker.
+void diagonal_mahalanobis_weights(int num_points, int dims, real *points, real *weights, double *scratch, int num_workers);
+
+// Distance policies. assign_points_to_clusters and the fused backend's row kernel are templated
+// on one of these, so each metric is compiled into its own inner loop. distance() only has to
+// order the centroids like the true distance and sum to the objective the matching update
+// minimizes; update says which centroid update goes with it (see kmeans_metric.h). point_term()
+// is worked out once per point and handed to every distance() from it. The bounds, trees and
+// indexes of the other backends are built on euclidean_metric's geometry and stay with it.
+#define UPDATE_MEAN 0
+#define UPDATE_SPHERICAL 1
+#define UPDATE_MEDIAN 2
+
+// squared euclidean distance, summed in float in dimension order; the default policy
+struct euclidean_metric {
+    static const int id = METRIC_EUCLIDEAN;
+    static const int update = UPDATE_MEAN;
+
+    static inline real point_term(const real *, int) { return 0; }
+
+    static inline real distance(const real *point, real, const real *centroid, int dims, const metric_params_t *) {
+        real distance = 0.0;
+        for (int d = 0; d < dims; d++) {
+            real diff = point[d] - centroid[d];
+            distance += diff * diff;
+        }
+        return distance;
+    }
+};
+
+// 1 - cos, against the unit-length centroids the spherical update leaves. A zero point is
+// at distance 1 from everything.
+struct cosine_metric {
+    static const int id = METRIC_COSINE;
+    static const int update = UPDATE_SPHERICAL;
+
+    // the point's length
+    static inline real point_term(const real *point, int dims) {
+        real norm = 0.0;
+        for (int d = 0; d < dims; d++)
+            norm += point[d] * point[d];
+        return sqrt(norm);
+    }
+
+    static inline real distance(const real *point, real length, const real *centroid, int dims, const metric_params_t *) {
+        real dot = 0.0;
+        for (int d = 0; d < dims; d++)
+            dot += point[d] * centroid[d];
+        return length > 0 ? 1 - dot / length : 1;
+    }
+};
+
+// k-medians: the coordinate-wise median minimizes the summed L1 distance
+struct l1_metric {
+    static const int id = METRIC_L1;
+    static const int update = UPDATE_MEDIAN;
+
+    static inline real point_term(const real *, int) { return 0; }
+
+    static inline real distance(const real *point, real, const real *centroid, int dims, const metric_params_t *) {
+        real distance = 0.0;
+        for (int d = 0; d < dims; d++)
+            distance += fabs(point[d] - centroid[d]);
+        return distance;
+    }
+};
+
+// squared distance with a diagonal inverse covariance; the mean still minimizes it
+struct mahalanobis_metric {
+    static const int id = METRIC_MAHALANOBIS;
+    static const int update = UPDATE_MEAN;
+
+    static inline real point_term(const real *, int) { return 0; }
+
+    static inline real distance(const real *point, real, const real *centroid, int dims, const metric_params_t *params) {
+        const real *weights = params->weights;
+        real distance = 0.0;
+        for (int d = 0; d < dims; d++) {
+            real diff = point[d] - centroid[d];
+            distance += weights[d] * diff * diff;
+        }
+        return distance;
+    }
+};
@@ -1,41 +1,369 @@
 #include <io.h>
+#include "parallel.h"
+
+#include <charconv>
+#include <climits>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// read_file keeps the mapping of a binary input here so free_points can tell it apart
+static mapped_points_t input_mapping = {NULL, 0, 0, NULL, 0};
+
+bool is_binary_point_file(const char *path) {
+	std::ifstream in(path, std::ios::binary);
+	char magic[4] = {0, 0, 0, 0};
+	in.read(magic, sizeof(magic));
+	return in.good() && memcmp(magic, POINT_FILE_MAGIC, sizeof(magic)) == 0;
+}
+
+bool map_point_file(const char *path, mapped_points_t *mapped) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(point_file_header_t)) {
+		close(fd);
+		return false;
+	}
+
+	void *base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return false;
+
+	// the point count is uint64 on disk but an int everywhere else
+	point_file_header_t *header = (point_file_header_t *)base;
+	if (memcmp(header->magic, POINT_FILE_MAGIC, 4) != 0 || header->num_points > INT_MAX || header->dims > INT_MAX ||
+	    (size_t)st.st_size < sizeof(point_file_header_t) + header->num_points * header->dims * sizeof(float)) {
+		munmap(base, st.st_size);
+		return false;
+	}
+	madvise(base, st.st_size, MADV_SEQUENTIAL);
+
+	mapped->base = base;
+	mapped->length = st.st_size;
+	mapped->num_points = header->num_points;
+	mapped->dims = header->dims;
+	mapped->points = (real *)((char *)base + sizeof(point_file_header_t));
+	return true;
+}
+
+void unmap_point_file(mapped_points_t *mapped) {
+	if (mapped->base)
+		munmap(mapped->base, mapped->length);
+	mapped->base = NULL;
+	mapped->points = NULL;
+}
+
+static const char *skip_spaces(const char *p, const char *end) {
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+		p++;
+	return p;
+}
+
+static const char *next_line(const char *p, const char *end) {
+	while (p < end && *p != '\n')
+		p++;
+	return p < end ? p + 1 : end;
+}
+
+// like skip_spaces, but stays on the line
+static const char *skip_blanks(const char *p, const char *end) {
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+		p++;
+	return p;
+}
+
+static bool blank_line(const char *p, const char *end) {
+	for (; p < end && *p != '\n'; p++) {
+		if (*p != ' ' && *p != '\t' && *p != '\r')
+			return false;
+	}
+	return true;
+}
+
+bool blank_text_line(const char *line, const char *end) {
+	return blank_line(line, end);
+}
+
+const char *parse_text_count(const char *p, const char *end, long *num_points) {
+	p = skip_spaces(p, end);
+	std::from_chars_result count = std::from_chars(p, end, *num_points);
+	if (count.ec != std::errc() || *num_points < 0 || !blank_line(count.ptr, end))
+		return NULL;
+	return next_line(count.ptr, end);
+}
+
+bool parse_text_point(const char *line, const char *end, int dims, real *row) {
+	int index;
+	std::from_chars_result parsed = std::from_chars(skip_blanks(line, end), end, index);
+	for (int d = 0; d < dims && parsed.ec == std::errc(); d++)
+		parsed = std::from_chars(skip_blanks(parsed.ptr, end), end, row[d]);
+	return parsed.ec == std::errc() && blank_line(parsed.ptr, end);
+}
+
+int parse_text_points(const char *path, int dims, int num_workers, real **points) {
+	std::ifstream in(path, std::ios::binary | std::ios::ate);
+	if (!in.is_open())
+		return -1;
+	size_t size = in.tellg();
+	std::vector<char> text(size);
+	in.seekg(0);
+	in.read(text.data(), size);
+
+	const char *begin = text.data();
+	const char *end = begin + size;
+
+	long count = 0;
+	const char *data_start = parse_text_count(begin, end, &count);
+	if (!data_start || count > INT_MAX) {
+		std::cerr << path << ": the first line must be a point count up to " << INT_MAX << std::endl;
+		return -1;
+	}
+	int num_points = count;
+
+	*points = (real *)malloc((long)num_points * dims * sizeof(real));
+	if (!*points && num_points > 0)
+		return -1;
+
+	// line-aligned byte range per worker
+	std::vector<const char *> range_start(num_workers + 1);
+	range_start[0] = data_start;
+	range_start[num_workers] = end;
+	for (int w = 1; w < num_workers; w++) {
+		const char *split = data_start + (end - data_start) * w / num_workers;
+		range_start[w] = std::max(range_start[w - 1], split > data_start ? next_line(split - 1, end) : data_start);
+	}
+
+	// first pass counts the points in each range, so the second knows where its rows start
+	std::vector<int> first_row(num_workers + 1, 0);
+	parallel_for(num_workers, num_workers, [&](int first, int last, int worker) {
+		for (int w = first; w < last; w++) {
+			int rows = 0;
+			for (const char *line = range_start[w]; line < range_start[w + 1]; line = next_line(line, end))
+				rows += blank_line(line, end) ? 0 : 1;
+			first_row[w + 1] = rows;
+		}
+	});
+	for (int w = 0; w < num_workers; w++)
+		first_row[w + 1] += first_row[w];
+
+	// every line must be an index and exactly dims values; each range keeps its first bad row
+	std::vector<int> bad_row(num_workers, -1);
+	parallel_for(num_workers, num_workers, [&](int first, int last, int worker) {
+		for (int w = first; w < last; w++) {
+			int row = first_row[w];
+			for (const char *line = range_start[w]; line < range_start[w + 1] && row < num_points; line = next_line(line, end)) {
+				if (blank_line(line, end))
+					continue;
+				if (!parse_text_point(line, end, dims, &(*points)[(long)row * dims])) {
+					bad_row[w] = row;
+					break;
+				}
+				row++;
+			}
+		}
+	});
+
+	for (int w = 0; w < num_workers; w++) {
+		if (bad_row[w] >= 0) {
+			std::cerr << path << ": point " << bad_row[w] + 1 << " is not an index followed by " << dims << " numbers" << std::endl;
+			free(*points);
+			*points = NULL;
+			return -1;
+		}
+	}
+	if (first_row[num_workers] != num_points) {
+		std::cerr << path << ": the first line says " << num_points << " points but " << first_row[num_workers] << " follow" << std::endl;
+		free(*points);
+		*points = NULL;
+		return -1;
+	}
+	return num_points;
+}
+
+bool write_binary_points(const char *path, int num_points, int dims, real *points) {
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	if (!out.is_open())
+		return false;
+	point_file_header_t header;
+	memcpy(header.magic, POINT_FILE_MAGIC, 4);
+	header.dims = dims;
+	header.num_points = num_points;
+	out.write((const char *)&header, sizeof(header));
+	out.write((const char *)points, (long)num_points * dims * sizeof(real));
+	return out.good();
+}
+
+bool write_text_points(const char *path, int num_points, int dims, real *points) {
+	FILE *out = fopen(path, "w");
+	if (!out)
+		return false;
+	fprintf(out, "%d\n", num_points);
+	for (int i = 0; i < num_points; i++) {
+		fprintf(out, "%d", i + 1);
+		for (int d = 0; d < dims; d++)
+			fprintf(out, " %.9g", points[(long)i * dims + d]);
+		fprintf(out, "\n");
+	}
+	return fclose(out) == 0;
+}
+
+bool save_model(const char *path, int num_clusters, int dims, real *centroids) {
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	if (!out.is_open())
+		return false;
+	model_file_header_t header;
+	memcpy(header.magic, MODEL_FILE_MAGIC, 4);
+	header.num_clusters = num_clusters;
+	header.dims = dims;
+	out.write((const char *)&header, sizeof(header));
+	out.write((const char *)centroids, (long)num_clusters * dims * sizeof(real));
+	return out.good();
+}
+
+bool load_model(const char *path, int *num_clusters, int *dims, real **centroids) {
+	std::ifstream in(path, std::ios::binary);
+	model_file_header_t header;
+	in.read((char *)&header, sizeof(header));
+	if (!in.good() || memcmp(header.magic, MODEL_FILE_MAGIC, 4) != 0)
+		return false;
+
+	*num_clusters = header.num_clusters;
+	*dims = header.dims;
+	*centroids = (real *)malloc((long)header.num_clusters * header.dims * sizeof(real));
+	in.read((char *)*centroids, (long)header.num_clusters * header.dims * sizeof(real));
+	if (!in.good()) {
+		free(*centroids);
+		return false;
+	}
+	return true;
+}
+
+// reads exactly bytes from fd, or says it could not
+static bool read_exact(int fd, void *buffer, size_t bytes) {
+	char *next = (char *)buffer;
+	while (bytes > 0) {
+		ssize_t got = read(fd, next, bytes);
+		if (got <= 0)
+			return false;
+		next += got;
+		bytes -= got;
+	}
+	return true;
+}
+
+bool read_model(const char *path, int num_clusters, int dims, real *centroids) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	model_file_header_t header;
+	bool fits = read_exact(fd, &header, sizeof(header)) && memcmp(header.magic, MODEL_FILE_MAGIC, 4) == 0 &&
+	            header.num_clusters == (uint32_t)num_clusters && header.dims == (uint32_t)dims &&
+	            read_exact(fd, centroids, (long)num_clusters * dims * sizeof(real));
+	close(fd);
+	return fits;
+}
+
+// whitespace separated tokens of a file, read through a fixed buffer so nothing is allocated
+struct token_reader_t {
+	int fd;
+	size_t begin;
+	size_t end;
+	char buffer[1 << 16];
+};
+
+static bool is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+// the next token, valid until the next call; one longer than the buffer comes back cut
+static bool next_token(token_reader_t *reader, const char **token, size_t *length) {
+	while (true) {
+		while (reader->begin < reader->end && is_space(reader->buffer[reader->begin]))
+			reader->begin++;
+		if (reader->begin < reader->end)
+			break;
+		ssize_t got = read(reader->fd, reader->buffer, sizeof(reader->buffer));
+		if (got <= 0)
+			return false;
+		reader->begin = 0;
+		reader->end = got;
+	}
+
+	size_t last = reader->begin;
+	while (true) {
+		while (last < reader->end && !is_space(reader->buffer[last]))
+			last++;
+		if (last < reader->end || reader->end - reader->begin == sizeof(reader->buffer))
+			break;
+		// the token runs past the buffer: move it to the front and read the rest
+		memmove(reader->buffer, &reader->buffer[reader->begin], reader->end - reader->begin);
+		reader->end -= reader->begin;
+		last -= reader->begin;
+		reader->begin = 0;
+		ssize_t got = read(reader->fd, &reader->buffer[reader->end], sizeof(reader->buffer) - reader->end);
+		if (got <= 0)
+			break;
+		reader->end += got;
+	}
+	*token = &reader->buffer[reader->begin];
+	*length = last - reader->begin;
+	reader->begin = last;
+	return true;
+}
+
+int load_assignments(const char *path, int *cluster_id_of_points, int capacity) {
+	token_reader_t reader;
+	reader.fd = open(path, O_RDONLY);
+	if (reader.fd < 0)
+		return -1;
+	reader.begin = 0;
+	reader.end = 0;
+
+	const char *token;
+	size_t length;
+	while (next_token(&reader, &token, &length) && !(length == 9 && memcmp(token, "clusters:", 9) == 0))
+		;
+	int count = 0;
+	while (count < capacity && next_token(&reader, &token, &length)) {
+		std::from_chars_result parsed = std::from_chars(token, token + length, cluster_id_of_points[count]);
+		if (parsed.ec != std::errc() || parsed.ptr != token + length)
+			break;
+		count++;
+	}
+	close(reader.fd);
+	return count > 0 ? count : -1;
+}
 
 void read_file(struct options_t* args,
                int*              n_vals,
                real**          input_vals) {
 
-  	// Open file
-	std::ifstream in;
-	in.open(args->in_file);
-	// Get num vals
-	in >> *n_vals;
+	if (is_binary_point_file(args->in_file)) {
+		if (!map_point_file(args->in_file, &input_mapping) || input_mapping.dims != args->dims) {
+			std::cerr << "cannot map " << args->in_file << " as a " << args->dims << "-dimensional point file" << std::endl;
+			exit(1);
+		}
+		*n_vals = input_mapping.num_points;
+		*input_vals = input_mapping.points;
+		return;
+	}
 
-	// Alloc input and output arrays
-	*input_vals = (real*) malloc(*n_vals * args -> dims * sizeof(real));
+	*n_vals = parse_text_points(args->in_file, args->dims, args->workers, input_vals);
+	if (*n_vals < 0) {
+		std::cerr << "cannot read " << args->in_file << std::endl;
+		exit(1);
+	}
+}
 
-	int index;
-	// Read input vals
-	for (int i = 0; i < (*n_vals) * args->dims; ++i) {
-		in >> index;
-		in >> (*input_vals)[i];
-	}
-}
-
-// void write_file(struct options_t*         args,
-//                	struct prefix_sum_args_t* opts) {
-//   // Open file
-// 	std::ofstream out;
-// 	out.open(args->out_file, std::ofstream::trunc);
-
-// 	// Write solution to output file
-// 	for (int i = 0; i < opts->n_vals; ++i) {
-// 		out << opts->output_vals[i] << std::endl;
-// 	}
-
-// 	out.flush();
-// 	out.close();
-	
-// 	// Free memory
-// 	free(opts->input_vals);
-// 	free(opts->output_vals);
-// }
+void free_points(real *input_vals) {
+	if (input_mapping.base && input_vals == input_mapping.points)
+		unmap_point_file(&input_mapping);
+	else
+		free(input_vals);
+}
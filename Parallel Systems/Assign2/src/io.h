@@ -3,11 +3,83 @@
 #include <argparse.h>
 #include <iostream>
 #include <fstream>
+#include <cstdint>
 #include "helpers.h"
 
+// Binary point file: this header, then num_points * dims float32 values, row-major.
+#define POINT_FILE_MAGIC "KMB1"
+
+struct point_file_header_t {
+    char magic[4];
+    uint32_t dims;
+    uint64_t num_points;
+};
+
+// Model file: this header, then num_clusters * dims float32 centroids, row-major.
+#define MODEL_FILE_MAGIC "KMM1"
+
+struct model_file_header_t {
+    char magic[4];
+    uint32_t num_clusters;
+    uint32_t dims;
+};
+
+struct mapped_points_t {
+    real *points;
+    long num_points;
+    int dims;
+    void *base;
+    size_t length;
+};
+
+bool is_binary_point_file(const char *path);
+
+// maps a binary point file copy-on-write, so the points can be used in place; fails on more
+// than INT_MAX points
+bool map_point_file(const char *path, mapped_points_t *mapped);
+
+void unmap_point_file(mapped_points_t *mapped);
+
+// The line parsers of the text format, for readers that take it a line at a time. end may be
+// the end of the whole text: a line stops at the first newline. Lines may be surrounded by blanks.
+bool blank_text_line(const char *line, const char *end);
+
+// Parses the count line, skipping blank lines before it. Returns the start of the line after
+// it, or NULL if the line is not a single non-negative count.
+const char *parse_text_count(const char *p, const char *end, long *num_points);
+
+// parses one "index x_0 .. x_dims-1" point line into row; false unless the line is an index and exactly dims numbers
+bool parse_text_point(const char *line, const char *end, int dims, real *row);
+
+// Parses the text format (point count, then one "index x_0 .. x_dims-1" line per point) with
+// std::from_chars, splitting the file into line-aligned byte ranges across num_workers threads.
+// Returns the number of points, or -1 (after saying why on stderr for malformed text) if the
+// file can't be read, a line isn't an index and exactly dims numbers, or the number of lines
+// isn't the count.
+int parse_text_points(const char *path, int dims, int num_workers, real **points);
+
+bool write_binary_points(const char *path, int num_points, int dims, real *points);
+
+bool write_text_points(const char *path, int num_points, int dims, real *points);
+
+bool save_model(const char *path, int num_clusters, int dims, real *centroids);
+
+// Reads a model written by save_model into a new buffer, setting its cluster count and dims.
+bool load_model(const char *path, int *num_clusters, int *dims, real **centroids);
+
+// Reads a model written by save_model into centroids, which must be num_clusters x dims.
+// Returns false if the file can't be read or has another shape. Allocates nothing.
+bool read_model(const char *path, int num_clusters, int dims, real *centroids);
+
+// Reads the ids a clustering run prints after "clusters:" (anything before that is skipped)
+// into cluster_id_of_points, at most capacity of them. Returns how many were read, or -1 if
+// the file can't be read or has none. Allocates nothing.
+int load_assignments(const char *path, int *cluster_id_of_points, int capacity);
+
+// Loads args->in_file, binary (memory-mapped) or text (parallel parser) by its magic.
+// The points must be released with free_points().
 void read_file(struct options_t* args,
                int*              n_vals,
                real**             input_vals);
 
-// void write_file(struct options_t*         args,
-//                 struct prefix_sum_args_t* opts);
+void free_points(real *input_vals);
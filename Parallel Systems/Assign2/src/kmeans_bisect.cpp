@@ -0,0 +1,287 @@
+#include "kmeans_bisect.h"
+
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+extern bool debug;
+extern bool timer_debug;
+
+int parse_bisect_split(const char *name) {
+    if (strcmp(name, "largest") == 0)
+        return BISECT_SPLIT_LARGEST;
+    if (strcmp(name, "sse") == 0)
+        return BISECT_SPLIT_SSE;
+    return -1;
+}
+
+struct bisect_leaf_t {
+    int begin;          // rows [begin, end) of order
+    int end;
+    double sse;
+    bool splittable;
+};
+
+struct bisect_split_t {
+    int leaf;
+    unsigned long rng;
+    bool ok;
+    int middle;
+    int iterations;
+    double sse[2];
+    real *centroids;    // 2 x dims
+    // scratch: side and right cover the split's rows of order, the rest is this split's alone
+    unsigned char *side;
+    int *right;
+    real *old_centroids;
+    double *sums;       // workers x 2 x dims
+    int *counts;        // workers x 2
+    double *worker_sse; // workers x 2
+};
+
+// same generator as k_means_rand, with the state held by the caller so splits can run concurrently
+static int split_rand(unsigned long *state) {
+    *state = *state * 1103515245 + 12345;
+    return (unsigned int)(*state / 65536) % 32768;
+}
+
+// 2-means over the points order[begin, end): a Lloyd run from two distinct random points, after
+// which the range is reordered so the first half keeps split->centroids[0]. Fails when no two
+// distinct points turn up or a side ends up empty.
+static void two_means(int dims, real *points, int *order, int begin, int end, int max_num_iters, real threshold,
+                      int num_workers, bisect_split_t *split) {
+    int count = end - begin;
+    real *pair = split->centroids;
+    split->ok = false;
+    split->iterations = 0;
+
+    bool seeded = false;
+    for (int attempt = 0; attempt < BISECT_SEED_TRIES && !seeded; attempt++) {
+        int a = begin + (split_rand(&split->rng) * 32768 + split_rand(&split->rng)) % count;
+        int b = begin + (split_rand(&split->rng) * 32768 + split_rand(&split->rng)) % count;
+        real *first = &points[(long)order[a] * dims];
+        real *second = &points[(long)order[b] * dims];
+        if (squared_distance(first, second, dims) > 0) {
+            memcpy(&pair[0], first, dims * sizeof(real));
+            memcpy(&pair[dims], second, dims * sizeof(real));
+            seeded = true;
+        }
+    }
+    if (!seeded)
+        return;
+
+    unsigned char *side = split->side;
+    real *old_pair = split->old_centroids;
+    double *sums = split->sums;
+    int *counts = split->counts;
+    double *sse = split->worker_sse;
+
+    bool done = false;
+    while (!done) {
+        memcpy(old_pair, pair, 2 * dims * sizeof(real));
+        memset(sums, 0, (long)num_workers * 2 * dims * sizeof(double));
+        memset(counts, 0, num_workers * 2 * sizeof(int));
+
+        parallel_for(num_workers, count, [&](int range_begin, int range_end, int worker) {
+            double *worker_sums = &sums[(long)worker * 2 * dims];
+            for (int j = range_begin; j < range_end; j++) {
+                real *point = &points[(long)order[begin + j] * dims];
+                int s = squared_distance(point, &pair[dims], dims) < squared_distance(point, &pair[0], dims) ? 1 : 0;
+                side[j] = s;
+                counts[worker * 2 + s]++;
+                for (int d = 0; d < dims; d++)
+                    worker_sums[s * dims + d] += point[d];
+            }
+        });
+
+        int total[2] = {0, 0};
+        for (int s = 0; s < 2; s++) {
+            for (int w = 0; w < num_workers; w++)
+                total[s] += counts[w * 2 + s];
+            for (int d = 0; d < dims; d++) {
+                double sum = 0.0;
+                for (int w = 0; w < num_workers; w++)
+                    sum += sums[((long)w * 2 + s) * dims + d];
+                pair[s * dims + d] = total[s] > 0 ? sum / total[s] : 0.0;
+            }
+        }
+        split->iterations++;
+        if (total[0] == 0 || total[1] == 0)
+            break;
+
+        done = split->iterations > max_num_iters || converged(2, dims, threshold, old_pair, pair);
+        if (done)
+            split->ok = true;
+    }
+
+    if (split->ok) {
+        // each side's error against its own mean
+        memset(sse, 0, num_workers * 2 * sizeof(double));
+        parallel_for(num_workers, count, [&](int range_begin, int range_end, int worker) {
+            for (int j = range_begin; j < range_end; j++)
+                sse[worker * 2 + side[j]] += squared_distance(&points[(long)order[begin + j] * dims], &pair[side[j] * dims], dims);
+        });
+        split->sse[0] = split->sse[1] = 0.0;
+        for (int w = 0; w < num_workers; w++) {
+            split->sse[0] += sse[w * 2];
+            split->sse[1] += sse[w * 2 + 1];
+        }
+
+        int *right = split->right;
+        int num_right = 0;
+        int left = begin;
+        for (int j = 0; j < count; j++) {
+            if (side[j] == 0)
+                order[left++] = order[begin + j];
+            else
+                right[num_right++] = order[begin + j];
+        }
+        memcpy(&order[left], right, num_right * sizeof(int));
+        split->middle = left;
+    }
+}
+
+int kmeans_bisect(int num_points, real *points, struct options_t *opts, int *cluster_id_of_points, real *centroids) {
+    int dims = opts->dims;
+    int num_clusters = opts->num_clusters;
+    int num_workers = opts->workers;
+
+    auto bisect_start = chrono::high_resolution_clock::now();
+
+    kmeans_context_t *context = opts->context;
+    int *order = context_array<int>(context, CONTEXT_BISECT, SLOT_BISECT_ORDER, num_points);
+    for (int i = 0; i < num_points; i++)
+        order[i] = i;
+
+    // the root: every point, its mean and error
+    memset(centroids, 0, num_clusters * dims * sizeof(real));
+    double *mean = context_array<double>(context, CONTEXT_BISECT, SLOT_BISECT_MEAN, dims);
+    memset(mean, 0, dims * sizeof(double));
+    for (int i = 0; i < num_points; i++)
+        for (int d = 0; d < dims; d++)
+            mean[d] += points[(long)i * dims + d];
+    for (int d = 0; d < dims; d++)
+        centroids[d] = num_points > 0 ? mean[d] / num_points : 0.0;
+    double root_sse = 0.0;
+    for (int i = 0; i < num_points; i++)
+        root_sse += squared_distance(&points[(long)i * dims], centroids, dims);
+
+    // a round never holds more splits than there are clusters left to make, and the 2-means
+    // runs of a round share out at most max(workers, k) worker slots between them
+    int task_slots = max(num_workers, num_clusters);
+    bisect_leaf_t *leaves = context_array<bisect_leaf_t>(context, CONTEXT_BISECT, SLOT_BISECT_LEAVES, num_clusters);
+    int *candidates = context_array<int>(context, CONTEXT_BISECT, SLOT_BISECT_CANDIDATES, num_clusters);
+    bisect_split_t *round = context_array<bisect_split_t>(context, CONTEXT_BISECT, SLOT_BISECT_ROUND, num_clusters);
+    real *pairs = context_array<real>(context, CONTEXT_BISECT, SLOT_BISECT_PAIRS, (long)num_clusters * 2 * dims);
+    real *old_pairs = context_array<real>(context, CONTEXT_BISECT, SLOT_BISECT_OLD_PAIRS, (long)num_clusters * 2 * dims);
+    unsigned char *side = context_array<unsigned char>(context, CONTEXT_BISECT, SLOT_BISECT_SIDE, num_points);
+    int *right = context_array<int>(context, CONTEXT_BISECT, SLOT_BISECT_RIGHT, num_points);
+    double *sums = context_array<double>(context, CONTEXT_BISECT, SLOT_BISECT_SUMS, (long)task_slots * 2 * dims);
+    int *counts = context_array<int>(context, CONTEXT_BISECT, SLOT_BISECT_COUNTS, task_slots * 2);
+    double *worker_sse = context_array<double>(context, CONTEXT_BISECT, SLOT_BISECT_SSE, task_slots * 2);
+    leaves[0] = {0, num_points, root_sse, num_points > 1};
+    int num_leaves = 1;
+    int rounds = 0;
+    int splits = 0;
+    long two_means_iterations = 0;
+
+    auto score = [&](const bisect_leaf_t &leaf) {
+        return opts->bisect_split == BISECT_SPLIT_SSE ? leaf.sse : (double)(leaf.end - leaf.begin);
+    };
+
+    while (num_leaves < num_clusters) {
+        int num_candidates = 0;
+        for (int l = 0; l < num_leaves; l++)
+            if (leaves[l].splittable && leaves[l].end - leaves[l].begin > 1)
+                candidates[num_candidates++] = l;
+        if (num_candidates == 0)
+            break;
+        // ties keep leaf order; sort rather than stable_sort, which allocates
+        sort(candidates, candidates + num_candidates, [&](int a, int b) {
+            return score(leaves[a]) > score(leaves[b]) || (score(leaves[a]) == score(leaves[b]) && a < b);
+        });
+
+        double top = score(leaves[candidates[0]]);
+        int room = num_clusters - num_leaves;
+        int num_tasks = 0;
+        for (int c = 0; c < num_candidates; c++) {
+            int l = candidates[c];
+            if (num_tasks == room || score(leaves[l]) < BISECT_ROUND_FRACTION * top)
+                break;
+            bisect_split_t &split = round[num_tasks];
+            split.leaf = l;
+            // one stream per split in the order the splits are made, whatever the worker count
+            split.rng = (unsigned long)opts->seed + 7919ul * (splits + num_tasks);
+            split.centroids = &pairs[(long)num_tasks * 2 * dims];
+            num_tasks++;
+        }
+
+        // independent subtrees run side by side; spare workers go into each 2-means
+        int task_workers = max(1, num_workers / num_tasks);
+        for (int t = 0; t < num_tasks; t++) {
+            bisect_split_t &split = round[t];
+            split.side = &side[leaves[split.leaf].begin];
+            split.right = &right[leaves[split.leaf].begin];
+            split.old_centroids = &old_pairs[(long)t * 2 * dims];
+            split.sums = &sums[(long)t * task_workers * 2 * dims];
+            split.counts = &counts[t * task_workers * 2];
+            split.worker_sse = &worker_sse[t * task_workers * 2];
+        }
+        parallel_for(min(num_workers, num_tasks), num_tasks, [&](int begin, int end, int worker) {
+            for (int t = begin; t < end; t++) {
+                bisect_leaf_t &leaf = leaves[round[t].leaf];
+                two_means(dims, points, order, leaf.begin, leaf.end, opts->max_num_iter, opts->threshold, task_workers, &round[t]);
+            }
+        });
+
+        for (int t = 0; t < num_tasks; t++) {
+            bisect_split_t &split = round[t];
+            two_means_iterations += split.iterations;
+            if (!split.ok) {
+                leaves[split.leaf].splittable = false;
+                continue;
+            }
+            int right = num_leaves++;
+            leaves[right] = {split.middle, leaves[split.leaf].end, split.sse[1], true};
+            leaves[split.leaf].end = split.middle;
+            leaves[split.leaf].sse = split.sse[0];
+            memcpy(&centroids[(long)split.leaf * dims], &split.centroids[0], dims * sizeof(real));
+            memcpy(&centroids[(long)right * dims], &split.centroids[dims], dims * sizeof(real));
+            splits++;
+        }
+        rounds++;
+
+        if(timer_debug)
+            printf("bisect_round: %d clusters: %d splits: %d \n", rounds, num_leaves, num_tasks);
+    }
+
+    // clusters that could not be made keep a zero centroid and no points, like empty ones
+    double total_sse = 0.0;
+    for (int l = 0; l < num_leaves; l++) {
+        total_sse += leaves[l].sse;
+        for (int j = leaves[l].begin; j < leaves[l].end; j++)
+            cluster_id_of_points[order[j]] = l;
+    }
+    auto bisect_time = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - bisect_start);
+
+    if(timer_debug) {
+        printf("bisect_time: %f ms \n", bisect_time.count());
+        printf("bisect_rounds: %d splits: %d two_means_iterations: %ld \n", rounds, splits, two_means_iterations);
+        printf("bisect_sse: %f \n", total_sse);
+    }
+
+    if(debug){
+        cout << "*********** BISECT CENTROIDS ***********" << endl;
+        print_centroids(centroids, num_clusters, dims);
+    }
+
+    int refine_iterations = 0;
+    if (opts->refine) {
+        refine_iterations = kmeans_fused(num_points, points, opts, cluster_id_of_points, centroids);
+        if(timer_debug)
+            printf("bisect_refine_iterations: %d \n", refine_iterations);
+    }
+
+    return rounds + refine_iterations;
+}
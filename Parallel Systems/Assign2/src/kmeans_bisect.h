@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+
+#include "argparse.h"
+#include "helpers.h"
+#include "kmeans_sequential.h"
+#include "kmeans_fused.h"
+#include "parallel.h"
+
+#define BISECT_SPLIT_LARGEST 0
+#define BISECT_SPLIT_SSE 1
+
+// a round splits every cluster scoring at least this fraction of the round's top score
+#define BISECT_ROUND_FRACTION 0.5
+// attempts at drawing two distinct seed points before a cluster is declared unsplittable
+#define BISECT_SEED_TRIES 8
+
+// "largest" or "sse"; -1 when unknown
+int parse_bisect_split(const char *name);
+
+// Bisecting k-means: starting from one cluster holding every point, the cluster with the most
+// points (--split largest) or the highest sum of squared errors (--split sse) is split with a
+// 2-means run until there are k clusters. Each round splits all the clusters scoring at least
+// half of the top one, in parallel; the rounds are chosen the same way whatever -w is, and the
+// workers left over when a round has fewer clusters than workers go to the 2-means assignment. With
+// --refine the result seeds kmeans_fused for a flat pass over all k. The centroids from the
+// main seeding are ignored. Returns the number of rounds plus the refinement iterations.
+int kmeans_bisect(int num_points, real *points, struct options_t *opts, int* cluster_id_of_points, real* centroids);
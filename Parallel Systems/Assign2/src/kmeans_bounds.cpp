@@ -0,0 +1,42 @@
+#include "kmeans_bounds.h"
+
+using namespace std;
+
+double bound_slack(int dims) {
+    return 4.0 * (dims + 2) * FLT_EPSILON;
+}
+
+void compute_centroid_distances(int num_clusters, int dims, real *centroids, double slack, double *centroid_distances, double *half_nearest) {
+    for (int c = 0; c < num_clusters; c++) {
+        if (centroid_distances)
+            centroid_distances[c * num_clusters + c] = 0.0;
+        half_nearest[c] = DBL_MAX;
+    }
+    for (int c = 0; c < num_clusters; c++) {
+        for (int c2 = c + 1; c2 < num_clusters; c2++) {
+            double distance = 0.0;
+            for (int d = 0; d < dims; d++) {
+                double diff = (double)centroids[c * dims + d] - centroids[c2 * dims + d];
+                distance += diff * diff;
+            }
+            distance = sqrt(distance) * (1.0 - slack);
+            if (centroid_distances) {
+                centroid_distances[c * num_clusters + c2] = distance;
+                centroid_distances[c2 * num_clusters + c] = distance;
+            }
+            half_nearest[c] = min(half_nearest[c], 0.5 * distance);
+            half_nearest[c2] = min(half_nearest[c2], 0.5 * distance);
+        }
+    }
+}
+
+void compute_drift(int num_clusters, int dims, real *old_centroids, real *new_centroids, double *drift) {
+    for (int c = 0; c < num_clusters; c++) {
+        double distance = 0.0;
+        for (int d = 0; d < dims; d++) {
+            double diff = (double)new_centroids[c * dims + d] - old_centroids[c * dims + d];
+            distance += diff * diff;
+        }
+        drift[c] = sqrt(distance);
+    }
+}
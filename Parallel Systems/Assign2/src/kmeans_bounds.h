@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+
+#include "helpers.h"
+
+// Shared pieces of the triangle-inequality bounded algorithms (elkan, hamerly, yinyang).
+//
+// Bounds are derived from float distances, so they are padded by the worst-case rounding
+// error of a dims-long float sum. A centroid is only pruned when it is strictly farther
+// than the current one, which keeps the assignment identical to the exhaustive scan.
+double bound_slack(int dims);
+
+// pairwise centroid distances (may be NULL) and half the distance to each centroid's nearest other centroid
+void compute_centroid_distances(int num_clusters, int dims, real *centroids, double slack, double *centroid_distances, double *half_nearest);
+
+// how far each centroid moved in the last update
+void compute_drift(int num_clusters, int dims, real *old_centroids, real *new_centroids, double *drift);
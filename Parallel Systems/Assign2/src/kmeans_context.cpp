@@ -0,0 +1,192 @@
+#include "kmeans_context.h"
+#include "seed.h"
+#include "io.h"
+#include "kmeans_sequential.h"
+#ifndef KMEANS_NO_CUDA
+#include "kmeans_cuda.h"
+#endif
+#ifndef KMEANS_NO_THRUST
+#include "kmeans_thrust.h"
+#endif
+#include "kmeans_elkan.h"
+#include "kmeans_hamerly.h"
+#include "kmeans_yinyang.h"
+#include "kmeans_fused.h"
+#include "kmeans_kdtree.h"
+#include "kmeans_ivf.h"
+#include "kmeans_bisect.h"
+#include "kmeans_predict.h"
+
+#include <cassert>
+#include <chrono>
+#include <iostream>
+
+using namespace std;
+
+void init_kmeans_context(struct kmeans_context_t *context) {
+    memset(context, 0, sizeof(*context));
+}
+
+void free_kmeans_context(struct kmeans_context_t *context) {
+    for (int owner = 0; owner < CONTEXT_OWNERS; owner++)
+        for (int slot = 0; slot < CONTEXT_SLOTS; slot++)
+            free(context->workspaces[owner][slot].data);
+    memset(context, 0, sizeof(*context));
+}
+
+bool telemetry_enabled(struct kmeans_context_t *context) {
+    return context && context->telemetry && context->telemetry->out;
+}
+
+void *context_workspace(struct kmeans_context_t *context, int owner, int slot, size_t bytes) {
+    assert(owner < CONTEXT_OWNERS && slot < CONTEXT_SLOTS);
+    context_workspace_t *workspace = &context->workspaces[owner][slot];
+    if (bytes > workspace->capacity) {
+        // rounded up to whole cache lines, so neighbouring workers' slices never share one
+        size_t capacity = (bytes + CONTEXT_ALIGNMENT - 1) / CONTEXT_ALIGNMENT * CONTEXT_ALIGNMENT;
+        free(workspace->data);
+        if (posix_memalign(&workspace->data, CONTEXT_ALIGNMENT, capacity) != 0) {
+            cerr << "cannot allocate a " << capacity << " byte workspace" << endl;
+            exit(1);
+        }
+        context->reserved_bytes += capacity - workspace->capacity;
+        workspace->capacity = capacity;
+        context->allocations++;
+    }
+    return workspace->data;
+}
+
+static bool k_means_init_from_centroid_files(struct kmeans_context_t *context, struct options_t *opts, int num_points,
+                                             real *points) {
+    int num_clusters = opts->num_clusters;
+    int dims = opts->dims;
+    if (!k_means_init_from_model(opts->init_from, num_clusters, dims, context->centroids)) {
+        cerr << "cannot read " << opts->init_from << " as a model of " << num_clusters << " " << dims << "-dimensional centroids" << endl;
+        return false;
+    }
+    if (!opts->init_assignments)
+        return true;
+
+    // only the first num_points ids are used
+    int *prior_ids = context_array<int>(context, CONTEXT_INIT, SLOT_INIT_PRIOR_IDS, num_points);
+    int num_prior = load_assignments(opts->init_assignments, prior_ids, num_points);
+    if (num_prior < 0) {
+        cerr << "cannot read assignments from " << opts->init_assignments << endl;
+        return false;
+    }
+    double *sums = context_array<double>(context, CONTEXT_INIT, SLOT_INIT_SUMS, (size_t)num_clusters * dims);
+    int *counts = context_array<int>(context, CONTEXT_INIT, SLOT_INIT_COUNTS, num_clusters);
+    context->warm_points = k_means_init_from_assignments(num_points, dims, points, num_clusters, prior_ids, num_prior,
+                                                         context->centroids, sums, counts);
+    return true;
+}
+
+int context_fit(struct kmeans_context_t *context, struct options_t *opts, int num_points, real *points) {
+    int num_clusters = opts->num_clusters;
+    int dims = opts->dims;
+    opts->context = context;
+
+    context->num_points = num_points;
+    context->num_clusters = num_clusters;
+    context->dims = dims;
+    context->cluster_id_of_points = context_array<int>(context, CONTEXT_RESULT, SLOT_RESULT_IDS, num_points);
+    context->centroids = context_array<real>(context, CONTEXT_RESULT, SLOT_RESULT_CENTROIDS, (size_t)num_clusters * dims);
+    context->initial_centroids = context_array<real>(context, CONTEXT_RESULT, SLOT_RESULT_INITIAL_CENTROIDS, (size_t)num_clusters * dims);
+    int *cluster_id_of_points = context->cluster_id_of_points;
+    real *centroids = context->centroids;
+
+    memset(&context->blocks, 0, sizeof(context->blocks));
+    context->layout_time = 0;
+    if (opts->layout == LAYOUT_BLOCKED) {
+        auto layout_start = chrono::high_resolution_clock::now();
+        real *data = context_array<real>(context, CONTEXT_LAYOUT, SLOT_LAYOUT_BLOCKS, point_blocks_size(num_points, dims));
+        block_points(num_points, dims, points, data, opts->workers, &context->blocks);
+        context->layout_time = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - layout_start).count();
+    }
+
+    auto init_start = chrono::high_resolution_clock::now();
+    context->warm_points = 0;
+    if (opts->init_from) {
+        if (!k_means_init_from_centroid_files(context, opts, num_points, points))
+            return -1;
+    } else {
+        k_means_init_centroids(context, num_points, dims, points, num_clusters, centroids, opts->seed, opts->init, opts->workers);
+    }
+    context->init_time = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - init_start).count();
+    memcpy(context->initial_centroids, centroids, (size_t)num_clusters * dims * sizeof(real));
+
+    int iterations = -1;
+    double per_iteration_time = 0;
+    auto start = chrono::high_resolution_clock::now();
+
+    switch (opts->algorithm)
+    {
+        case 0:
+            iterations = kmeans_sequential(num_points, points, opts, cluster_id_of_points, centroids);
+            break;
+#ifndef KMEANS_NO_CUDA
+        case 1:
+            iterations = kmeans_cuda(num_points, points, opts, cluster_id_of_points, centroids, false, &per_iteration_time);
+            break;
+        case 2:
+            iterations = kmeans_cuda(num_points, points, opts, cluster_id_of_points, centroids, true, &per_iteration_time);
+            break;
+#else
+        case 1:
+        case 2:
+            cerr << "algorithms 1 and 2 need the CUDA build (make)" << endl;
+            return -1;
+#endif
+#ifndef KMEANS_NO_THRUST
+        case 3:
+            iterations = kmeans_thrust(num_points, points, opts, cluster_id_of_points, centroids, &per_iteration_time);
+            break;
+#else
+        case 3:
+            cerr << "algorithm 3 needs the CUDA or a host thrust build (make, make thrust-omp, make thrust-tbb)" << endl;
+            return -1;
+#endif
+        case 4:
+            iterations = kmeans_elkan(num_points, points, opts, cluster_id_of_points, centroids);
+            break;
+        case 5:
+            iterations = kmeans_hamerly(num_points, points, opts, cluster_id_of_points, centroids);
+            break;
+        case 6:
+            iterations = kmeans_yinyang(num_points, points, opts, cluster_id_of_points, centroids);
+            break;
+        case 7:
+            iterations = kmeans_fused(num_points, points, opts, cluster_id_of_points, centroids);
+            break;
+        case 12:
+            iterations = kmeans_kdtree(num_points, points, opts, cluster_id_of_points, centroids);
+            break;
+        case 13:
+            iterations = kmeans_ivf(num_points, points, opts, cluster_id_of_points, centroids);
+            break;
+        case 14:
+            iterations = kmeans_bisect(num_points, points, opts, cluster_id_of_points, centroids);
+            break;
+        default:
+            cerr << "algorithm " << opts->algorithm << " has its own driver and cannot be fitted in memory" << endl;
+            return -1;
+    }
+
+    if (telemetry_enabled(context))
+        context->telemetry->fit++;
+    context->fit_time = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+
+    // the GPU backends report their own per-iteration time, from cuda events for 1 and 2 and
+    // from the host clock for thrust; both cover the transfers as well as the iterations
+    if (opts->algorithm == 0 || opts->algorithm > 3)
+        per_iteration_time = context->fit_time / iterations;
+    context->per_iteration_time = per_iteration_time;
+
+    return iterations;
+}
+
+void context_predict(struct kmeans_context_t *context, struct options_t *opts, int num_points, real *points, int *cluster_id_of_points) {
+    opts->context = context;
+    predict_clusters(context, context->num_clusters, context->dims, num_points, points, context->centroids, cluster_id_of_points,
+                     opts->workers);
+}
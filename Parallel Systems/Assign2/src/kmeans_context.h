@@ -0,0 +1,172 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+#include "argparse.h"
+#include "helpers.h"
+#include "point_blocks.h"
+#include "telemetry.h"
+
+// every workspace starts on its own cache line
+#define CONTEXT_ALIGNMENT 64
+// buffers one owner can hold at once
+#define CONTEXT_SLOTS 16
+
+// Workspace owners. Each backend asks for its buffers under its own owner, so one backend
+// calling another (bisect refining through fused, the storage report rerunning fused) never
+// has its buffers regrown underneath it.
+#define CONTEXT_RESULT 0
+#define CONTEXT_SEQUENTIAL 1
+#define CONTEXT_ELKAN 2
+#define CONTEXT_HAMERLY 3
+#define CONTEXT_YINYANG 4
+#define CONTEXT_FUSED 5
+#define CONTEXT_MINIBATCH 6
+#define CONTEXT_MPI 7
+#define CONTEXT_MULTIRUN 8
+#define CONTEXT_SPARSE 9
+#define CONTEXT_KDTREE 10
+#define CONTEXT_IVF 11
+#define CONTEXT_BISECT 12
+#define CONTEXT_PREDICT 13
+#define CONTEXT_STORAGE 14
+#define CONTEXT_LAYOUT 15
+#define CONTEXT_INIT 16
+#define CONTEXT_TELEMETRY 17
+#define CONTEXT_METRIC 18
+#define CONTEXT_OWNERS 19
+
+// The slots of each owner, named after the buffer they hold. Each enum has to stay under
+// CONTEXT_SLOTS, which context_workspace asserts.
+enum result_slot_t {
+    SLOT_RESULT_IDS, SLOT_RESULT_CENTROIDS, SLOT_RESULT_INITIAL_CENTROIDS,
+    SLOT_RESULT_GATHERED_IDS, SLOT_RESULT_SHARD_SIZES, SLOT_RESULT_SHARD_OFFSETS
+};
+enum sequential_slot_t {
+    SLOT_SEQUENTIAL_SIZES, SLOT_SEQUENTIAL_POINT_NORMS, SLOT_SEQUENTIAL_GEMM_WORKSPACE, SLOT_SEQUENTIAL_NEIGHBOURS,
+    SLOT_SEQUENTIAL_NEIGHBOUR_SCRATCH, SLOT_SEQUENTIAL_VISITED, SLOT_SEQUENTIAL_SUMS, SLOT_SEQUENTIAL_COUNTS,
+    SLOT_SEQUENTIAL_TOUCHED, SLOT_SEQUENTIAL_OLD_IDS, SLOT_SEQUENTIAL_OLD_CENTROIDS, SLOT_SEQUENTIAL_TILE_DISTANCES
+};
+enum elkan_slot_t {
+    SLOT_ELKAN_SIZES, SLOT_ELKAN_OLD_CENTROIDS, SLOT_ELKAN_UPPER, SLOT_ELKAN_LOWER, SLOT_ELKAN_CENTROID_DISTANCES,
+    SLOT_ELKAN_HALF_NEAREST, SLOT_ELKAN_DRIFT, SLOT_ELKAN_COMPUTED, SLOT_ELKAN_CHANGED
+};
+enum hamerly_slot_t {
+    SLOT_HAMERLY_SIZES, SLOT_HAMERLY_OLD_CENTROIDS, SLOT_HAMERLY_UPPER, SLOT_HAMERLY_LOWER, SLOT_HAMERLY_HALF_NEAREST,
+    SLOT_HAMERLY_DRIFT, SLOT_HAMERLY_COMPUTED, SLOT_HAMERLY_CHANGED
+};
+enum yinyang_slot_t {
+    SLOT_YINYANG_SIZES, SLOT_YINYANG_OLD_CENTROIDS, SLOT_YINYANG_UPPER, SLOT_YINYANG_LOWER, SLOT_YINYANG_DRIFT,
+    SLOT_YINYANG_GROUP_DRIFT, SLOT_YINYANG_SCRATCH_DISTANCES, SLOT_YINYANG_COMPUTED, SLOT_YINYANG_CHANGED,
+    SLOT_YINYANG_GROUP_CENTERS, SLOT_YINYANG_GROUP_SIZES, SLOT_YINYANG_GROUP_OF, SLOT_YINYANG_MEMBERS, SLOT_YINYANG_GROUP_START
+};
+enum fused_slot_t {
+    SLOT_FUSED_SUMS, SLOT_FUSED_COUNTS, SLOT_FUSED_CHANGED, SLOT_FUSED_TOTALS, SLOT_FUSED_TOTAL_COUNTS, SLOT_FUSED_SCRATCH,
+    SLOT_FUSED_TILE_IDS, SLOT_FUSED_TILE_DISTANCES, SLOT_FUSED_NEXT_CENTROIDS
+};
+// the prefetcher double-buffers through SLOT_MINIBATCH_PREFETCH and the slot after it
+enum minibatch_slot_t {
+    SLOT_MINIBATCH_PREFETCH, SLOT_MINIBATCH_SEEN = 2, SLOT_MINIBATCH_BATCH_IDS, SLOT_MINIBATCH_SHUFFLE_SCRATCH,
+    SLOT_MINIBATCH_SHUFFLE_ORDER, SLOT_MINIBATCH_IDS, SLOT_MINIBATCH_DISTANCES
+};
+enum mpi_slot_t {
+    SLOT_MPI_OLD_IDS, SLOT_MPI_OLD_CENTROIDS, SLOT_MPI_SUMS, SLOT_MPI_COUNTS, SLOT_MPI_REDUCE, SLOT_MPI_POINT_NORMS,
+    SLOT_MPI_GEMM_WORKSPACE, SLOT_MPI_LOCAL_SAMPLE, SLOT_MPI_SAMPLE_COUNTS, SLOT_MPI_SAMPLE_OFFSETS, SLOT_MPI_SAMPLE
+};
+enum multirun_slot_t {
+    SLOT_MULTIRUN_CENTROIDS, SLOT_MULTIRUN_OLD_CENTROIDS, SLOT_MULTIRUN_IDS, SLOT_MULTIRUN_SUMS, SLOT_MULTIRUN_COUNTS,
+    SLOT_MULTIRUN_CHANGED, SLOT_MULTIRUN_PARTIAL
+};
+enum sparse_slot_t {
+    SLOT_SPARSE_OLD_CENTROIDS, SLOT_SPARSE_CENTROIDS_BY_DIM, SLOT_SPARSE_CENTROID_NORMS, SLOT_SPARSE_SUMS, SLOT_SPARSE_COUNTS,
+    SLOT_SPARSE_DOTS, SLOT_SPARSE_CHANGED
+};
+enum kdtree_slot_t {
+    SLOT_KDTREE_ORDER, SLOT_KDTREE_BEGIN, SLOT_KDTREE_END, SLOT_KDTREE_LEAF, SLOT_KDTREE_LOW, SLOT_KDTREE_HIGH,
+    SLOT_KDTREE_NODE_SUMS, SLOT_KDTREE_POINTS, SLOT_KDTREE_TASKS, SLOT_KDTREE_NEXT_TASKS, SLOT_KDTREE_OLD_CENTROIDS,
+    SLOT_KDTREE_TREE_IDS, SLOT_KDTREE_STATES, SLOT_KDTREE_CANDIDATES, SLOT_KDTREE_SUMS, SLOT_KDTREE_COUNTS
+};
+enum ivf_slot_t {
+    SLOT_IVF_COARSE, SLOT_IVF_LIST_START, SLOT_IVF_MEMBERS, SLOT_IVF_LIST_CENTROIDS, SLOT_IVF_OWNER, SLOT_IVF_LIST_SUMS,
+    SLOT_IVF_LIST_COUNTS, SLOT_IVF_OLD_CENTROIDS, SLOT_IVF_WORKERS, SLOT_IVF_SUMS, SLOT_IVF_COUNTS, SLOT_IVF_COARSE_DISTANCES,
+    SLOT_IVF_PROBE_ORDER, SLOT_IVF_SAMPLE_CORRECT
+};
+enum bisect_slot_t {
+    SLOT_BISECT_ORDER, SLOT_BISECT_MEAN, SLOT_BISECT_LEAVES, SLOT_BISECT_CANDIDATES, SLOT_BISECT_ROUND, SLOT_BISECT_PAIRS,
+    SLOT_BISECT_OLD_PAIRS, SLOT_BISECT_SIDE, SLOT_BISECT_RIGHT, SLOT_BISECT_SUMS, SLOT_BISECT_COUNTS, SLOT_BISECT_SSE
+};
+enum predict_slot_t { SLOT_PREDICT_POINT_NORMS, SLOT_PREDICT_GEMM_WORKSPACE, SLOT_PREDICT_BLOCKS };
+enum storage_slot_t { SLOT_STORAGE_REFERENCE_IDS, SLOT_STORAGE_REFERENCE_CENTROIDS, SLOT_STORAGE_ENCODED };
+enum layout_slot_t { SLOT_LAYOUT_BLOCKS };
+// the RECLUSTER slots belong to kmeans||'s reclustering of its weighted candidates
+enum init_slot_t {
+    SLOT_INIT_SUMS, SLOT_INIT_COUNTS, SLOT_INIT_PRIOR_IDS, SLOT_INIT_MIN_DISTANCES, SLOT_INIT_BLOCK_SUMS, SLOT_INIT_NEAREST,
+    SLOT_INIT_CANDIDATE_IDS, SLOT_INIT_SAMPLED, SLOT_INIT_BLOCK_FIRST, SLOT_INIT_CANDIDATE_ROWS, SLOT_INIT_WEIGHTS,
+    SLOT_INIT_RECLUSTER_MIN_DISTANCES, SLOT_INIT_RECLUSTER_SCORES, SLOT_INIT_RECLUSTER_ASSIGNMENT, SLOT_INIT_RECLUSTER_SUMS,
+    SLOT_INIT_RECLUSTER_TOTALS
+};
+enum telemetry_slot_t { SLOT_TELEMETRY_PARTIAL };
+enum metric_slot_t {
+    SLOT_METRIC_PARTIAL, SLOT_METRIC_SPHERICAL_SUMS, SLOT_METRIC_MEDIAN_OFFSETS, SLOT_METRIC_MEDIAN_NEXT, SLOT_METRIC_MEDIAN_ORDER,
+    SLOT_METRIC_MEDIAN_VALUES, SLOT_METRIC_WEIGHTS, SLOT_METRIC_WEIGHT_SCRATCH
+};
+
+struct context_workspace_t {
+    void *data;
+    size_t capacity;
+};
+
+// Owns the buffers of every backend across fits. A workspace only grows, to the largest size
+// asked of it so far, so once a context has fitted its largest dataset the following fits
+// reuse the same memory. The last fit's centroids and assignment stay in the context until
+// the next fit.
+struct kmeans_context_t {
+    context_workspace_t workspaces[CONTEXT_OWNERS][CONTEXT_SLOTS];
+    long allocations;           // workspace growths so far
+    size_t reserved_bytes;      // sum of the workspace capacities
+
+    int num_points;
+    int num_clusters;
+    int dims;
+    real *centroids;
+    real *initial_centroids;    // as seeded, before the backend ran
+    int *cluster_id_of_points;
+    point_blocks_t blocks;      // the fitted points in the blocked layout, with --layout blocked
+    int warm_points;            // points placed by --init-assignments
+    telemetry_t *telemetry;     // per-iteration lines go here with --telemetry; NULL otherwise
+
+    double layout_time;         // ms, building the blocks
+    double init_time;           // ms
+    double fit_time;            // ms, the backend alone
+    double per_iteration_time;  // ms, from the GPU backends' own timers where they have them
+};
+
+void init_kmeans_context(struct kmeans_context_t *context);
+
+void free_kmeans_context(struct kmeans_context_t *context);
+
+// whether the backend fitting in this context should record per-iteration telemetry; context may be NULL
+bool telemetry_enabled(struct kmeans_context_t *context);
+
+// A CONTEXT_ALIGNMENT-aligned buffer of at least bytes. It stays valid until the same (owner,
+// slot) is asked for more than it holds; growing does not keep the contents.
+void *context_workspace(struct kmeans_context_t *context, int owner, int slot, size_t bytes);
+
+template <typename T>
+T *context_array(struct kmeans_context_t *context, int owner, int slot, size_t count) {
+    return (T *)context_workspace(context, owner, slot, count * sizeof(T));
+}
+
+// Seeds with opts->init and runs opts->algorithm over the points, leaving the result in the
+// context. With --layout blocked the points are first copied into context->blocks. --init-from
+// replaces the seeding with the saved centroids (moved to the means of the previous partition
+// with --init-assignments). Only the backends of the main switch go through here; minibatch, multirun, sparse
+// and mpi have their own drivers but take their workspaces from opts->context all the same.
+// Returns the iteration count, or -1 when the algorithm is not in this build or the warm start
+// files can't be used.
+int context_fit(struct kmeans_context_t *context, struct options_t *opts, int num_points, real *points);
+
+// Assigns the points to the centroids of the last fit.
+void context_predict(struct kmeans_context_t *context, struct options_t *opts, int num_points, real *points, int *cluster_id_of_points);
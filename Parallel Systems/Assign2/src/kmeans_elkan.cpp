@@ -0,0 +1,189 @@
+#include "kmeans_elkan.h"
+
+using namespace std;
+
+extern bool debug;
+extern bool timer_debug;
+
+// first iteration: every distance is computed and becomes a tight bound
+static long initial_assignment(int num_clusters, int dims, int begin, int end, real *points, real *centroids, double slack,
+                               int *cluster_id_of_points, double *upper, double *lower, int *changed) {
+    for (int i = begin; i < end; i++) {
+        int best_centroid = -1;
+        real best_distance = DBL_MAX;
+        for (int c = 0; c < num_clusters; c++) {
+            real distance = squared_distance(&points[i * dims], &centroids[c * dims], dims);
+            lower[(long)i * num_clusters + c] = sqrt((double)distance) * (1.0 - slack);
+            if (distance < best_distance) {
+                best_distance = distance;
+                best_centroid = c;
+            }
+        }
+        if (cluster_id_of_points[i] != best_centroid)
+            (*changed)++;
+        cluster_id_of_points[i] = best_centroid;
+        upper[i] = sqrt((double)best_distance) * (1.0 + slack);
+    }
+    return (long)(end - begin) * num_clusters;
+}
+
+static long bounded_assignment(int num_clusters, int dims, int begin, int end, real *points, real *centroids, double slack,
+                               double *centroid_distances, double *half_nearest,
+                               int *cluster_id_of_points, double *upper, double *lower, int *changed) {
+    long computed = 0;
+    for (int i = begin; i < end; i++) {
+        real *point = &points[i * dims];
+        double *point_lower = &lower[(long)i * num_clusters];
+        int best_centroid = cluster_id_of_points[i];
+        double best_upper = upper[i];
+
+        if (best_upper < half_nearest[best_centroid])
+            continue;
+
+        bool upper_is_stale = true;
+        real best_distance = 0.0;
+
+        for (int c = 0; c < num_clusters; c++) {
+            if (c == best_centroid)
+                continue;
+            if (best_upper < point_lower[c] || best_upper < 0.5 * centroid_distances[best_centroid * num_clusters + c])
+                continue;
+
+            if (upper_is_stale) {
+                best_distance = squared_distance(point, &centroids[best_centroid * dims], dims);
+                computed++;
+                best_upper = sqrt((double)best_distance) * (1.0 + slack);
+                point_lower[best_centroid] = sqrt((double)best_distance) * (1.0 - slack);
+                upper_is_stale = false;
+                if (best_upper < point_lower[c] || best_upper < 0.5 * centroid_distances[best_centroid * num_clusters + c])
+                    continue;
+            }
+
+            real distance = squared_distance(point, &centroids[c * dims], dims);
+            computed++;
+            point_lower[c] = sqrt((double)distance) * (1.0 - slack);
+            // ties go to the lower index, matching the first-minimum rule of the exhaustive scan
+            if (distance < best_distance || (distance == best_distance && c < best_centroid)) {
+                best_distance = distance;
+                best_centroid = c;
+                best_upper = sqrt((double)distance) * (1.0 + slack);
+            }
+        }
+
+        if (cluster_id_of_points[i] != best_centroid)
+            (*changed)++;
+        cluster_id_of_points[i] = best_centroid;
+        upper[i] = best_upper;
+    }
+    return computed;
+}
+
+int kmeans_elkan(int num_points, real *points, struct options_t *opts, int *cluster_id_of_points, real *centroids) {
+    int dims = opts->dims;
+    int num_clusters = opts->num_clusters;
+    int max_num_iters = opts->max_num_iter;
+    int num_workers = opts->workers;
+    real threshold = opts->threshold;
+    bool use_alternate_convergence = opts->avoid_floating_point_convergence;
+    double slack = bound_slack(dims);
+
+    kmeans_context_t *context = opts->context;
+    int *cluster_sizes = context_array<int>(context, CONTEXT_ELKAN, SLOT_ELKAN_SIZES, num_clusters);
+    real *old_centroids = context_array<real>(context, CONTEXT_ELKAN, SLOT_ELKAN_OLD_CENTROIDS, num_clusters * dims);
+    double *upper = context_array<double>(context, CONTEXT_ELKAN, SLOT_ELKAN_UPPER, num_points);
+    double *lower = context_array<double>(context, CONTEXT_ELKAN, SLOT_ELKAN_LOWER, (long)num_points * num_clusters);
+    double *centroid_distances = context_array<double>(context, CONTEXT_ELKAN, SLOT_ELKAN_CENTROID_DISTANCES, num_clusters * num_clusters);
+    double *half_nearest = context_array<double>(context, CONTEXT_ELKAN, SLOT_ELKAN_HALF_NEAREST, num_clusters);
+    double *drift = context_array<double>(context, CONTEXT_ELKAN, SLOT_ELKAN_DRIFT, num_clusters);
+    long *computed_by_worker = context_array<long>(context, CONTEXT_ELKAN, SLOT_ELKAN_COMPUTED, num_workers);
+    int *changed_by_worker = context_array<int>(context, CONTEXT_ELKAN, SLOT_ELKAN_CHANGED, num_workers);
+    bool trace = telemetry_enabled(context);
+    phase_clock_t phases(trace);
+
+    if(debug){
+        cout << "dims = " << dims << endl;
+        cout << "num_clusters = " << num_clusters << endl;
+        cout << "max_num_iters = " << max_num_iters << endl;
+        cout << "threshold = " << threshold << endl;
+        cout << "num_points = " << num_points << endl;
+
+        cout << "*********** INITIAL CENTROIDS ***********" << endl;
+        print_centroids(centroids, num_clusters, dims);
+    }
+
+    bool done = false;
+    int iterations = 0;
+
+    while(!done) {
+        phases.start();
+        memset(computed_by_worker, 0, num_workers * sizeof(long));
+        memset(changed_by_worker, 0, num_workers * sizeof(int));
+
+        if (iterations > 0)
+            compute_centroid_distances(num_clusters, dims, centroids, slack, centroid_distances, half_nearest);
+
+        parallel_for(num_workers, num_points, [&](int begin, int end, int worker) {
+            if (iterations == 0)
+                computed_by_worker[worker] = initial_assignment(num_clusters, dims, begin, end, points, centroids, slack,
+                                                                cluster_id_of_points, upper, lower, &changed_by_worker[worker]);
+            else
+                computed_by_worker[worker] = bounded_assignment(num_clusters, dims, begin, end, points, centroids, slack,
+                                                                centroid_distances, half_nearest, cluster_id_of_points, upper, lower,
+                                                                &changed_by_worker[worker]);
+        });
+
+        double assign_time = phases.lap();
+
+        memcpy(old_centroids, centroids, num_clusters * dims * sizeof(real));
+        update_centroids(num_clusters, dims, num_points, points, cluster_id_of_points, centroids, cluster_sizes);
+
+        compute_drift(num_clusters, dims, old_centroids, centroids, drift);
+        parallel_for(num_workers, num_points, [&](int begin, int end, int worker) {
+            for (int i = begin; i < end; i++) {
+                upper[i] += drift[cluster_id_of_points[i]];
+                double *point_lower = &lower[(long)i * num_clusters];
+                for (int c = 0; c < num_clusters; c++)
+                    point_lower[c] = max(0.0, point_lower[c] - drift[c]);
+            }
+        });
+
+        double update_time = phases.lap();
+
+        long computed = 0;
+        int changed = 0;
+        for (int w = 0; w < num_workers; w++) {
+            computed += computed_by_worker[w];
+            changed += changed_by_worker[w];
+        }
+
+        iterations++;
+        bool is_converged;
+
+        if (use_alternate_convergence)
+            is_converged = changed == 0;
+        else
+            is_converged = converged(num_clusters, dims, threshold, old_centroids, centroids);
+
+        done = iterations > max_num_iters || is_converged;
+
+        if (trace) {
+            iteration_telemetry_t stats = {iterations, assign_time, update_time, phases.lap(), iterations == 1 ? num_points : changed,
+                                           computed,
+                                           assignment_inertia(context, num_points, dims, points, cluster_id_of_points, centroids,
+                                                              num_workers)};
+            write_iteration_telemetry(context->telemetry, "elkan", &stats);
+        }
+
+        if(timer_debug) {
+            double total = (double)num_points * num_clusters;
+            printf("elkan_iteration: %d skipped_fraction: %f \n", iterations, 1.0 - computed / total);
+        }
+
+        if(debug){
+            cout << "*********** CENTROIDS " << iterations << " ***********" << endl;
+            print_centroids(centroids, num_clusters, dims);
+        }
+    }
+
+    return iterations;
+}
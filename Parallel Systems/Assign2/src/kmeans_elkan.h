@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+
+#include "argparse.h"
+#include "helpers.h"
+#include "kmeans_sequential.h"
+#include "kmeans_bounds.h"
+#include "parallel.h"
+
+int kmeans_elkan(int num_points, real *points, struct options_t *opts, int* cluster_id_of_points, real* centroids);
@@ -0,0 +1,458 @@
+#include "kmeans_fused.h"
+
+using namespace std;
+
+extern bool debug;
+extern bool timer_debug;
+
+// One pass over a range of points: each point is assigned under Metric and immediately added
+// to this worker's centroid sums while it is still in L1. In delta mode only points that
+// changed cluster contribute, as +point to the new cluster and -point to the old one. The
+// spherical update sums the unit-length points and the median update nothing, as it is taken
+// from the assignment afterwards. Rows come through one of the point_storage.h readers,
+// decoded into scratch when compressed. Returns how many assignments changed.
+template <typename Metric, typename Rows>
+static int assign_and_accumulate(int num_clusters, int dims, int begin, int end, const Rows &rows, real *scratch,
+                                 real *centroids, const metric_params_t *params, int *cluster_id_of_points, double *sums,
+                                 int *counts, bool delta) {
+    int changed = 0;
+    memset(sums, 0, num_clusters * dims * sizeof(double));
+    memset(counts, 0, num_clusters * sizeof(int));
+
+    for (int i = begin; i < end; i++) {
+        const real *point = rows.row(i, scratch);
+        real term = Metric::point_term(point, dims);
+        int best_centroid = -1;
+        real best_distance = DBL_MAX;
+
+        for (int c = 0; c < num_clusters; c++) {
+            real distance = Metric::distance(point, term, &centroids[c * dims], dims, params);
+            if (distance < best_distance) {
+                best_distance = distance;
+                best_centroid = c;
+            }
+        }
+
+        int old_centroid = cluster_id_of_points[i];
+        cluster_id_of_points[i] = best_centroid;
+        if (old_centroid != best_centroid)
+            changed++;
+        if (Metric::update == UPDATE_MEDIAN)
+            continue;
+
+        if (delta) {
+            if (old_centroid == best_centroid)
+                continue;
+            counts[old_centroid]--;
+            double *old_sum = &sums[old_centroid * dims];
+            for (int d = 0; d < dims; d++)
+                old_sum[d] -= point[d];
+        }
+
+        counts[best_centroid]++;
+        double *sum = &sums[best_centroid * dims];
+        if (Metric::update == UPDATE_SPHERICAL) {
+            // cosine's point term is the length
+            double scale = term > 0 ? 1.0 / term : 0.0;
+            for (int d = 0; d < dims; d++)
+                sum[d] += point[d] * scale;
+        } else {
+            for (int d = 0; d < dims; d++)
+                sum[d] += point[d];
+        }
+    }
+    return changed;
+}
+
+// assign_and_accumulate over whole blocks [begin, end) of the blocked layout; the sums are
+// taken from the block while it is still in L1
+static int assign_and_accumulate_blocked(int num_clusters, int dims, int begin, int end, point_blocks_t *blocks,
+                                         real *centroids, int *cluster_id_of_points, double *sums, int *counts, bool delta) {
+    int changed = 0;
+    memset(sums, 0, num_clusters * dims * sizeof(double));
+    memset(counts, 0, num_clusters * sizeof(int));
+
+    int best_centroid[POINT_BLOCK];
+    real best_distance[POINT_BLOCK];
+    for (int b = begin; b < end; b++) {
+        const real *block = &blocks->data[(long)b * dims * POINT_BLOCK];
+        nearest_in_block(block, dims, num_clusters, centroids, best_centroid, best_distance);
+
+        int first = b * POINT_BLOCK;
+        int count = min(POINT_BLOCK, blocks->num_points - first);
+        for (int l = 0; l < count; l++) {
+            int old_centroid = cluster_id_of_points[first + l];
+            int new_centroid = best_centroid[l];
+            cluster_id_of_points[first + l] = new_centroid;
+            if (old_centroid != new_centroid)
+                changed++;
+
+            if (delta) {
+                if (old_centroid == new_centroid)
+                    continue;
+                counts[old_centroid]--;
+                double *old_sum = &sums[old_centroid * dims];
+                for (int d = 0; d < dims; d++)
+                    old_sum[d] -= block[d * POINT_BLOCK + l];
+            }
+
+            counts[new_centroid]++;
+            double *sum = &sums[new_centroid * dims];
+            for (int d = 0; d < dims; d++)
+                sum[d] += block[d * POINT_BLOCK + l];
+        }
+    }
+    return changed;
+}
+
+// assign_and_accumulate over fp32 rows a point tile at a time: the tile is assigned against
+// each centroid tile in turn, then summed while it is still in L2. best_centroid and
+// best_distance are tiles->points each.
+static int assign_and_accumulate_tiled(int num_clusters, int dims, int begin, int end, const real *points,
+                                       const assignment_tiles_t *tiles, int *best_centroid, real *best_distance,
+                                       real *centroids, int *cluster_id_of_points, double *sums, int *counts, bool delta) {
+    int changed = 0;
+    memset(sums, 0, num_clusters * dims * sizeof(double));
+    memset(counts, 0, num_clusters * sizeof(int));
+
+    for (int first = begin; first < end; first += tiles->points) {
+        int count = min(tiles->points, end - first);
+        nearest_in_tile(num_clusters, dims, count, &points[(long)first * dims], centroids, tiles, best_centroid, best_distance);
+
+        for (int l = 0; l < count; l++) {
+            const real *point = &points[(long)(first + l) * dims];
+            int old_centroid = cluster_id_of_points[first + l];
+            int new_centroid = best_centroid[l];
+            cluster_id_of_points[first + l] = new_centroid;
+            if (old_centroid != new_centroid)
+                changed++;
+
+            if (delta) {
+                if (old_centroid == new_centroid)
+                    continue;
+                counts[old_centroid]--;
+                double *old_sum = &sums[old_centroid * dims];
+                for (int d = 0; d < dims; d++)
+                    old_sum[d] -= point[d];
+            }
+
+            counts[new_centroid]++;
+            double *sum = &sums[new_centroid * dims];
+            for (int d = 0; d < dims; d++)
+                sum[d] += point[d];
+        }
+    }
+    return changed;
+}
+
+template <typename Metric>
+static int assign_and_accumulate_stored(int num_clusters, int dims, int begin, int end, point_storage_t *storage, real *scratch,
+                                        real *centroids, const metric_params_t *params, int *cluster_id_of_points, double *sums,
+                                        int *counts, bool delta) {
+    switch (storage->format)
+    {
+        case STORAGE_FP16: {
+            fp16_rows rows = {(const uint16_t *)storage->data, dims};
+            return assign_and_accumulate<Metric>(num_clusters, dims, begin, end, rows, scratch, centroids, params, cluster_id_of_points,
+                                                 sums, counts, delta);
+        }
+        case STORAGE_BF16: {
+            bf16_rows rows = {(const uint16_t *)storage->data, dims};
+            return assign_and_accumulate<Metric>(num_clusters, dims, begin, end, rows, scratch, centroids, params, cluster_id_of_points,
+                                                 sums, counts, delta);
+        }
+        case STORAGE_INT8: {
+            int8_rows rows = {(const uint8_t *)storage->data, storage->scale, storage->offset, dims};
+            return assign_and_accumulate<Metric>(num_clusters, dims, begin, end, rows, scratch, centroids, params, cluster_id_of_points,
+                                                 sums, counts, delta);
+        }
+        default: {
+            fp32_rows rows = {(const real *)storage->data, dims};
+            return assign_and_accumulate<Metric>(num_clusters, dims, begin, end, rows, scratch, centroids, params, cluster_id_of_points,
+                                                 sums, counts, delta);
+        }
+    }
+}
+
+// kmeans_fused under Metric, printing its -r lines only when report is set. The blocked and
+// tiled kernels are euclidean only, which argparse makes sure of.
+template <typename Metric>
+static int fused_fit(int num_points, real *points, struct options_t *opts, int *cluster_id_of_points, real *centroids,
+                     bool report) {
+    int dims = opts->dims;
+    int num_clusters = opts->num_clusters;
+    int max_num_iters = opts->max_num_iter;
+    int num_workers = opts->workers;
+    real threshold = opts->threshold;
+    bool use_alternate_convergence = opts->avoid_floating_point_convergence;
+
+    kmeans_context_t *context = opts->context;
+
+    // per-worker accumulators, kept in double so the result does not depend on how the
+    // points were split across workers
+    double *sums = context_array<double>(context, CONTEXT_FUSED, SLOT_FUSED_SUMS, num_workers * num_clusters * dims);
+    int *counts = context_array<int>(context, CONTEXT_FUSED, SLOT_FUSED_COUNTS, num_workers * num_clusters);
+    int *changed_by_worker = context_array<int>(context, CONTEXT_FUSED, SLOT_FUSED_CHANGED, num_workers);
+    // with delta updates the sums persist across iterations and only moved points are applied
+    int recompute_every = opts->delta_update;
+    double *totals = context_array<double>(context, CONTEXT_FUSED, SLOT_FUSED_TOTALS, num_clusters * dims);
+    int *total_counts = context_array<int>(context, CONTEXT_FUSED, SLOT_FUSED_TOTAL_COUNTS, num_clusters);
+
+    real *scratch = context_array<real>(context, CONTEXT_FUSED, SLOT_FUSED_SCRATCH, num_workers * dims);
+    // the blocks come from context_fit
+    bool blocked = opts->layout == LAYOUT_BLOCKED;
+    // tiling needs fp32 rows, which argparse makes sure of
+    bool tiled = !blocked && opts->tiled;
+    // only the row kernels read the encoded points
+    point_storage_t storage;
+    if (!blocked && !tiled)
+        encode_point_storage(num_points, dims, points, opts->storage,
+                             context_workspace(context, CONTEXT_STORAGE, SLOT_STORAGE_ENCODED, point_storage_size(num_points, dims, opts->storage)),
+                             &storage);
+    cache_sizes_t caches;
+    assignment_tiles_t tiles;
+    int *tile_ids = NULL;
+    real *tile_distances = NULL;
+    if (tiled) {
+        detect_cache_sizes(&caches);
+        choose_assignment_tiles(num_clusters, dims, &caches, &tiles);
+        tile_ids = context_array<int>(context, CONTEXT_FUSED, SLOT_FUSED_TILE_IDS, (size_t)num_workers * tiles.points);
+        tile_distances = context_array<real>(context, CONTEXT_FUSED, SLOT_FUSED_TILE_DISTANCES, (size_t)num_workers * tiles.points);
+    }
+    metric_params_t params;
+    prepare_metric(num_points, points, opts, centroids, &params);
+    // the updates other than the mean are worked out here before the convergence check
+    real *next_centroids = NULL;
+    int *offsets = NULL, *next = NULL, *order = NULL;
+    real *values = NULL;
+    if (Metric::update != UPDATE_MEAN)
+        next_centroids = context_array<real>(context, CONTEXT_FUSED, SLOT_FUSED_NEXT_CENTROIDS, (size_t)num_clusters * dims);
+    if (Metric::update == UPDATE_MEDIAN) {
+        offsets = context_array<int>(context, CONTEXT_METRIC, SLOT_METRIC_MEDIAN_OFFSETS, num_clusters + 1);
+        next = context_array<int>(context, CONTEXT_METRIC, SLOT_METRIC_MEDIAN_NEXT, num_clusters);
+        order = context_array<int>(context, CONTEXT_METRIC, SLOT_METRIC_MEDIAN_ORDER, num_points);
+        values = context_array<real>(context, CONTEXT_METRIC, SLOT_METRIC_MEDIAN_VALUES, num_points);
+    }
+    cache_counters_t counters;
+    bool counting = report && open_cache_counters(&counters);
+    bool trace = telemetry_enabled(context);
+    phase_clock_t phases(trace);
+    char backend[32] = "fused";
+    if (Metric::id != METRIC_EUCLIDEAN)
+        snprintf(backend, sizeof(backend), "fused_%s", metric_name(Metric::id));
+
+    if(debug){
+        cout << "dims = " << dims << endl;
+        cout << "num_clusters = " << num_clusters << endl;
+        cout << "max_num_iters = " << max_num_iters << endl;
+        cout << "threshold = " << threshold << endl;
+        cout << "num_points = " << num_points << endl;
+
+        cout << "*********** INITIAL CENTROIDS ***********" << endl;
+        print_centroids(centroids, num_clusters, dims);
+    }
+
+    bool done = false;
+    int iterations = 0;
+
+    while(!done) {
+        // the first iteration's previous assignment is garbage, so it always rebuilds
+        bool delta = recompute_every > 0 && iterations % recompute_every != 0;
+        phases.start();
+
+        // parallel_for leaves the workers past the range count idle, which is common with few blocks
+        memset(sums, 0, num_workers * num_clusters * dims * sizeof(double));
+        memset(counts, 0, num_workers * num_clusters * sizeof(int));
+        memset(changed_by_worker, 0, num_workers * sizeof(int));
+        if (counting)
+            start_cache_counters(&counters);
+        if (blocked) {
+            parallel_for(num_workers, context->blocks.num_blocks, [&](int begin, int end, int worker) {
+                changed_by_worker[worker] = assign_and_accumulate_blocked(num_clusters, dims, begin, end, &context->blocks,
+                                                                          centroids, cluster_id_of_points,
+                                                                          &sums[worker * num_clusters * dims], &counts[worker * num_clusters], delta);
+            });
+        } else if (tiled) {
+            parallel_for(num_workers, num_points, [&](int begin, int end, int worker) {
+                changed_by_worker[worker] = assign_and_accumulate_tiled(num_clusters, dims, begin, end, points, &tiles,
+                                                                        &tile_ids[(long)worker * tiles.points],
+                                                                        &tile_distances[(long)worker * tiles.points],
+                                                                        centroids, cluster_id_of_points,
+                                                                        &sums[worker * num_clusters * dims], &counts[worker * num_clusters], delta);
+            });
+        } else {
+            parallel_for(num_workers, num_points, [&](int begin, int end, int worker) {
+                changed_by_worker[worker] = assign_and_accumulate_stored<Metric>(num_clusters, dims, begin, end, &storage,
+                                                                                 &scratch[worker * dims], centroids, &params,
+                                                                                 cluster_id_of_points,
+                                                                         &sums[worker * num_clusters * dims], &counts[worker * num_clusters], delta);
+            });
+        }
+
+        if (counting)
+            stop_cache_counters(&counters);
+        double assign_time = phases.lap();
+
+        if (!delta) {
+            memset(totals, 0, num_clusters * dims * sizeof(double));
+            memset(total_counts, 0, num_clusters * sizeof(int));
+        }
+
+        int changed = 0;
+        for (int w = 0; w < num_workers; w++) {
+            changed += changed_by_worker[w];
+            for (int j = 0; j < num_clusters * dims; j++)
+                totals[j] += sums[w * num_clusters * dims + j];
+            for (int c = 0; c < num_clusters; c++)
+                total_counts[c] += counts[w * num_clusters + c];
+        }
+
+        // the medians are taken over the fp32 points whatever the storage
+        if (Metric::update == UPDATE_SPHERICAL) {
+            for (long j = 0; j < (long)num_clusters * dims; j++)
+                next_centroids[j] = totals[j];
+            normalize_centroids(num_clusters, dims, next_centroids);
+        } else if (Metric::update == UPDATE_MEDIAN) {
+            update_centroids_median(num_clusters, dims, num_points, points, cluster_id_of_points, offsets, next, order, values,
+                                    next_centroids, num_workers);
+        }
+
+        // the old centroids are still in place, so convergence is checked while they are overwritten
+        bool is_converged = true;
+        for (int c = 0; c < num_clusters; c++) {
+            for (int d = 0; d < dims; d++) {
+                real centroid;
+                if (Metric::update != UPDATE_MEAN)
+                    centroid = next_centroids[c * dims + d];
+                else
+                    centroid = total_counts[c] > 0 ? totals[c * dims + d] / total_counts[c] : totals[c * dims + d];
+                if (abs(centroid - centroids[c * dims + d]) > threshold / dims)
+                    is_converged = false;
+                centroids[c * dims + d] = centroid;
+            }
+        }
+
+        // the update and the convergence check share one pass, so converge_ms only covers what follows it
+        double update_time = phases.lap();
+
+        iterations++;
+
+        if (use_alternate_convergence)
+            is_converged = changed == 0;
+
+        done = iterations > max_num_iters || is_converged;
+
+        if (trace) {
+            iteration_telemetry_t stats = {iterations, assign_time, update_time, phases.lap(), iterations == 1 ? num_points : changed,
+                                           (long)num_points * num_clusters,
+                                           metric_objective<Metric>(context, num_points, dims, points, cluster_id_of_points, centroids,
+                                                                    &params, num_workers)};
+            write_iteration_telemetry(context->telemetry, backend, &stats);
+        }
+
+        if(report)
+            printf("fused_iteration: %d points_changed: %d \n", iterations, changed);
+
+        if(debug){
+            cout << "*********** CENTROIDS " << iterations << " ***********" << endl;
+            print_centroids(centroids, num_clusters, dims);
+        }
+    }
+
+    if(report) {
+        printf("fused_storage: %s \n", storage_format_name(opts->storage));
+        printf("fused_layout: %s \n", point_layout_name(opts->layout));
+        printf("fused_metric: %s \n", metric_name(Metric::id));
+        printf("fused_point_bytes_per_iteration: %ld \n", (long)num_points * dims * storage_bytes_per_value(opts->storage));
+        if (tiled) {
+            printf("cache_l1d: %ld cache_l2: %ld cache_llc: %ld \n", caches.l1d, caches.l2, caches.llc);
+            printf("assign_tile_points: %d assign_tile_centroids: %d \n", tiles.points, tiles.centroids);
+        }
+        print_cache_misses(counting ? &counters : NULL);
+    }
+    if (counting)
+        close_cache_counters(&counters);
+
+    return iterations;
+}
+
+// the fused_fit instantiation for opts->metric
+static int fused_fit_metric(int num_points, real *points, struct options_t *opts, int *cluster_id_of_points, real *centroids,
+                            bool report) {
+    switch (opts->metric)
+    {
+        case METRIC_COSINE:
+            return fused_fit<cosine_metric>(num_points, points, opts, cluster_id_of_points, centroids, report);
+        case METRIC_L1:
+            return fused_fit<l1_metric>(num_points, points, opts, cluster_id_of_points, centroids, report);
+        case METRIC_MAHALANOBIS:
+            return fused_fit<mahalanobis_metric>(num_points, points, opts, cluster_id_of_points, centroids, report);
+        default:
+            return fused_fit<euclidean_metric>(num_points, points, opts, cluster_id_of_points, centroids, report);
+    }
+}
+
+int kmeans_fused(int num_points, real *points, struct options_t *opts, int *cluster_id_of_points, real *centroids) {
+    return fused_fit_metric(num_points, points, opts, cluster_id_of_points, centroids, timer_debug);
+}
+
+// objective of points (fp32) against their nearest centroid under Metric, accumulated in double
+template <typename Metric>
+static double fp32_objective(int num_points, int dims, int num_clusters, real *points, real *centroids, const metric_params_t *params) {
+    double objective = 0;
+    for (int i = 0; i < num_points; i++) {
+        const real *point = &points[i * dims];
+        real term = Metric::point_term(point, dims);
+        real best_distance = DBL_MAX;
+        for (int c = 0; c < num_clusters; c++)
+            best_distance = min(best_distance, Metric::distance(point, term, &centroids[c * dims], dims, params));
+        objective += best_distance;
+    }
+    return objective;
+}
+
+static double fp32_inertia(int num_points, real *points, struct options_t *opts, real *centroids) {
+    metric_params_t params;
+    prepare_metric(num_points, points, opts, NULL, &params);
+    switch (opts->metric)
+    {
+        case METRIC_COSINE:
+            return fp32_objective<cosine_metric>(num_points, opts->dims, opts->num_clusters, points, centroids, &params);
+        case METRIC_L1:
+            return fp32_objective<l1_metric>(num_points, opts->dims, opts->num_clusters, points, centroids, &params);
+        case METRIC_MAHALANOBIS:
+            return fp32_objective<mahalanobis_metric>(num_points, opts->dims, opts->num_clusters, points, centroids, &params);
+        default:
+            return fp32_objective<euclidean_metric>(num_points, opts->dims, opts->num_clusters, points, centroids, &params);
+    }
+}
+
+void report_storage_accuracy(int num_points, real *points, struct options_t *opts, int *cluster_id_of_points, real *centroids,
+                             real *initial_centroids) {
+    int dims = opts->dims;
+    int num_clusters = opts->num_clusters;
+
+    struct options_t reference_opts = *opts;
+    reference_opts.storage = STORAGE_FP32;
+    kmeans_context_t *context = opts->context;
+    int *reference_ids = context_array<int>(context, CONTEXT_STORAGE, SLOT_STORAGE_REFERENCE_IDS, num_points);
+    real *reference_centroids = context_array<real>(context, CONTEXT_STORAGE, SLOT_STORAGE_REFERENCE_CENTROIDS, num_clusters * dims);
+    memcpy(reference_centroids, initial_centroids, num_clusters * dims * sizeof(real));
+
+    int reference_iterations = fused_fit_metric(num_points, points, &reference_opts, reference_ids, reference_centroids, false);
+
+    int agree = 0;
+    for (int i = 0; i < num_points; i++)
+        if (reference_ids[i] == cluster_id_of_points[i])
+            agree++;
+
+    double inertia = fp32_inertia(num_points, points, opts, centroids);
+    double reference_inertia = fp32_inertia(num_points, points, opts, reference_centroids);
+
+    printf("storage_format: %s \n", storage_format_name(opts->storage));
+    printf("storage_fp32_iterations: %d \n", reference_iterations);
+    printf("storage_assignment_agreement: %f \n", (double)agree / num_points);
+    printf("storage_inertia: %f \n", inertia);
+    printf("storage_fp32_inertia: %f \n", reference_inertia);
+    printf("storage_inertia_ratio: %f \n", inertia / reference_inertia);
+}
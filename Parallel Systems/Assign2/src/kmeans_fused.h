@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+
+#include "argparse.h"
+#include "cache_counters.h"
+#include "cache_tiling.h"
+#include "helpers.h"
+#include "kmeans_metric.h"
+#include "kmeans_sequential.h"
+#include "parallel.h"
+#include "point_storage.h"
+
+// --storage picks how the points are held during the iterations (point_storage.h); sums
+// and centroids stay in double/fp32 either way. --metric picks the distance and its update
+// (kmeans_metric.h) on the rows layout.
+int kmeans_fused(int num_points, real *points, struct options_t *opts, int* cluster_id_of_points, real* centroids);
+
+// Reruns kmeans_fused on the fp32 points from the same initial centroids and prints how
+// many assignments agree with the --storage run and both runs' inertia on the fp32 points,
+// under --metric's distance.
+void report_storage_accuracy(int num_points, real *points, struct options_t *opts, int *cluster_id_of_points, real *centroids,
+                             real *initial_centroids);
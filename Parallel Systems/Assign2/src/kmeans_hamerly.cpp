@@ -0,0 +1,173 @@
+#include "kmeans_hamerly.h"
+
+using namespace std;
+
+extern bool debug;
+extern bool timer_debug;
+
+// exhaustive scan that also remembers the runner-up, used whenever the bounds can't prune
+static void closest_two(int num_clusters, int dims, real *point, real *centroids, int *best_centroid, real *best_distance, real *second_distance) {
+    *best_centroid = -1;
+    *best_distance = DBL_MAX;
+    *second_distance = DBL_MAX;
+    for (int c = 0; c < num_clusters; c++) {
+        real distance = squared_distance(point, &centroids[c * dims], dims);
+        if (distance < *best_distance) {
+            *second_distance = *best_distance;
+            *best_distance = distance;
+            *best_centroid = c;
+        } else if (distance < *second_distance) {
+            *second_distance = distance;
+        }
+    }
+}
+
+static long hamerly_assignment(int num_clusters, int dims, int begin, int end, real *points, real *centroids, double slack,
+                               double *half_nearest, bool first_iteration,
+                               int *cluster_id_of_points, double *upper, double *lower, int *changed) {
+    long computed = 0;
+    for (int i = begin; i < end; i++) {
+        real *point = &points[i * dims];
+        int best_centroid = cluster_id_of_points[i];
+
+        if (!first_iteration) {
+            double bound = max(half_nearest[best_centroid], lower[i]);
+            if (upper[i] < bound)
+                continue;
+
+            real distance = squared_distance(point, &centroids[best_centroid * dims], dims);
+            computed++;
+            upper[i] = sqrt((double)distance) * (1.0 + slack);
+            if (upper[i] < bound)
+                continue;
+        }
+
+        real best_distance, second_distance;
+        closest_two(num_clusters, dims, point, centroids, &best_centroid, &best_distance, &second_distance);
+        computed += num_clusters;
+
+        if (cluster_id_of_points[i] != best_centroid)
+            (*changed)++;
+        cluster_id_of_points[i] = best_centroid;
+        upper[i] = sqrt((double)best_distance) * (1.0 + slack);
+        lower[i] = sqrt((double)second_distance) * (1.0 - slack);
+    }
+    return computed;
+}
+
+int kmeans_hamerly(int num_points, real *points, struct options_t *opts, int *cluster_id_of_points, real *centroids) {
+    int dims = opts->dims;
+    int num_clusters = opts->num_clusters;
+    int max_num_iters = opts->max_num_iter;
+    int num_workers = opts->workers;
+    real threshold = opts->threshold;
+    bool use_alternate_convergence = opts->avoid_floating_point_convergence;
+    double slack = bound_slack(dims);
+
+    kmeans_context_t *context = opts->context;
+    int *cluster_sizes = context_array<int>(context, CONTEXT_HAMERLY, SLOT_HAMERLY_SIZES, num_clusters);
+    real *old_centroids = context_array<real>(context, CONTEXT_HAMERLY, SLOT_HAMERLY_OLD_CENTROIDS, num_clusters * dims);
+    double *upper = context_array<double>(context, CONTEXT_HAMERLY, SLOT_HAMERLY_UPPER, num_points);
+    double *lower = context_array<double>(context, CONTEXT_HAMERLY, SLOT_HAMERLY_LOWER, num_points);
+    double *half_nearest = context_array<double>(context, CONTEXT_HAMERLY, SLOT_HAMERLY_HALF_NEAREST, num_clusters);
+    double *drift = context_array<double>(context, CONTEXT_HAMERLY, SLOT_HAMERLY_DRIFT, num_clusters);
+    long *computed_by_worker = context_array<long>(context, CONTEXT_HAMERLY, SLOT_HAMERLY_COMPUTED, num_workers);
+    int *changed_by_worker = context_array<int>(context, CONTEXT_HAMERLY, SLOT_HAMERLY_CHANGED, num_workers);
+    bool trace = telemetry_enabled(context);
+    phase_clock_t phases(trace);
+
+    if(debug){
+        cout << "dims = " << dims << endl;
+        cout << "num_clusters = " << num_clusters << endl;
+        cout << "max_num_iters = " << max_num_iters << endl;
+        cout << "threshold = " << threshold << endl;
+        cout << "num_points = " << num_points << endl;
+
+        cout << "*********** INITIAL CENTROIDS ***********" << endl;
+        print_centroids(centroids, num_clusters, dims);
+    }
+
+    bool done = false;
+    int iterations = 0;
+
+    while(!done) {
+        phases.start();
+        memset(computed_by_worker, 0, num_workers * sizeof(long));
+        memset(changed_by_worker, 0, num_workers * sizeof(int));
+
+        if (iterations > 0)
+            compute_centroid_distances(num_clusters, dims, centroids, slack, NULL, half_nearest);
+
+        parallel_for(num_workers, num_points, [&](int begin, int end, int worker) {
+            computed_by_worker[worker] = hamerly_assignment(num_clusters, dims, begin, end, points, centroids, slack,
+                                                            half_nearest, iterations == 0, cluster_id_of_points, upper, lower,
+                                                            &changed_by_worker[worker]);
+        });
+
+        double assign_time = phases.lap();
+
+        memcpy(old_centroids, centroids, num_clusters * dims * sizeof(real));
+        update_centroids(num_clusters, dims, num_points, points, cluster_id_of_points, centroids, cluster_sizes);
+
+        // the single lower bound covers every other centroid, so it shrinks by the largest
+        // drift among them: the overall maximum, or the runner-up for the centroid that had it
+        compute_drift(num_clusters, dims, old_centroids, centroids, drift);
+        int max_drift_centroid = 0;
+        double second_max_drift = 0.0;
+        for (int c = 1; c < num_clusters; c++) {
+            if (drift[c] > drift[max_drift_centroid]) {
+                second_max_drift = drift[max_drift_centroid];
+                max_drift_centroid = c;
+            } else if (drift[c] > second_max_drift) {
+                second_max_drift = drift[c];
+            }
+        }
+
+        parallel_for(num_workers, num_points, [&](int begin, int end, int worker) {
+            for (int i = begin; i < end; i++) {
+                int c = cluster_id_of_points[i];
+                upper[i] += drift[c];
+                lower[i] -= c == max_drift_centroid ? second_max_drift : drift[max_drift_centroid];
+            }
+        });
+
+        double update_time = phases.lap();
+
+        long computed = 0;
+        int changed = 0;
+        for (int w = 0; w < num_workers; w++) {
+            computed += computed_by_worker[w];
+            changed += changed_by_worker[w];
+        }
+
+        iterations++;
+        bool is_converged;
+
+        if (use_alternate_convergence)
+            is_converged = changed == 0;
+        else
+            is_converged = converged(num_clusters, dims, threshold, old_centroids, centroids);
+
+        done = iterations > max_num_iters || is_converged;
+
+        if (trace) {
+            iteration_telemetry_t stats = {iterations, assign_time, update_time, phases.lap(), iterations == 1 ? num_points : changed,
+                                           computed,
+                                           assignment_inertia(context, num_points, dims, points, cluster_id_of_points, centroids,
+                                                              num_workers)};
+            write_iteration_telemetry(context->telemetry, "hamerly", &stats);
+        }
+
+        if(timer_debug) {
+            double total = (double)num_points * num_clusters;
+            printf("hamerly_iteration: %d skipped_fraction: %f \n", iterations, 1.0 - computed / total);
+        }
+
+        if(debug){
+            cout << "*********** CENTROIDS " << iterations << " ***********" << endl;
+            print_centroids(centroids, num_clusters, dims);
+        }
+    }
+
+    return iterations;
+}
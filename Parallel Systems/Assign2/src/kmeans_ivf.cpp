@@ -0,0 +1,318 @@
+#include "kmeans_ivf.h"
+
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+extern bool debug;
+extern bool timer_debug;
+
+void alloc_ivf_index(struct kmeans_context_t *context, int num_clusters, int dims, ivf_index_t *index) {
+    index->num_clusters = num_clusters;
+    index->dims = dims;
+    index->num_lists = max(1, (int)sqrt((double)num_clusters));
+    index->coarse = context_array<real>(context, CONTEXT_IVF, SLOT_IVF_COARSE, (long)index->num_lists * dims);
+    index->list_start = context_array<int>(context, CONTEXT_IVF, SLOT_IVF_LIST_START, index->num_lists + 1);
+    index->members = context_array<int>(context, CONTEXT_IVF, SLOT_IVF_MEMBERS, num_clusters);
+    index->list_centroids = context_array<real>(context, CONTEXT_IVF, SLOT_IVF_LIST_CENTROIDS, (long)num_clusters * dims);
+    index->owner = context_array<int>(context, CONTEXT_IVF, SLOT_IVF_OWNER, num_clusters);
+    index->sums = context_array<double>(context, CONTEXT_IVF, SLOT_IVF_LIST_SUMS, (long)index->num_lists * dims);
+    index->counts = context_array<int>(context, CONTEXT_IVF, SLOT_IVF_LIST_COUNTS, index->num_lists);
+}
+
+static int nearest(const real *point, const real *rows, int num_rows, int dims) {
+    int best = 0;
+    real best_distance = DBL_MAX;
+    for (int r = 0; r < num_rows; r++) {
+        real distance = squared_distance(point, &rows[(long)r * dims], dims);
+        if (distance < best_distance) {
+            best_distance = distance;
+            best = r;
+        }
+    }
+    return best;
+}
+
+void build_ivf_index(real *centroids, int num_workers, bool first, ivf_index_t *index) {
+    int dims = index->dims;
+    int num_clusters = index->num_clusters;
+    int num_lists = index->num_lists;
+
+    // evenly spaced centroids to start; afterwards the centroids have only moved a little
+    if (first) {
+        for (int l = 0; l < num_lists; l++)
+            memcpy(&index->coarse[(long)l * dims], &centroids[(long)l * num_clusters / num_lists * dims], dims * sizeof(real));
+    }
+
+    double *sums = index->sums;
+    int *counts = index->counts;
+    for (int iter = 0; iter <= IVF_COARSE_ITERS; iter++) {
+        parallel_for(num_workers, num_clusters, [&](int begin, int end, int worker) {
+            for (int c = begin; c < end; c++)
+                index->owner[c] = nearest(&centroids[(long)c * dims], index->coarse, num_lists, dims);
+        });
+        if (iter == IVF_COARSE_ITERS)
+            break;
+
+        memset(sums, 0, (long)num_lists * dims * sizeof(double));
+        memset(counts, 0, num_lists * sizeof(int));
+        for (int c = 0; c < num_clusters; c++) {
+            int l = index->owner[c];
+            counts[l]++;
+            for (int d = 0; d < dims; d++)
+                sums[(long)l * dims + d] += centroids[(long)c * dims + d];
+        }
+        // a list that lost all its centroids keeps its centre for the next round
+        for (int l = 0; l < num_lists; l++) {
+            if (counts[l] == 0)
+                continue;
+            for (int d = 0; d < dims; d++)
+                index->coarse[(long)l * dims + d] = sums[(long)l * dims + d] / counts[l];
+        }
+    }
+
+    // counting sort of the centroids by list, in index order within a list
+    memset(counts, 0, num_lists * sizeof(int));
+    for (int c = 0; c < num_clusters; c++)
+        counts[index->owner[c]]++;
+    index->list_start[0] = 0;
+    for (int l = 0; l < num_lists; l++)
+        index->list_start[l + 1] = index->list_start[l] + counts[l];
+    for (int l = 0; l < num_lists; l++)
+        counts[l] = index->list_start[l];
+    for (int c = 0; c < num_clusters; c++) {
+        int j = counts[index->owner[c]]++;
+        index->members[j] = c;
+        memcpy(&index->list_centroids[(long)j * dims], &centroids[(long)c * dims], dims * sizeof(real));
+    }
+}
+
+struct ivf_worker_t {
+    double *sums;
+    int *counts;
+    real *coarse_distances;
+    int *probe_order;
+    int changed;
+    long computed;
+};
+
+// nearest centroid among the members of the nprobe lists whose centres are nearest to the point;
+// ties go to the lower centroid index, as in the exhaustive scan
+static int search_ivf(const real *point, ivf_index_t *index, int nprobe, ivf_worker_t *worker) {
+    int dims = index->dims;
+    int num_lists = index->num_lists;
+    real *coarse_distances = worker->coarse_distances;
+    int *probe_order = worker->probe_order;
+
+    for (int l = 0; l < num_lists; l++) {
+        coarse_distances[l] = squared_distance(point, &index->coarse[(long)l * dims], dims);
+        probe_order[l] = l;
+    }
+    partial_sort(probe_order, probe_order + nprobe, probe_order + num_lists, [&](int a, int b) {
+        return coarse_distances[a] < coarse_distances[b] || (coarse_distances[a] == coarse_distances[b] && a < b);
+    });
+    worker->computed += num_lists;
+
+    int best_centroid = -1;
+    real best_distance = DBL_MAX;
+    for (int p = 0; p < nprobe; p++) {
+        int l = probe_order[p];
+        for (int j = index->list_start[l]; j < index->list_start[l + 1]; j++) {
+            real distance = squared_distance(point, &index->list_centroids[(long)j * dims], dims);
+            int c = index->members[j];
+            if (distance < best_distance || (distance == best_distance && c < best_centroid)) {
+                best_distance = distance;
+                best_centroid = c;
+            }
+        }
+        worker->computed += index->list_start[l + 1] - index->list_start[l];
+    }
+    return best_centroid;
+}
+
+int kmeans_ivf(int num_points, real *points, struct options_t *opts, int *cluster_id_of_points, real *centroids) {
+    int dims = opts->dims;
+    int num_clusters = opts->num_clusters;
+    int max_num_iters = opts->max_num_iter;
+    int num_workers = opts->workers;
+    int exact_every = opts->exact_every;
+    real threshold = opts->threshold;
+    bool use_alternate_convergence = opts->avoid_floating_point_convergence;
+
+    kmeans_context_t *context = opts->context;
+    ivf_index_t index;
+    alloc_ivf_index(context, num_clusters, dims, &index);
+    int nprobe = min(max(1, opts->nprobe), index.num_lists);
+
+    real *old_centroids = context_array<real>(context, CONTEXT_IVF, SLOT_IVF_OLD_CENTROIDS, num_clusters * dims);
+    ivf_worker_t *workers = context_array<ivf_worker_t>(context, CONTEXT_IVF, SLOT_IVF_WORKERS, num_workers);
+    double *sums = context_array<double>(context, CONTEXT_IVF, SLOT_IVF_SUMS, (long)num_workers * num_clusters * dims);
+    int *counts = context_array<int>(context, CONTEXT_IVF, SLOT_IVF_COUNTS, num_workers * num_clusters);
+    real *coarse_distances = context_array<real>(context, CONTEXT_IVF, SLOT_IVF_COARSE_DISTANCES, num_workers * index.num_lists);
+    int *probe_order = context_array<int>(context, CONTEXT_IVF, SLOT_IVF_PROBE_ORDER, num_workers * index.num_lists);
+    for (int w = 0; w < num_workers; w++) {
+        workers[w].sums = &sums[(long)w * num_clusters * dims];
+        workers[w].counts = &counts[w * num_clusters];
+        workers[w].coarse_distances = &coarse_distances[w * index.num_lists];
+        workers[w].probe_order = &probe_order[w * index.num_lists];
+    }
+    for (int i = 0; i < num_points; i++)
+        cluster_id_of_points[i] = -1;
+
+    int sample_stride = max(1, num_points / IVF_RECALL_SAMPLE);
+    int num_samples = (num_points + sample_stride - 1) / sample_stride;
+    int *sample_correct = context_array<int>(context, CONTEXT_IVF, SLOT_IVF_SAMPLE_CORRECT, num_workers);
+    bool trace = telemetry_enabled(context);
+    phase_clock_t phases(trace);
+
+    if(debug){
+        cout << "dims = " << dims << endl;
+        cout << "num_clusters = " << num_clusters << endl;
+        cout << "max_num_iters = " << max_num_iters << endl;
+        cout << "threshold = " << threshold << endl;
+        cout << "num_points = " << num_points << endl;
+        cout << "num_lists = " << index.num_lists << endl;
+        cout << "nprobe = " << nprobe << endl;
+
+        cout << "*********** INITIAL CENTROIDS ***********" << endl;
+        print_centroids(centroids, num_clusters, dims);
+    }
+
+    bool done = false;
+    int iterations = 0;
+    double exact_time = 0.0, approx_time = 0.0, exact_fraction_total = 0.0;
+    int exact_passes = 0, approx_passes = 0;
+
+    while(!done) {
+        phases.start();
+        memcpy(old_centroids, centroids, num_clusters * dims * sizeof(real));
+        bool exact = exact_every > 0 && iterations % exact_every == 0;
+
+        auto assign_start = chrono::high_resolution_clock::now();
+        if (!exact)
+            build_ivf_index(centroids, num_workers, approx_passes == 0, &index);
+
+        // reset every worker, parallel_for may leave the last ones without a range
+        for (int w = 0; w < num_workers; w++) {
+            ivf_worker_t &worker = workers[w];
+            memset(worker.sums, 0, (long)num_clusters * dims * sizeof(double));
+            memset(worker.counts, 0, num_clusters * sizeof(int));
+            worker.changed = 0;
+            worker.computed = 0;
+        }
+
+        parallel_for(num_workers, num_points, [&](int begin, int end, int w) {
+            ivf_worker_t *worker = &workers[w];
+            for (int i = begin; i < end; i++) {
+                real *point = &points[(long)i * dims];
+                int best_centroid;
+                if (exact) {
+                    best_centroid = nearest(point, centroids, num_clusters, dims);
+                    worker->computed += num_clusters;
+                } else {
+                    best_centroid = search_ivf(point, &index, nprobe, worker);
+                }
+
+                if (cluster_id_of_points[i] != best_centroid)
+                    worker->changed++;
+                cluster_id_of_points[i] = best_centroid;
+                worker->counts[best_centroid]++;
+                double *sum = &worker->sums[(long)best_centroid * dims];
+                for (int d = 0; d < dims; d++)
+                    sum[d] += point[d];
+            }
+        });
+        auto assign_time = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - assign_start);
+        double assign_phase_time = phases.lap();
+
+        // the sample is checked before the update, against the centroids the points were assigned to
+        double exact_fraction = 1.0;
+        if (timer_debug && !exact) {
+            memset(sample_correct, 0, num_workers * sizeof(int));
+            parallel_for(num_workers, num_samples, [&](int begin, int end, int w) {
+                for (int s = begin; s < end; s++) {
+                    int i = s * sample_stride;
+                    if (nearest(&points[(long)i * dims], centroids, num_clusters, dims) == cluster_id_of_points[i])
+                        sample_correct[w]++;
+                }
+            });
+            int correct = 0;
+            for (int w = 0; w < num_workers; w++)
+                correct += sample_correct[w];
+            exact_fraction = (double)correct / num_samples;
+        }
+        // the recall sample is a report of its own, not part of any phase
+        phases.start();
+
+        long computed = 0;
+        int changed = 0;
+        for (int c = 0; c < num_clusters; c++) {
+            int count = 0;
+            for (int w = 0; w < num_workers; w++)
+                count += workers[w].counts[c];
+            for (int d = 0; d < dims; d++) {
+                double sum = 0.0;
+                for (int w = 0; w < num_workers; w++)
+                    sum += workers[w].sums[(long)c * dims + d];
+                // like update_centroids, an empty cluster ends up at zero
+                centroids[c * dims + d] = count > 0 ? sum / count : 0.0;
+            }
+        }
+        for (int w = 0; w < num_workers; w++) {
+            computed += workers[w].computed;
+            changed += workers[w].changed;
+        }
+
+        double update_time = phases.lap();
+
+        if (exact) {
+            exact_time += assign_time.count();
+            exact_passes++;
+        } else {
+            approx_time += assign_time.count();
+            exact_fraction_total += exact_fraction;
+            approx_passes++;
+        }
+
+        iterations++;
+        bool is_converged;
+
+        if (use_alternate_convergence)
+            is_converged = changed == 0;
+        else
+            is_converged = converged(num_clusters, dims, threshold, old_centroids, centroids);
+
+        done = iterations > max_num_iters || is_converged;
+
+        if (trace) {
+            iteration_telemetry_t stats = {iterations, assign_phase_time, update_time, phases.lap(), iterations == 1 ? num_points : changed,
+                                           computed,
+                                           assignment_inertia(context, num_points, dims, points, cluster_id_of_points, centroids,
+                                                              num_workers)};
+            write_iteration_telemetry(context->telemetry, "ivf", &stats);
+        }
+
+        if(timer_debug) {
+            double total = (double)num_points * num_clusters;
+            printf("ivf_iteration: %d exact_pass: %d exact_fraction: %f distance_fraction: %f assign_time: %f ms \n",
+                   iterations, exact ? 1 : 0, exact_fraction, computed / total, assign_time.count());
+        }
+
+        if(debug){
+            cout << "*********** CENTROIDS " << iterations << " ***********" << endl;
+            print_centroids(centroids, num_clusters, dims);
+        }
+    }
+
+    if(timer_debug) {
+        printf("ivf_lists: %d nprobe: %d \n", index.num_lists, nprobe);
+        if (approx_passes > 0)
+            printf("ivf_exact_fraction: %f \n", exact_fraction_total / approx_passes);
+        // mean assignment time of a full scan over that of an index search (the index build included)
+        if (approx_passes > 0 && exact_passes > 0)
+            printf("ivf_assign_speedup: %f \n", (exact_time / exact_passes) / (approx_time / approx_passes));
+    }
+
+    return iterations;
+}
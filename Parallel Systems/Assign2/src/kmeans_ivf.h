@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+
+#include "argparse.h"
+#include "helpers.h"
+#include "kmeans_sequential.h"
+#include "kmeans_context.h"
+#include "parallel.h"
+
+// Lloyd iterations run over the centroids to place the coarse centres each time the index is rebuilt
+#define IVF_COARSE_ITERS 4
+// points checked against the exhaustive scan per iteration under -r
+#define IVF_RECALL_SAMPLE 512
+
+// Inverted index over the centroids: about sqrt(k) coarse centres, each owning the centroids
+// nearest to it. The member centroids are copied out in list order so a probe reads one
+// contiguous block.
+struct ivf_index_t {
+    int num_lists;
+    int num_clusters;
+    int dims;
+    real *coarse;           // num_lists x dims
+    int *list_start;        // num_lists + 1 offsets into members
+    int *members;           // centroid indices, grouped by list
+    real *list_centroids;   // centroids[members[j]] at row j
+    int *owner;             // list of every centroid
+    double *sums;           // num_lists x dims, for placing the coarse centres
+    int *counts;            // num_lists
+};
+
+// the index arrays are workspaces of the context
+void alloc_ivf_index(struct kmeans_context_t *context, int num_clusters, int dims, ivf_index_t *index);
+
+// Places the coarse centres (starting from the previous ones after the first build) and
+// regroups the centroids under them.
+void build_ivf_index(real *centroids, int num_workers, bool first, ivf_index_t *index);
+
+// Approximate assignment for large k. Every iteration rebuilds the index over the current
+// centroids; each point is compared with the coarse centres and then only with the members
+// of the nprobe nearest lists. Every exact_every-th iteration (starting with the first) scans
+// all the centroids instead, so the drift from missed neighbours cannot build up. Under -r
+// each iteration reports how many of a sample of points got the same centroid as the
+// exhaustive scan and how many distances were computed relative to n*k.
+int kmeans_ivf(int num_points, real *points, struct options_t *opts, int* cluster_id_of_points, real* centroids);
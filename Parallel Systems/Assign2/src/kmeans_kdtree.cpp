@@ -0,0 +1,389 @@
+#include "kmeans_kdtree.h"
+
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+extern bool debug;
+extern bool timer_debug;
+
+// box, count and sum of the rows in [begin, end) of the original points, listed by order
+static void summarize_node(kdtree_t *tree, real *points, int node) {
+    int dims = tree->dims;
+    real *low = &tree->low[(long)node * dims];
+    real *high = &tree->high[(long)node * dims];
+    double *sum = &tree->sum[(long)node * dims];
+    for (int d = 0; d < dims; d++) {
+        low[d] = FLT_MAX;
+        high[d] = -FLT_MAX;
+        sum[d] = 0.0;
+    }
+    for (int j = tree->begin[node]; j < tree->end[node]; j++) {
+        real *point = &points[(long)tree->order[j] * dims];
+        for (int d = 0; d < dims; d++) {
+            low[d] = min(low[d], point[d]);
+            high[d] = max(high[d], point[d]);
+            sum[d] += point[d];
+        }
+    }
+}
+
+// splits at the median of the widest box dimension; the top levels build the two sides on two workers
+static void build_node(kdtree_t *tree, real *points, int node, int begin, int end, int depth, int spawn_depth) {
+    int dims = tree->dims;
+    tree->begin[node] = begin;
+    tree->end[node] = end;
+    summarize_node(tree, points, node);
+
+    tree->leaf[node] = end - begin <= KDTREE_LEAF_SIZE || depth == tree->max_depth;
+    if (tree->leaf[node])
+        return;
+
+    int split_dim = 0;
+    for (int d = 1; d < dims; d++) {
+        real extent = tree->high[(long)node * dims + d] - tree->low[(long)node * dims + d];
+        if (extent > tree->high[(long)node * dims + split_dim] - tree->low[(long)node * dims + split_dim])
+            split_dim = d;
+    }
+
+    int middle = begin + (end - begin) / 2;
+    nth_element(&tree->order[begin], &tree->order[middle], &tree->order[end], [&](int a, int b) {
+        return points[(long)a * dims + split_dim] < points[(long)b * dims + split_dim];
+    });
+
+    if (depth < spawn_depth) {
+        parallel_for(2, 2, [&](int first, int last, int worker) {
+            if (first == 0)
+                build_node(tree, points, 2 * node + 1, begin, middle, depth + 1, spawn_depth);
+            else
+                build_node(tree, points, 2 * node + 2, middle, end, depth + 1, spawn_depth);
+        });
+    } else {
+        build_node(tree, points, 2 * node + 1, begin, middle, depth + 1, spawn_depth);
+        build_node(tree, points, 2 * node + 2, middle, end, depth + 1, spawn_depth);
+    }
+}
+
+void build_kdtree(struct kmeans_context_t *context, int num_points, int dims, real *points, int num_workers, kdtree_t *tree) {
+    tree->num_points = num_points;
+    tree->dims = dims;
+    // median splits keep sibling sizes within one point, so every leaf sits at max_depth or one above
+    tree->max_depth = 0;
+    while (((long)KDTREE_LEAF_SIZE << tree->max_depth) < num_points)
+        tree->max_depth++;
+    tree->num_nodes = (2 << tree->max_depth) - 1;
+
+    tree->order = context_array<int>(context, CONTEXT_KDTREE, SLOT_KDTREE_ORDER, num_points);
+    tree->begin = context_array<int>(context, CONTEXT_KDTREE, SLOT_KDTREE_BEGIN, tree->num_nodes);
+    tree->end = context_array<int>(context, CONTEXT_KDTREE, SLOT_KDTREE_END, tree->num_nodes);
+    tree->leaf = context_array<bool>(context, CONTEXT_KDTREE, SLOT_KDTREE_LEAF, tree->num_nodes);
+    tree->low = context_array<real>(context, CONTEXT_KDTREE, SLOT_KDTREE_LOW, (long)tree->num_nodes * dims);
+    tree->high = context_array<real>(context, CONTEXT_KDTREE, SLOT_KDTREE_HIGH, (long)tree->num_nodes * dims);
+    tree->sum = context_array<double>(context, CONTEXT_KDTREE, SLOT_KDTREE_NODE_SUMS, (long)tree->num_nodes * dims);
+    memset(tree->leaf, 0, tree->num_nodes * sizeof(bool));
+    for (int i = 0; i < num_points; i++)
+        tree->order[i] = i;
+
+    int spawn_depth = 0;
+    while ((1 << spawn_depth) < num_workers)
+        spawn_depth++;
+    build_node(tree, points, 0, 0, num_points, 0, spawn_depth);
+
+    tree->points = context_array<real>(context, CONTEXT_KDTREE, SLOT_KDTREE_POINTS, (long)num_points * dims);
+    parallel_for(num_workers, num_points, [&](int begin, int end, int worker) {
+        for (int j = begin; j < end; j++)
+            memcpy(&tree->points[(long)j * dims], &points[(long)tree->order[j] * dims], dims * sizeof(real));
+    });
+}
+
+struct filter_state_t {
+    kdtree_t *tree;
+    real *centroids;
+    int num_clusters;
+    double slack;
+    int *candidates;    // one list of num_clusters per depth
+    double *sums;       // this worker's num_clusters x dims
+    int *counts;
+    int *tree_ids;      // cluster of every tree row
+    int changed;
+    long computed;      // point-centroid and box-centroid distance evaluations
+};
+
+static void assign_node(filter_state_t *state, int node, int cluster) {
+    kdtree_t *tree = state->tree;
+    int dims = tree->dims;
+    double *sum = &state->sums[(long)cluster * dims];
+    double *node_sum = &tree->sum[(long)node * dims];
+    for (int d = 0; d < dims; d++)
+        sum[d] += node_sum[d];
+    state->counts[cluster] += tree->end[node] - tree->begin[node];
+    for (int j = tree->begin[node]; j < tree->end[node]; j++) {
+        if (state->tree_ids[j] != cluster)
+            state->changed++;
+        state->tree_ids[j] = cluster;
+    }
+}
+
+static void filter_node(filter_state_t *state, int node, int depth, int *candidates, int num_candidates) {
+    kdtree_t *tree = state->tree;
+    int dims = tree->dims;
+    real *centroids = state->centroids;
+
+    if (num_candidates == 1) {
+        assign_node(state, node, candidates[0]);
+        return;
+    }
+
+    real *low = &tree->low[(long)node * dims];
+    real *high = &tree->high[(long)node * dims];
+
+    if (!tree->leaf[node]) {
+        // the candidate nearest the box centre...
+        int closest = candidates[0];
+        double closest_distance = DBL_MAX;
+        for (int j = 0; j < num_candidates; j++) {
+            double distance = 0.0;
+            for (int d = 0; d < dims; d++) {
+                double diff = 0.5 * ((double)low[d] + high[d]) - centroids[candidates[j] * dims + d];
+                distance += diff * diff;
+            }
+            if (distance < closest_distance) {
+                closest_distance = distance;
+                closest = candidates[j];
+            }
+        }
+        state->computed += num_candidates;
+
+        // ...is compared with every other candidate at the box corner most favourable to it.
+        // Over the box, |x-z|^2 - |x-z*|^2 is smallest there; z is dropped only when that
+        // smallest gap beats the rounding error of a float distance as large as the farthest
+        // corner from z*
+        const real *best = &centroids[closest * dims];
+        double farthest = 0.0;
+        for (int d = 0; d < dims; d++) {
+            double to_low = (double)low[d] - best[d];
+            double to_high = (double)high[d] - best[d];
+            farthest += max(to_low * to_low, to_high * to_high);
+        }
+        double margin = 2.0 * state->slack * farthest;
+
+        int *kept = &state->candidates[(depth + 1) * state->num_clusters];
+        int num_kept = 0;
+        for (int j = 0; j < num_candidates; j++) {
+            int c = candidates[j];
+            if (c != closest) {
+                const real *other = &centroids[c * dims];
+                double gap = 0.0;
+                for (int d = 0; d < dims; d++) {
+                    double corner = other[d] > best[d] ? high[d] : low[d];
+                    double to_other = corner - other[d];
+                    double to_best = corner - best[d];
+                    gap += to_other * to_other - to_best * to_best;
+                }
+                if (gap > margin)
+                    continue;
+            }
+            kept[num_kept++] = c;
+        }
+        state->computed += num_candidates - 1;
+
+        if (num_kept == 1) {
+            assign_node(state, node, kept[0]);
+            return;
+        }
+        filter_node(state, 2 * node + 1, depth + 1, kept, num_kept);
+        filter_node(state, 2 * node + 2, depth + 1, kept, num_kept);
+        return;
+    }
+
+    // leaf: the surviving candidates in index order, scanned like assign_points_to_clusters
+    for (int j = tree->begin[node]; j < tree->end[node]; j++) {
+        real *point = &tree->points[(long)j * dims];
+        int best_centroid = -1;
+        real best_distance = DBL_MAX;
+        for (int n = 0; n < num_candidates; n++) {
+            int c = candidates[n];
+            real distance = squared_distance(point, &centroids[c * dims], dims);
+            if (distance < best_distance) {
+                best_distance = distance;
+                best_centroid = c;
+            }
+        }
+        if (state->tree_ids[j] != best_centroid)
+            state->changed++;
+        state->tree_ids[j] = best_centroid;
+        state->counts[best_centroid]++;
+        double *sum = &state->sums[(long)best_centroid * dims];
+        for (int d = 0; d < dims; d++)
+            sum[d] += point[d];
+    }
+    state->computed += (long)(tree->end[node] - tree->begin[node]) * num_candidates;
+}
+
+int kmeans_kdtree(int num_points, real *points, struct options_t *opts, int *cluster_id_of_points, real *centroids) {
+    int dims = opts->dims;
+    int num_clusters = opts->num_clusters;
+    int max_num_iters = opts->max_num_iter;
+    int num_workers = opts->workers;
+    real threshold = opts->threshold;
+    bool use_alternate_convergence = opts->avoid_floating_point_convergence;
+
+    auto build_start = chrono::high_resolution_clock::now();
+    kmeans_context_t *context = opts->context;
+    kdtree_t tree;
+    build_kdtree(context, num_points, dims, points, num_workers, &tree);
+    auto build_time = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - build_start);
+
+    // subtrees handed to the workers: every node at the first depth with a few per worker.
+    // A level at most doubles the list, so it never reaches 8 per worker
+    int *tasks = context_array<int>(context, CONTEXT_KDTREE, SLOT_KDTREE_TASKS, 8 * num_workers);
+    int *next = context_array<int>(context, CONTEXT_KDTREE, SLOT_KDTREE_NEXT_TASKS, 8 * num_workers);
+    int num_tasks = 1;
+    tasks[0] = 0;
+    while (num_tasks < 4 * num_workers) {
+        int num_next = 0;
+        for (int t = 0; t < num_tasks; t++) {
+            int node = tasks[t];
+            if (tree.leaf[node]) {
+                next[num_next++] = node;
+            } else {
+                next[num_next++] = 2 * node + 1;
+                next[num_next++] = 2 * node + 2;
+            }
+        }
+        if (num_next == num_tasks)
+            break;
+        swap(tasks, next);
+        num_tasks = num_next;
+    }
+
+    real *old_centroids = context_array<real>(context, CONTEXT_KDTREE, SLOT_KDTREE_OLD_CENTROIDS, num_clusters * dims);
+    int *tree_ids = context_array<int>(context, CONTEXT_KDTREE, SLOT_KDTREE_TREE_IDS, num_points);
+    filter_state_t *states = context_array<filter_state_t>(context, CONTEXT_KDTREE, SLOT_KDTREE_STATES, num_workers);
+    long candidates_per_worker = (long)(tree.max_depth + 2) * num_clusters;
+    int *candidates = context_array<int>(context, CONTEXT_KDTREE, SLOT_KDTREE_CANDIDATES, num_workers * candidates_per_worker);
+    double *sums = context_array<double>(context, CONTEXT_KDTREE, SLOT_KDTREE_SUMS, (long)num_workers * num_clusters * dims);
+    int *counts = context_array<int>(context, CONTEXT_KDTREE, SLOT_KDTREE_COUNTS, num_workers * num_clusters);
+    for (int w = 0; w < num_workers; w++) {
+        states[w].tree = &tree;
+        states[w].centroids = centroids;
+        states[w].num_clusters = num_clusters;
+        states[w].slack = bound_slack(dims);
+        states[w].candidates = &candidates[w * candidates_per_worker];
+        states[w].sums = &sums[(long)w * num_clusters * dims];
+        states[w].counts = &counts[w * num_clusters];
+        states[w].tree_ids = tree_ids;
+    }
+    for (int j = 0; j < num_points; j++)
+        tree_ids[j] = -1;
+    bool trace = telemetry_enabled(context);
+    phase_clock_t phases(trace);
+
+    if(debug){
+        cout << "dims = " << dims << endl;
+        cout << "num_clusters = " << num_clusters << endl;
+        cout << "max_num_iters = " << max_num_iters << endl;
+        cout << "threshold = " << threshold << endl;
+        cout << "num_points = " << num_points << endl;
+        cout << "tree depth = " << tree.max_depth << endl;
+
+        cout << "*********** INITIAL CENTROIDS ***********" << endl;
+        print_centroids(centroids, num_clusters, dims);
+    }
+
+    bool done = false;
+    int iterations = 0;
+
+    while(!done) {
+        phases.start();
+        memcpy(old_centroids, centroids, num_clusters * dims * sizeof(real));
+
+        // reset every worker, parallel_for may leave the last ones without a range
+        for (int w = 0; w < num_workers; w++) {
+            filter_state_t &state = states[w];
+            memset(state.sums, 0, (long)num_clusters * dims * sizeof(double));
+            memset(state.counts, 0, num_clusters * sizeof(int));
+            state.changed = 0;
+            state.computed = 0;
+        }
+
+        parallel_for(num_workers, num_tasks, [&](int begin, int end, int worker) {
+            filter_state_t *state = &states[worker];
+            // every task starts from the full candidate list, in index order
+            int *all = state->candidates;
+            for (int c = 0; c < num_clusters; c++)
+                all[c] = c;
+            for (int t = begin; t < end; t++) {
+                int node = tasks[t];
+                int depth = 0;
+                while ((2 << depth) - 1 <= node)
+                    depth++;
+                filter_node(state, node, depth, all, num_clusters);
+            }
+        });
+
+        double assign_time = phases.lap();
+
+        long computed = 0;
+        int changed = 0;
+        for (int c = 0; c < num_clusters; c++) {
+            int count = 0;
+            for (int w = 0; w < num_workers; w++)
+                count += states[w].counts[c];
+            for (int d = 0; d < dims; d++) {
+                double sum = 0.0;
+                for (int w = 0; w < num_workers; w++)
+                    sum += states[w].sums[(long)c * dims + d];
+                // like update_centroids, an empty cluster ends up at zero
+                centroids[c * dims + d] = count > 0 ? sum / count : 0.0;
+            }
+        }
+        for (int w = 0; w < num_workers; w++) {
+            computed += states[w].computed;
+            changed += states[w].changed;
+        }
+
+        double update_time = phases.lap();
+
+        iterations++;
+        bool is_converged;
+
+        if (use_alternate_convergence)
+            is_converged = changed == 0;
+        else
+            is_converged = converged(num_clusters, dims, threshold, old_centroids, centroids);
+
+        done = iterations > max_num_iters || is_converged;
+
+        // the assignment is still in tree order, which the inertia does not mind
+
+        if (trace) {
+            iteration_telemetry_t stats = {iterations, assign_time, update_time, phases.lap(), iterations == 1 ? num_points : changed,
+                                           computed,
+                                           assignment_inertia(context, num_points, dims, tree.points, tree_ids, centroids,
+                                                              num_workers)};
+            write_iteration_telemetry(context->telemetry, "kdtree", &stats);
+        }
+
+        if(timer_debug) {
+            double total = (double)num_points * num_clusters;
+            printf("kdtree_iteration: %d skipped_fraction: %f \n", iterations, max(0.0, 1.0 - computed / total));
+        }
+
+        if(debug){
+            cout << "*********** CENTROIDS " << iterations << " ***********" << endl;
+            print_centroids(centroids, num_clusters, dims);
+        }
+    }
+
+    for (int j = 0; j < num_points; j++)
+        cluster_id_of_points[tree.order[j]] = tree_ids[j];
+
+    if(timer_debug) {
+        printf("kdtree_build_time: %f ms \n", build_time.count());
+        printf("kdtree_nodes: %d \n", tree.num_nodes);
+    }
+
+    return iterations;
+}
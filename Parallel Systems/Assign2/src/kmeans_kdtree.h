@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+
+#include "argparse.h"
+#include "helpers.h"
+#include "kmeans_sequential.h"
+#include "kmeans_bounds.h"
+#include "kmeans_context.h"
+#include "parallel.h"
+
+// points per leaf; a node stops splitting at this size
+#define KDTREE_LEAF_SIZE 32
+
+// Kd-tree over the points in an implicit heap layout (children of node i are 2i+1, 2i+2), so
+// subtrees can be built by different threads without sharing an allocator. Each node covers
+// the contiguous rows [begin, end) of the tree-ordered copy of the points and caches their
+// bounding box, count and coordinate sum.
+struct kdtree_t {
+    int num_points;
+    int dims;
+    int num_nodes;
+    int max_depth;
+    real *points;       // tree order
+    int *order;         // order[j] = original index of tree row j
+    int *begin;
+    int *end;
+    bool *leaf;
+    real *low;          // num_nodes x dims bounding boxes
+    real *high;
+    double *sum;        // num_nodes x dims coordinate sums
+};
+
+// the tree's arrays are workspaces of the context, valid until the next build
+void build_kdtree(struct kmeans_context_t *context, int num_points, int dims, real *points, int num_workers, kdtree_t *tree);
+
+// Filtering algorithm (Kanungo et al.): each iteration pushes the centroids down the tree,
+// dropping the ones that cannot be nearest to anything in a node's box, and assigns whole
+// subtrees from their cached sums once a single candidate is left. A centroid is only dropped
+// with a margin larger than the float rounding of the point distances, so every point gets
+// the centroid assign_points_to_clusters would give it for the same centroids. The tree is
+// built once, in parallel, and the traversal is split across workers by subtree.
+int kmeans_kdtree(int num_points, real *points, struct options_t *opts, int* cluster_id_of_points, real* centroids);
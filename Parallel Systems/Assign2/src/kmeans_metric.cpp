@@ -0,0 +1,84 @@
+#include "kmeans_metric.h"
+
+#include <algorithm>
+
+using namespace std;
+
+void prepare_metric(int num_points, real *points, struct options_t *opts, real *centroids, metric_params_t *params) {
+    int dims = opts->dims;
+    kmeans_context_t *context = opts->context;
+
+    params->weights = NULL;
+    if (opts->metric == METRIC_MAHALANOBIS) {
+        params->weights = context_array<real>(context, CONTEXT_METRIC, SLOT_METRIC_WEIGHTS, dims);
+        double *scratch = context_array<double>(context, CONTEXT_METRIC, SLOT_METRIC_WEIGHT_SCRATCH, (size_t)opts->workers * 2 * dims);
+        diagonal_mahalanobis_weights(num_points, dims, points, params->weights, scratch, opts->workers);
+    }
+    if (opts->metric == METRIC_COSINE && centroids)
+        normalize_centroids(opts->num_clusters, dims, centroids);
+}
+
+void normalize_centroids(int num_clusters, int dims, real *centroids) {
+    for (int c = 0; c < num_clusters; c++) {
+        real *centroid = &centroids[(long)c * dims];
+        double norm = 0.0;
+        for (int d = 0; d < dims; d++)
+            norm += (double)centroid[d] * centroid[d];
+        if (norm > 0) {
+            double scale = 1.0 / sqrt(norm);
+            for (int d = 0; d < dims; d++)
+                centroid[d] *= scale;
+        }
+    }
+}
+
+void update_centroids_spherical(int num_clusters, int dims, int num_points, real *points, int *cluster_id_of_points,
+                                double *sums, real *centroids) {
+    memset(sums, 0, (size_t)num_clusters * dims * sizeof(double));
+    for (int i = 0; i < num_points; i++) {
+        const real *point = &points[(long)i * dims];
+        double norm = 0.0;
+        for (int d = 0; d < dims; d++)
+            norm += (double)point[d] * point[d];
+        if (norm == 0)
+            continue;
+        double scale = 1.0 / sqrt(norm);
+        double *sum = &sums[(long)cluster_id_of_points[i] * dims];
+        for (int d = 0; d < dims; d++)
+            sum[d] += point[d] * scale;
+    }
+    for (long j = 0; j < (long)num_clusters * dims; j++)
+        centroids[j] = sums[j];
+    normalize_centroids(num_clusters, dims, centroids);
+}
+
+void update_centroids_median(int num_clusters, int dims, int num_points, real *points, int *cluster_id_of_points,
+                             int *offsets, int *next, int *order, real *values, real *centroids, int num_workers) {
+    memset(offsets, 0, (num_clusters + 1) * sizeof(int));
+    for (int i = 0; i < num_points; i++)
+        offsets[cluster_id_of_points[i] + 1]++;
+    for (int c = 0; c < num_clusters; c++)
+        offsets[c + 1] += offsets[c];
+    memcpy(next, offsets, num_clusters * sizeof(int));
+    for (int i = 0; i < num_points; i++)
+        order[next[cluster_id_of_points[i]]++] = i;
+
+    parallel_for(num_workers, num_clusters, [&](int begin, int end, int worker) {
+        for (int c = begin; c < end; c++) {
+            int first = offsets[c];
+            int count = offsets[c + 1] - first;
+            real *centroid = &centroids[(long)c * dims];
+            if (count == 0) {
+                memset(centroid, 0, dims * sizeof(real));
+                continue;
+            }
+            real *slice = &values[first];
+            for (int d = 0; d < dims; d++) {
+                for (int j = 0; j < count; j++)
+                    slice[j] = points[(long)order[first + j] * dims + d];
+                nth_element(slice, slice + (count - 1) / 2, slice + count);
+                centroid[d] = slice[(count - 1) / 2];
+            }
+        }
+    });
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+
+#include "argparse.h"
+#include "helpers.h"
+#include "distance_metric.h"
+#include "kmeans_context.h"
+#include "parallel.h"
+
+// What --metric adds to the sequential and fused backends besides the templated assignment:
+// its setup and the centroid updates other than the mean. Mahalanobis keeps the mean, cosine
+// takes the normalized mean of the normalized points (spherical k-means, which also normalizes
+// the seeded centroids) and l1 the coordinate-wise median. An empty cluster gets a zero centroid.
+
+// Works out the weights opts->metric needs into params (kept in the context) and, for cosine,
+// scales the seeded centroids to unit length. centroids may be NULL when only params are wanted.
+void prepare_metric(int num_points, real *points, struct options_t *opts, real *centroids, metric_params_t *params);
+
+// rescales each centroid to unit length, leaving zero ones at zero
+void normalize_centroids(int num_clusters, int dims, real *centroids);
+
+// mean of the unit-length points of each cluster, rescaled to unit length; sums is
+// num_clusters * dims doubles of scratch
+void update_centroids_spherical(int num_clusters, int dims, int num_points, real *points, int *cluster_id_of_points,
+                                double *sums, real *centroids);
+
+// Coordinate-wise lower median of each cluster. The points are bucketed by cluster once
+// (offsets is num_clusters + 1 ints, next num_clusters and order num_points), then each worker
+// takes whole clusters and selects within their slice of values (num_points).
+void update_centroids_median(int num_clusters, int dims, int num_points, real *points, int *cluster_id_of_points,
+                             int *offsets, int *next, int *order, real *values, real *centroids, int num_workers);
+
+// Sum of the Metric distances of the points to their clusters' centroids, accumulated in
+// double; for euclidean_metric it is assignment_inertia.
+template <typename Metric>
+double metric_objective(struct kmeans_context_t *context, int num_points, int dims, real *points, int *cluster_id_of_points,
+                        real *centroids, const metric_params_t *params, int num_workers) {
+    double *partial = context_array<double>(context, CONTEXT_METRIC, SLOT_METRIC_PARTIAL, num_workers);
+    memset(partial, 0, num_workers * sizeof(double));
+    parallel_for(num_workers, num_points, [&](int begin, int end, int worker) {
+        double sum = 0.0;
+        for (int i = begin; i < end; i++) {
+            const real *point = &points[(long)i * dims];
+            sum += Metric::distance(point, Metric::point_term(point, dims), &centroids[(long)cluster_id_of_points[i] * dims], dims,
+                                    params);
+        }
+        partial[worker] = sum;
+    });
+
+    double objective = 0.0;
+    for (int w = 0; w < num_workers; w++)
+        objective += partial[w];
+    return objective;
+}
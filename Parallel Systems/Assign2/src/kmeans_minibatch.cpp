@@ -0,0 +1,340 @@
+#include "kmeans_minibatch.h"
+
+using namespace std;
+
+extern bool debug;
+extern bool timer_debug;
+
+// batches per chunk handed over by the reader thread; random order shuffles within a chunk
+#define BATCHES_PER_CHUNK 8
+
+// Double-buffered reader: the background thread fills one chunk while the other is consumed.
+// In random mode (binary files) each chunk is sampled from the whole file, and a pass is
+// num_points sampled rows. A pass that comes up short of num_points stops the reader with
+// failed set.
+struct chunk_prefetcher_t {
+    point_stream_t *stream;
+    int chunk_points;
+    int max_passes;
+    bool random_rows;
+    uint64_t rng_state;
+    long rows_this_pass;
+    real *buffers[2];
+    int counts[2];
+    bool ready[2];
+    bool finished;
+    bool failed;
+    bool stop;
+    thread reader;
+    mutex lock;
+    condition_variable changed;
+};
+
+static void prefetch_chunks(chunk_prefetcher_t *prefetcher) {
+    int slot = 0;
+    int pass = 0;
+    while (true) {
+        {
+            unique_lock<mutex> guard(prefetcher->lock);
+            prefetcher->changed.wait(guard, [&] { return !prefetcher->ready[slot] || prefetcher->stop; });
+            if (prefetcher->stop)
+                return;
+        }
+
+        int count;
+        bool short_read;
+        point_stream_t *stream = prefetcher->stream;
+        if (prefetcher->random_rows) {
+            long remaining = stream->num_points - prefetcher->rows_this_pass;
+            if (remaining <= 0) {
+                pass++;
+                prefetcher->rows_this_pass = 0;
+                remaining = pass < prefetcher->max_passes ? stream->num_points : 0;
+            }
+            int wanted = (int)min((long)prefetcher->chunk_points, remaining);
+            count = read_random_points(stream, prefetcher->buffers[slot], wanted, &prefetcher->rng_state);
+            prefetcher->rows_this_pass += count;
+            short_read = count < wanted;
+        } else {
+            count = read_points(stream, prefetcher->buffers[slot], prefetcher->chunk_points);
+            if (count == 0 && stream->position == stream->num_points) {
+                pass++;
+                if (pass < prefetcher->max_passes) {
+                    rewind_point_stream(stream);
+                    count = read_points(stream, prefetcher->buffers[slot], prefetcher->chunk_points);
+                }
+            }
+            // the file ended before its count, or had a line that isn't a point
+            short_read = count < 0 || (count < prefetcher->chunk_points && stream->position < stream->num_points);
+        }
+
+        lock_guard<mutex> guard(prefetcher->lock);
+        if (short_read) {
+            prefetcher->failed = true;
+            prefetcher->finished = true;
+            prefetcher->changed.notify_all();
+            return;
+        }
+        if (count == 0) {
+            prefetcher->finished = true;
+            prefetcher->changed.notify_all();
+            return;
+        }
+        prefetcher->counts[slot] = count;
+        prefetcher->ready[slot] = true;
+        prefetcher->changed.notify_all();
+        slot = 1 - slot;
+    }
+}
+
+// the two chunk buffers are CONTEXT_MINIBATCH slots 0 and 1, so only one prefetcher runs at a time
+static void start_prefetcher(kmeans_context_t *context, chunk_prefetcher_t *prefetcher, point_stream_t *stream,
+                             int chunk_points, int max_passes, bool random_rows, int seed) {
+    prefetcher->stream = stream;
+    prefetcher->chunk_points = chunk_points;
+    prefetcher->max_passes = max_passes;
+    prefetcher->random_rows = random_rows;
+    prefetcher->rng_state = 0x9E3779B97F4A7C15ULL ^ (uint64_t)seed;
+    prefetcher->rows_this_pass = 0;
+    for (int slot = 0; slot < 2; slot++) {
+        prefetcher->buffers[slot] = context_array<real>(context, CONTEXT_MINIBATCH, SLOT_MINIBATCH_PREFETCH + slot,
+                                                        (long)chunk_points * stream->dims);
+        prefetcher->counts[slot] = 0;
+        prefetcher->ready[slot] = false;
+    }
+    prefetcher->finished = false;
+    prefetcher->failed = false;
+    prefetcher->stop = false;
+    prefetcher->reader = thread(prefetch_chunks, prefetcher);
+}
+
+// blocks until the chunk in slot is filled; returns its point count, 0 once the stream is
+// exhausted or -1 once the reader has failed
+static int acquire_chunk(chunk_prefetcher_t *prefetcher, int slot) {
+    unique_lock<mutex> guard(prefetcher->lock);
+    prefetcher->changed.wait(guard, [&] { return prefetcher->ready[slot] || prefetcher->finished; });
+    if (prefetcher->ready[slot])
+        return prefetcher->counts[slot];
+    return prefetcher->failed ? -1 : 0;
+}
+
+static void release_chunk(chunk_prefetcher_t *prefetcher, int slot) {
+    lock_guard<mutex> guard(prefetcher->lock);
+    prefetcher->ready[slot] = false;
+    prefetcher->changed.notify_all();
+}
+
+static void stop_prefetcher(chunk_prefetcher_t *prefetcher) {
+    {
+        lock_guard<mutex> guard(prefetcher->lock);
+        prefetcher->stop = true;
+        prefetcher->changed.notify_all();
+    }
+    prefetcher->reader.join();
+}
+
+// after acquire_chunk returned -1: says which point could not be read and exits
+static void prefetch_failed(struct options_t *opts, chunk_prefetcher_t *prefetcher) {
+    stop_prefetcher(prefetcher);
+    point_stream_t *stream = prefetcher->stream;
+    if (prefetcher->random_rows)
+        cerr << "cannot read " << opts->in_file << endl;
+    else
+        cerr << opts->in_file << ": point " << stream->position + 1 << " of " << stream->num_points
+             << " is missing or not an index followed by " << stream->dims << " numbers" << endl;
+    exit(1);
+}
+
+static int nearest_centroid(int num_clusters, int dims, real *point, real *centroids, real *best_distance) {
+    int best_centroid = -1;
+    *best_distance = DBL_MAX;
+    for (int c = 0; c < num_clusters; c++) {
+        real distance = squared_distance(point, &centroids[c * dims], dims);
+        if (distance < *best_distance) {
+            *best_distance = distance;
+            best_centroid = c;
+        }
+    }
+    return best_centroid;
+}
+
+// one mini-batch step; returns the summed squared movement of the centroids
+static double minibatch_step(int num_clusters, int dims, int batch_points, real *batch, int *batch_ids,
+                             real *centroids, long *seen, int num_workers) {
+    // assignments use the centroids from before the batch, as in sculley's algorithm
+    parallel_for(num_workers, batch_points, [&](int begin, int end, int worker) {
+        real distance;
+        for (int i = begin; i < end; i++)
+            batch_ids[i] = nearest_centroid(num_clusters, dims, &batch[i * dims], centroids, &distance);
+    });
+
+    double shift = 0.0;
+    for (int i = 0; i < batch_points; i++) {
+        int c = batch_ids[i];
+        seen[c]++;
+        real rate = 1.0 / seen[c];
+        for (int d = 0; d < dims; d++) {
+            real step = rate * (batch[i * dims + d] - centroids[c * dims + d]);
+            centroids[c * dims + d] += step;
+            shift += (double)step * step;
+        }
+    }
+    return shift;
+}
+
+static void shuffle_rows(int num_rows, int dims, real *rows, real *scratch, int *order) {
+    for (int i = 0; i < num_rows; i++)
+        order[i] = i;
+    for (int i = num_rows - 1; i > 0; i--) {
+        int j = k_means_rand() % (i + 1);
+        int tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+    for (int i = 0; i < num_rows; i++)
+        memcpy(&scratch[i * dims], &rows[order[i] * dims], dims * sizeof(real));
+    memcpy(rows, scratch, (long)num_rows * dims * sizeof(real));
+}
+
+int kmeans_minibatch(struct options_t *opts, real *centroids, double *per_batch_time) {
+    int dims = opts->dims;
+    int num_clusters = opts->num_clusters;
+    int max_batches = opts->max_num_iter;
+    int batch_size = opts->batch_size;
+    int num_workers = opts->workers;
+    real threshold = opts->threshold;
+    int chunk_points = batch_size * BATCHES_PER_CHUNK;
+
+    point_stream_t stream;
+    if (!open_point_stream(&stream, opts->in_file, dims)) {
+        cerr << "cannot open " << opts->in_file << endl;
+        exit(1);
+    }
+
+    kmeans_context_t *context = opts->context;
+    long *seen = context_array<long>(context, CONTEXT_MINIBATCH, SLOT_MINIBATCH_SEEN, num_clusters);
+    int *batch_ids = context_array<int>(context, CONTEXT_MINIBATCH, SLOT_MINIBATCH_BATCH_IDS, batch_size);
+    real *shuffle_scratch = context_array<real>(context, CONTEXT_MINIBATCH, SLOT_MINIBATCH_SHUFFLE_SCRATCH, (long)chunk_points * dims);
+    int *shuffle_order = context_array<int>(context, CONTEXT_MINIBATCH, SLOT_MINIBATCH_SHUFFLE_ORDER, chunk_points);
+    memset(seen, 0, num_clusters * sizeof(long));
+
+    // binary files can be sampled at random; text can only be shuffled chunk by chunk
+    bool random_order = opts->batch_order == BATCH_ORDER_RANDOM;
+    chunk_prefetcher_t prefetcher;
+    start_prefetcher(context, &prefetcher, &stream, chunk_points, opts->epochs, random_order && stream.binary, opts->seed);
+
+    auto start = chrono::high_resolution_clock::now();
+
+    int batches = 0;
+    long points_processed = 0;
+    double smoothed_shift = -1.0;
+    bool done = false;
+    bool initialized = false;
+    int slot = 0;
+
+    k_means_srand(opts->seed);
+
+    while (!done) {
+        int chunk_count = acquire_chunk(&prefetcher, slot);
+        if (chunk_count < 0)
+            prefetch_failed(opts, &prefetcher);
+        if (chunk_count == 0)
+            break;
+        real *chunk = prefetcher.buffers[slot];
+
+        if (!initialized) {
+            k_means_init_centroids(context, chunk_count, dims, chunk, num_clusters, centroids, opts->seed, opts->init, num_workers);
+            initialized = true;
+        }
+
+        if (random_order && !stream.binary)
+            shuffle_rows(chunk_count, dims, chunk, shuffle_scratch, shuffle_order);
+
+        for (int first = 0; first < chunk_count && !done; first += batch_size) {
+            int batch_points = min(batch_size, chunk_count - first);
+            double shift = minibatch_step(num_clusters, dims, batch_points, &chunk[first * dims], batch_ids,
+                                          centroids, seen, num_workers);
+            batches++;
+            points_processed += batch_points;
+
+            // exponentially weighted, per centroid coordinate, so it is comparable to the threshold of the other backends
+            shift /= (double)num_clusters * dims;
+            smoothed_shift = smoothed_shift < 0.0 ? shift : 0.9 * smoothed_shift + 0.1 * shift;
+
+            done = batches >= max_batches || (batches > BATCHES_PER_CHUNK && sqrt(smoothed_shift) < threshold / dims);
+
+            if(debug){
+                cout << "*********** CENTROIDS " << batches << " ***********" << endl;
+                print_centroids(centroids, num_clusters, dims);
+            }
+        }
+
+        release_chunk(&prefetcher, slot);
+        slot = 1 - slot;
+    }
+
+    stop_prefetcher(&prefetcher);
+    close_point_stream(&stream);
+
+    auto end = chrono::high_resolution_clock::now();
+    double elapsed = chrono::duration<double, milli>(end - start).count();
+    *per_batch_time = batches > 0 ? elapsed / batches : 0.0;
+
+    if(timer_debug) {
+        printf("minibatch_batches: %d \n", batches);
+        printf("minibatch_elapsed_time: %f ms \n", elapsed);
+        printf("minibatch_throughput: %f points/s \n", points_processed / (elapsed / 1000.0));
+        printf("minibatch_inertia: %f \n", stream_assign_points(opts, centroids, false));
+    }
+
+    return batches;
+}
+
+double stream_assign_points(struct options_t *opts, real *centroids, bool print) {
+    int dims = opts->dims;
+    int num_clusters = opts->num_clusters;
+    int chunk_points = opts->batch_size * BATCHES_PER_CHUNK;
+
+    point_stream_t stream;
+    if (!open_point_stream(&stream, opts->in_file, dims)) {
+        cerr << "cannot open " << opts->in_file << endl;
+        exit(1);
+    }
+
+    kmeans_context_t *context = opts->context;
+    int *ids = context_array<int>(context, CONTEXT_MINIBATCH, SLOT_MINIBATCH_IDS, chunk_points);
+    real *distances = context_array<real>(context, CONTEXT_MINIBATCH, SLOT_MINIBATCH_DISTANCES, chunk_points);
+    double inertia = 0.0;
+
+    chunk_prefetcher_t prefetcher;
+    start_prefetcher(context, &prefetcher, &stream, chunk_points, 1, false, 0);
+
+    if (print)
+        printf("clusters:");
+
+    for (int slot = 0; ; slot = 1 - slot) {
+        int chunk_count = acquire_chunk(&prefetcher, slot);
+        if (chunk_count < 0)
+            prefetch_failed(opts, &prefetcher);
+        if (chunk_count == 0)
+            break;
+        real *chunk = prefetcher.buffers[slot];
+
+        parallel_for(opts->workers, chunk_count, [&](int begin, int end, int worker) {
+            for (int i = begin; i < end; i++)
+                ids[i] = nearest_centroid(num_clusters, dims, &chunk[i * dims], centroids, &distances[i]);
+        });
+        for (int i = 0; i < chunk_count; i++) {
+            inertia += distances[i];
+            if (print)
+                printf(" %d", ids[i]);
+        }
+
+        release_chunk(&prefetcher, slot);
+    }
+
+    stop_prefetcher(&prefetcher);
+    close_point_stream(&stream);
+
+    return inertia;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "argparse.h"
+#include "helpers.h"
+#include "seed.h"
+#include "point_stream.h"
+#include "kmeans_sequential.h"
+#include "parallel.h"
+
+#define BATCH_ORDER_SEQUENTIAL 0
+#define BATCH_ORDER_RANDOM 1
+
+// Mini-batch k-means (Sculley, 2010) over a point file that is never fully loaded. Chunks of
+// the file are read on a background thread while the previous chunk is being clustered; each
+// batch moves its points' centroids by a per-centroid learning rate of 1 / (points seen).
+// Stops after max_num_iter batches, opts->epochs passes over the file, or once the smoothed
+// per-batch centroid shift falls under the threshold. Returns the number of batches run.
+int kmeans_minibatch(struct options_t *opts, real *centroids, double *per_batch_time);
+
+// One more streaming pass that assigns every point to its nearest centroid. Returns the
+// inertia (sum of squared distances) and, if print is set, prints the ids like print_clusters.
+double stream_assign_points(struct options_t *opts, real *centroids, bool print);
@@ -0,0 +1,201 @@
+#include "kmeans_mpi.h"
+
+#ifdef KMEANS_USE_MPI
+
+using namespace std;
+
+extern bool debug;
+extern bool timer_debug;
+
+// Adds this shard's points into the per-cluster sums. Each worker owns a slice of the
+// dimensions and walks the points in order, so every sum is built in the same order as
+// update_centroids builds it and a single rank reproduces kmeans_sequential exactly.
+static void accumulate_shard(int num_clusters, int dims, int num_points, real *points, int *cluster_id_of_points,
+                             real *sums, int *counts, int num_workers) {
+    memset(sums, 0, num_clusters * dims * sizeof(real));
+    memset(counts, 0, num_clusters * sizeof(int));
+
+    parallel_for(num_workers, dims, [&](int begin, int end, int worker) {
+        for (int i = 0; i < num_points; i++) {
+            int cluster_id = cluster_id_of_points[i];
+            if (worker == 0)
+                counts[cluster_id]++;
+            for (int d = begin; d < end; d++)
+                sums[cluster_id * dims + d] += points[i * dims + d];
+        }
+    });
+}
+
+// the rank whose shard holds point index, for the split read_point_shard uses
+static int shard_owner(long index, long total_points, int num_ranks) {
+    int owner = 0;
+    while (owner + 1 < num_ranks && index >= total_points * (owner + 1) / num_ranks)
+        owner++;
+    return owner;
+}
+
+void mpi_init_centroids(int num_points, real *points, long first_point, long total_points, struct options_t *opts,
+                        real *centroids) {
+    int dims = opts->dims;
+    int num_clusters = opts->num_clusters;
+    int rank, num_ranks;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_ranks);
+
+    if (opts->init == INIT_RANDOM) {
+        k_means_srand(opts->seed);
+        for (int c = 0; c < num_clusters; c++) {
+            long index = k_means_rand() % (int)total_points;
+            int owner = shard_owner(index, total_points, num_ranks);
+            if (rank == owner)
+                memcpy(&centroids[(long)c * dims], &points[(index - first_point) * dims], dims * sizeof(real));
+            MPI_Bcast(&centroids[(long)c * dims], dims, MPI_FLOAT, owner, MPI_COMM_WORLD);
+        }
+        return;
+    }
+
+    kmeans_context_t *context = opts->context;
+    long stride = (total_points + MPI_SEED_SAMPLE - 1) / MPI_SEED_SAMPLE;
+    long first_sampled = (first_point + stride - 1) / stride * stride;
+    int local_count = 0;
+    real *local_sample = context_array<real>(context, CONTEXT_MPI, SLOT_MPI_LOCAL_SAMPLE, (size_t)min((long)num_points, (long)MPI_SEED_SAMPLE) * dims);
+    for (long index = first_sampled; index < first_point + num_points; index += stride)
+        memcpy(&local_sample[(long)local_count++ * dims], &points[(index - first_point) * dims], dims * sizeof(real));
+
+    int *sample_counts = context_array<int>(context, CONTEXT_MPI, SLOT_MPI_SAMPLE_COUNTS, num_ranks);
+    int *sample_offsets = context_array<int>(context, CONTEXT_MPI, SLOT_MPI_SAMPLE_OFFSETS, num_ranks);
+    int local_values = local_count * dims;
+    MPI_Gather(&local_values, 1, MPI_INT, sample_counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    real *sample = NULL;
+    int sample_points = 0;
+    if (rank == 0) {
+        for (int r = 0; r < num_ranks; r++) {
+            sample_offsets[r] = sample_points * dims;
+            sample_points += sample_counts[r] / dims;
+        }
+        sample = context_array<real>(context, CONTEXT_MPI, SLOT_MPI_SAMPLE, (size_t)sample_points * dims);
+    }
+    MPI_Gatherv(local_sample, local_values, MPI_FLOAT, sample, sample_counts, sample_offsets, MPI_FLOAT, 0, MPI_COMM_WORLD);
+
+    if (rank == 0)
+        k_means_init_centroids(context, sample_points, dims, sample, num_clusters, centroids, opts->seed, opts->init, opts->workers);
+    MPI_Bcast(centroids, num_clusters * dims, MPI_FLOAT, 0, MPI_COMM_WORLD);
+}
+
+int kmeans_mpi(int num_points, real *points, struct options_t *opts, int *cluster_id_of_points, real *centroids) {
+    int dims = opts->dims;
+    int num_clusters = opts->num_clusters;
+    int max_num_iters = opts->max_num_iter;
+    int num_workers = opts->workers;
+    real threshold = opts->threshold;
+    bool use_alternate_convergence = opts->avoid_floating_point_convergence;
+    bool use_gemm = use_gemm_assignment(dims, num_clusters);
+    real *point_norms = NULL;
+    real *gemm_workspace = NULL;
+    long workspace_size = gemm_workspace_size(num_clusters, dims);
+
+    kmeans_context_t *context = opts->context;
+    int *old_cluster_id_of_points = context_array<int>(context, CONTEXT_MPI, SLOT_MPI_OLD_IDS, num_points);
+    real *old_centroids = context_array<real>(context, CONTEXT_MPI, SLOT_MPI_OLD_CENTROIDS, num_clusters * dims);
+    real *sums = context_array<real>(context, CONTEXT_MPI, SLOT_MPI_SUMS, num_clusters * dims);
+    int *counts = context_array<int>(context, CONTEXT_MPI, SLOT_MPI_COUNTS, num_clusters);
+    // sums, then counts, then the number of changed assignments: one reduction per iteration
+    int reduce_length = num_clusters * dims + num_clusters + 1;
+    double *reduce_buffer = context_array<double>(context, CONTEXT_MPI, SLOT_MPI_REDUCE, reduce_length);
+    double *changed_total = &reduce_buffer[reduce_length - 1];
+
+    if(use_gemm) {
+        point_norms = context_array<real>(context, CONTEXT_MPI, SLOT_MPI_POINT_NORMS, num_points);
+        gemm_workspace = context_array<real>(context, CONTEXT_MPI, SLOT_MPI_GEMM_WORKSPACE, num_workers * workspace_size);
+        compute_squared_norms(num_points, dims, points, point_norms);
+    }
+
+    // nothing is assigned yet, so the first iteration always counts as a change
+    for (int i = 0; i < num_points; i++)
+        cluster_id_of_points[i] = -1;
+
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    if(debug && rank == 0){
+        cout << "dims = " << dims << endl;
+        cout << "num_clusters = " << num_clusters << endl;
+        cout << "max_num_iters = " << max_num_iters << endl;
+        cout << "threshold = " << threshold << endl;
+        cout << "num_points (rank 0) = " << num_points << endl;
+
+        cout << "*********** INITIAL CENTROIDS ***********" << endl;
+        print_centroids(centroids, num_clusters, dims);
+    }
+
+    double reduce_time = 0;
+    bool done = false;
+    int iterations = 0;
+
+    while(!done) {
+        memcpy(old_cluster_id_of_points, cluster_id_of_points, num_points * sizeof(int));
+        memcpy(old_centroids, centroids, num_clusters * dims * sizeof(real));
+
+        parallel_for(num_workers, num_points, [&](int begin, int end, int worker) {
+            if(use_gemm)
+                assign_points_to_clusters_gemm(num_clusters, dims, end - begin, &points[begin * dims], &point_norms[begin],
+                                               &cluster_id_of_points[begin], centroids, &gemm_workspace[worker * workspace_size]);
+            else
+                assign_points_to_clusters(num_clusters, dims, end - begin, &points[begin * dims],
+                                          &cluster_id_of_points[begin], centroids);
+        });
+
+        accumulate_shard(num_clusters, dims, num_points, points, cluster_id_of_points, sums, counts, num_workers);
+
+        int changed = 0;
+        for (int i = 0; i < num_points; i++)
+            if (old_cluster_id_of_points[i] != cluster_id_of_points[i])
+                changed++;
+
+        // doubles hold every float sum and int count exactly, so one buffer carries all three
+        for (int j = 0; j < num_clusters * dims; j++)
+            reduce_buffer[j] = sums[j];
+        for (int c = 0; c < num_clusters; c++)
+            reduce_buffer[num_clusters * dims + c] = counts[c];
+        *changed_total = changed;
+
+        double reduce_start = MPI_Wtime();
+        MPI_Allreduce(MPI_IN_PLACE, reduce_buffer, reduce_length, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        reduce_time += MPI_Wtime() - reduce_start;
+
+        // same arithmetic as update_centroids: float sum divided by the cluster size
+        for (int c = 0; c < num_clusters; c++) {
+            long cluster_size = (long)reduce_buffer[num_clusters * dims + c];
+            for (int d = 0; d < dims; d++) {
+                real sum = (real)reduce_buffer[c * dims + d];
+                centroids[c * dims + d] = cluster_size > 0 ? sum / cluster_size : sum;
+            }
+        }
+
+        iterations++;
+        bool is_converged;
+
+        if (use_alternate_convergence)
+            is_converged = *changed_total == 0;
+        else
+            is_converged = converged(num_clusters, dims, threshold, old_centroids, centroids);
+
+        done = iterations > max_num_iters || is_converged;
+
+        if(timer_debug && rank == 0)
+            printf("mpi_iteration: %d points_changed: %ld \n", iterations, (long)*changed_total);
+
+        if(debug && rank == 0){
+            cout << "*********** CENTROIDS " << iterations << " ***********" << endl;
+            print_centroids(centroids, num_clusters, dims);
+        }
+    }
+
+    if(timer_debug && rank == 0)
+        printf("mpi_allreduce_time: %f ms \n", reduce_time * 1000);
+
+    return iterations;
+}
+
+#endif
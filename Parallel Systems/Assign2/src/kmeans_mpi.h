@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+
+#include "argparse.h"
+#include "helpers.h"
+#include "kmeans_sequential.h"
+#include "parallel.h"
+#include "seed.h"
+
+#ifdef KMEANS_USE_MPI
+#include <mpi.h>
+
+// most points rank 0 gathers to run k-means++ or k-means|| on
+#define MPI_SEED_SAMPLE (1 << 18)
+
+// Seeds every rank with the same centroids from the shards alone; this rank holds num_points
+// points starting at first_point of total_points. --init random draws the indices
+// k_means_init_random_centroids would and each row is broadcast by the rank holding it.
+// k-means++ and k-means|| run on rank 0 over every stride-th point of the input, gathered so
+// that there are at most MPI_SEED_SAMPLE; below that it is the whole input in order, and the
+// centroids are the single-process ones.
+void mpi_init_centroids(int num_points, real *points, long first_point, long total_points, struct options_t *opts,
+                        real *centroids);
+
+// Runs Lloyd's iterations on this rank's shard of the points. Every rank must enter with the
+// same centroids; each iteration combines the per-cluster sums, counts and the number of
+// changed assignments of all ranks with one MPI_Allreduce, so every rank leaves with the same
+// centroids and its own shard's cluster ids. One rank reproduces kmeans_sequential exactly.
+// With more, each shard's float sums are rounded separately before they are combined, so the
+// centroids can differ from the single-pass sums in the last bits and later iterations can
+// diverge from kmeans_sequential.
+int kmeans_mpi(int num_points, real *points, struct options_t *opts, int* cluster_id_of_points, real* centroids);
+#endif
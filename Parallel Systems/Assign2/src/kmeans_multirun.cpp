@@ -0,0 +1,252 @@
+#include "kmeans_multirun.h"
+
+#include <chrono>
+#include <vector>
+
+using namespace std;
+
+extern bool debug;
+extern bool timer_debug;
+
+// points loaded together; every active run scans them before the next block, so they stay in L1
+#define MULTIRUN_BLOCK_POINTS 64
+
+struct run_state_t {
+    int num_clusters;
+    int seed;
+    int iterations;
+    bool done;
+    double inertia;
+    real *centroids;
+    real *old_centroids;
+    int *cluster_id_of_points;
+    real *sums;     // one num_clusters x dims block per worker
+    int *counts;    // one num_clusters block per worker
+    int *changed;   // per worker
+};
+
+static vector<int> parse_cluster_counts(struct options_t *opts) {
+    vector<int> cluster_counts;
+    if (!opts->cluster_counts) {
+        cluster_counts.push_back(opts->num_clusters);
+        return cluster_counts;
+    }
+    char *list = strdup(opts->cluster_counts);
+    for (char *token = strtok(list, ","); token; token = strtok(NULL, ","))
+        cluster_counts.push_back(atoi(token));
+    free(list);
+    return cluster_counts;
+}
+
+int multirun_max_clusters(struct options_t *opts) {
+    int max_clusters = 0;
+    for (int k : parse_cluster_counts(opts))
+        max_clusters = max(max_clusters, k);
+    return max_clusters;
+}
+
+// Assigns points [begin, end) for every active run, a block at a time, and adds each point
+// to the run's per-worker sums in point order.
+static void assign_block_range(int dims, int begin, int end, real *points, vector<run_state_t *> &active, int worker) {
+    for (run_state_t *run : active) {
+        memset(&run->sums[worker * run->num_clusters * dims], 0, run->num_clusters * dims * sizeof(real));
+        memset(&run->counts[worker * run->num_clusters], 0, run->num_clusters * sizeof(int));
+        run->changed[worker] = 0;
+    }
+
+    for (int block = begin; block < end; block += MULTIRUN_BLOCK_POINTS) {
+        int block_end = min(end, block + MULTIRUN_BLOCK_POINTS);
+        for (run_state_t *run : active) {
+            int num_clusters = run->num_clusters;
+            real *sums = &run->sums[worker * num_clusters * dims];
+            int *counts = &run->counts[worker * num_clusters];
+            for (int i = block; i < block_end; i++) {
+                real *point = &points[(long)i * dims];
+                int best_centroid = -1;
+                real best_distance = DBL_MAX;
+                for (int c = 0; c < num_clusters; c++) {
+                    real distance = squared_distance(point, &run->centroids[c * dims], dims);
+                    if (distance < best_distance) {
+                        best_distance = distance;
+                        best_centroid = c;
+                    }
+                }
+                if (run->cluster_id_of_points[i] != best_centroid)
+                    run->changed[worker]++;
+                run->cluster_id_of_points[i] = best_centroid;
+                counts[best_centroid]++;
+                for (int d = 0; d < dims; d++)
+                    sums[best_centroid * dims + d] += point[d];
+            }
+        }
+    }
+}
+
+// Final pass: inertia of every run against its final centroids, sharing the point loads the same way.
+static void compute_inertia(int num_points, int dims, real *points, vector<run_state_t> &runs, int num_workers,
+                            double *partial) {
+    int num_runs = runs.size();
+    memset(partial, 0, num_workers * num_runs * sizeof(double));
+
+    parallel_for(num_workers, num_points, [&](int begin, int end, int worker) {
+        for (int block = begin; block < end; block += MULTIRUN_BLOCK_POINTS) {
+            int block_end = min(end, block + MULTIRUN_BLOCK_POINTS);
+            for (int r = 0; r < num_runs; r++) {
+                double inertia = 0;
+                for (int i = block; i < block_end; i++) {
+                    real best_distance = DBL_MAX;
+                    for (int c = 0; c < runs[r].num_clusters; c++)
+                        best_distance = min(best_distance, squared_distance(&points[(long)i * dims], &runs[r].centroids[c * dims], dims));
+                    inertia += best_distance;
+                }
+                partial[worker * num_runs + r] += inertia;
+            }
+        }
+    });
+
+    for (int r = 0; r < num_runs; r++) {
+        runs[r].inertia = 0;
+        for (int w = 0; w < num_workers; w++)
+            runs[r].inertia += partial[w * num_runs + r];
+    }
+}
+
+int kmeans_multirun(int num_points, real *points, struct options_t *opts, int *cluster_id_of_points, real *centroids) {
+    int dims = opts->dims;
+    int max_num_iters = opts->max_num_iter;
+    int num_workers = opts->workers;
+    real threshold = opts->threshold;
+    bool use_alternate_convergence = opts->avoid_floating_point_convergence;
+    vector<int> cluster_counts = parse_cluster_counts(opts);
+    int restarts = max(1, opts->restarts);
+
+    // every run's buffers are slices of one workspace per kind
+    int num_runs = cluster_counts.size() * restarts;
+    long total_clusters = 0;
+    for (int k : cluster_counts)
+        total_clusters += (long)k * restarts;
+    kmeans_context_t *context = opts->context;
+    real *all_centroids = context_array<real>(context, CONTEXT_MULTIRUN, SLOT_MULTIRUN_CENTROIDS, total_clusters * dims);
+    real *all_old_centroids = context_array<real>(context, CONTEXT_MULTIRUN, SLOT_MULTIRUN_OLD_CENTROIDS, total_clusters * dims);
+    int *all_ids = context_array<int>(context, CONTEXT_MULTIRUN, SLOT_MULTIRUN_IDS, (long)num_runs * num_points);
+    real *all_sums = context_array<real>(context, CONTEXT_MULTIRUN, SLOT_MULTIRUN_SUMS, num_workers * total_clusters * dims);
+    int *all_counts = context_array<int>(context, CONTEXT_MULTIRUN, SLOT_MULTIRUN_COUNTS, num_workers * total_clusters);
+    int *all_changed = context_array<int>(context, CONTEXT_MULTIRUN, SLOT_MULTIRUN_CHANGED, num_workers * num_runs);
+    double *partial = context_array<double>(context, CONTEXT_MULTIRUN, SLOT_MULTIRUN_PARTIAL, num_workers * num_runs);
+
+    vector<run_state_t> runs;
+    long offset = 0;
+    for (int k : cluster_counts) {
+        for (int r = 0; r < restarts; r++) {
+            int index = runs.size();
+            run_state_t run;
+            run.num_clusters = k;
+            run.seed = opts->seed + r;
+            run.iterations = 0;
+            run.done = false;
+            run.inertia = 0;
+            run.centroids = &all_centroids[offset * dims];
+            run.old_centroids = &all_old_centroids[offset * dims];
+            run.cluster_id_of_points = &all_ids[(long)index * num_points];
+            run.sums = &all_sums[num_workers * offset * dims];
+            run.counts = &all_counts[num_workers * offset];
+            run.changed = &all_changed[num_workers * index];
+            offset += k;
+            for (int i = 0; i < num_points; i++)
+                run.cluster_id_of_points[i] = -1;
+            k_means_init_centroids(context, num_points, dims, points, k, run.centroids, run.seed, opts->init, num_workers);
+            runs.push_back(run);
+        }
+    }
+
+    if(debug){
+        cout << "dims = " << dims << endl;
+        cout << "runs = " << runs.size() << endl;
+        cout << "max_num_iters = " << max_num_iters << endl;
+        cout << "threshold = " << threshold << endl;
+        cout << "num_points = " << num_points << endl;
+    }
+
+    auto start = chrono::high_resolution_clock::now();
+    long points_streamed = 0;
+    int passes = 0;
+    vector<run_state_t *> active;
+
+    while (true) {
+        active.clear();
+        for (run_state_t &run : runs)
+            if (!run.done)
+                active.push_back(&run);
+        if (active.empty())
+            break;
+
+        for (run_state_t *run : active)
+            memcpy(run->old_centroids, run->centroids, run->num_clusters * dims * sizeof(real));
+
+        parallel_for(num_workers, num_points, [&](int begin, int end, int worker) {
+            assign_block_range(dims, begin, end, points, active, worker);
+        });
+        passes++;
+        points_streamed += (long)num_points * active.size();
+
+        for (run_state_t *run : active) {
+            int num_clusters = run->num_clusters;
+            int changed = 0;
+            // worker partial sums are added in worker order, after the first one, like update_centroids
+            memcpy(run->centroids, run->sums, num_clusters * dims * sizeof(real));
+            for (int w = 1; w < num_workers; w++) {
+                for (int j = 0; j < num_clusters * dims; j++)
+                    run->centroids[j] += run->sums[w * num_clusters * dims + j];
+                for (int c = 0; c < num_clusters; c++)
+                    run->counts[c] += run->counts[w * num_clusters + c];
+            }
+            for (int w = 0; w < num_workers; w++)
+                changed += run->changed[w];
+
+            for (int c = 0; c < num_clusters; c++)
+                if (run->counts[c] > 0)
+                    for (int d = 0; d < dims; d++)
+                        run->centroids[c * dims + d] /= run->counts[c];
+
+            run->iterations++;
+            bool is_converged;
+            if (use_alternate_convergence)
+                is_converged = changed == 0;
+            else
+                is_converged = converged(num_clusters, dims, threshold, run->old_centroids, run->centroids);
+            run->done = run->iterations > max_num_iters || is_converged;
+        }
+
+        if(timer_debug)
+            printf("multirun_pass: %d active_runs: %d \n", passes, (int)active.size());
+    }
+
+    double elapsed = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+
+    compute_inertia(num_points, dims, points, runs, num_workers, partial);
+
+    int best = 0;
+    for (int r = 0; r < (int)runs.size(); r++) {
+        if (runs[r].inertia < runs[best].inertia)
+            best = r;
+        if(timer_debug)
+            printf("multirun_run: %d k: %d seed: %d iterations: %d inertia: %f \n",
+                   r, runs[r].num_clusters, runs[r].seed, runs[r].iterations, runs[r].inertia);
+    }
+
+    if(timer_debug) {
+        printf("multirun_best: %d k: %d seed: %d inertia: %f \n", best, runs[best].num_clusters, runs[best].seed, runs[best].inertia);
+        printf("multirun_passes: %d \n", passes);
+        printf("multirun_points_streamed: %ld \n", points_streamed);
+        printf("multirun_elapsed_time: %f ms \n", elapsed);
+        printf("multirun_throughput: %f points/s \n", points_streamed / (elapsed / 1000));
+    }
+
+    opts->num_clusters = runs[best].num_clusters;
+    opts->seed = runs[best].seed;
+    memcpy(centroids, runs[best].centroids, runs[best].num_clusters * dims * sizeof(real));
+    memcpy(cluster_id_of_points, runs[best].cluster_id_of_points, num_points * sizeof(int));
+    int iterations = runs[best].iterations;
+
+    return iterations;
+}
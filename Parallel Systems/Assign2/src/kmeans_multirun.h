@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+
+#include "argparse.h"
+#include "helpers.h"
+#include "seed.h"
+#include "kmeans_sequential.h"
+#include "parallel.h"
+
+// Largest k in opts->cluster_counts (or -k when no list is given): the size callers need
+// for the centroid buffer passed to kmeans_multirun.
+int multirun_max_clusters(struct options_t *opts);
+
+// Runs --restarts seeds (seed, seed+1, ...) for every k in --ks (default -k) in lock-step:
+// each block of points is loaded once per iteration and assigned for every run that has not
+// converged yet, each run keeping its own sums, ids and convergence test. With one worker a
+// run reproduces kmeans_sequential with the same k and seed (below the gemm sizes).
+// The run with the lowest inertia is returned: its ids and centroids are copied out,
+// opts->num_clusters and opts->seed are set to its k and seed, and its iterations returned.
+int kmeans_multirun(int num_points, real *points, struct options_t *opts, int* cluster_id_of_points, real* centroids);
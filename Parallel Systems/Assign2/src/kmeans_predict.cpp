@@ -0,0 +1,99 @@
+#include "kmeans_predict.h"
+#include "io.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+using namespace std;
+
+extern bool debug;
+extern bool timer_debug;
+
+void predict_clusters(struct kmeans_context_t *context, int num_clusters, int dims, int num_points, real *points, real *centroids,
+                      int *cluster_id_of_points, int num_workers) {
+    if (use_gemm_assignment(dims, num_clusters)) {
+        long workspace_size = gemm_workspace_size(num_clusters, dims);
+        real *point_norms = context_array<real>(context, CONTEXT_PREDICT, SLOT_PREDICT_POINT_NORMS, num_points);
+        real *gemm_workspace = context_array<real>(context, CONTEXT_PREDICT, SLOT_PREDICT_GEMM_WORKSPACE, num_workers * workspace_size);
+        parallel_for(num_workers, num_points, [&](int begin, int end, int worker) {
+            real *first = &points[(long)begin * dims];
+            compute_squared_norms(end - begin, dims, first, &point_norms[begin]);
+            assign_points_to_clusters_gemm(num_clusters, dims, end - begin, first, &point_norms[begin],
+                                           &cluster_id_of_points[begin], centroids, &gemm_workspace[worker * workspace_size]);
+        });
+        return;
+    }
+
+    // the blocked kernel, one block at a time: each worker transposes POINT_BLOCK rows into its
+    // own scratch block and assigns them while they are still in cache
+    long block_size = point_blocks_size(POINT_BLOCK, dims);
+    real *scratch = context_array<real>(context, CONTEXT_PREDICT, SLOT_PREDICT_BLOCKS, num_workers * block_size);
+    int num_blocks = (num_points + POINT_BLOCK - 1) / POINT_BLOCK;
+    parallel_for(num_workers, num_blocks, [&](int begin, int end, int worker) {
+        point_blocks_t block;
+        for (int b = begin; b < end; b++) {
+            int first = b * POINT_BLOCK;
+            block_points(min(POINT_BLOCK, num_points - first), dims, &points[(long)first * dims], &scratch[worker * block_size], 1, &block);
+            assign_points_to_clusters_blocked(num_clusters, dims, &block, &cluster_id_of_points[first], centroids);
+        }
+    });
+}
+
+int kmeans_predict(struct options_t *opts, int **cluster_id_of_points, double *per_batch_time) {
+    int num_clusters, dims;
+    real *centroids;
+    if (!load_model(opts->predict_model, &num_clusters, &dims, &centroids)) {
+        cerr << "cannot read model " << opts->predict_model << endl;
+        return -1;
+    }
+    // the model decides the shape; -k and -d are not needed
+    opts->num_clusters = num_clusters;
+    opts->dims = dims;
+
+    int num_points;
+    real *points;
+    auto io_start = chrono::high_resolution_clock::now();
+    read_file(opts, &num_points, &points);
+    auto io_time = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - io_start);
+
+    *cluster_id_of_points = context_array<int>(opts->context, CONTEXT_RESULT, SLOT_RESULT_IDS, num_points);
+
+    int batch_size = max(1, opts->batch_size);
+    int num_batches = (num_points + batch_size - 1) / batch_size;
+    vector<double> batch_latency(num_batches);
+
+    if(debug){
+        cout << "dims = " << dims << endl;
+        cout << "num_clusters = " << num_clusters << endl;
+        cout << "num_points = " << num_points << endl;
+        cout << "batch_size = " << batch_size << endl;
+    }
+
+    auto start = chrono::high_resolution_clock::now();
+    for (int b = 0; b < num_batches; b++) {
+        auto batch_start = chrono::high_resolution_clock::now();
+        int first = b * batch_size;
+        int count = min(batch_size, num_points - first);
+        predict_clusters(opts->context, num_clusters, dims, count, &points[(long)first * dims], centroids,
+                         &(*cluster_id_of_points)[first], opts->workers);
+        batch_latency[b] = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - batch_start).count();
+    }
+    double elapsed = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+
+    *per_batch_time = num_batches > 0 ? elapsed / num_batches : 0;
+
+    if(timer_debug && num_batches > 0) {
+        sort(batch_latency.begin(), batch_latency.end());
+        printf("predict_batches: %d \n", num_batches);
+        printf("predict_elapsed_time: %f ms \n", elapsed);
+        printf("predict_throughput: %f points/s \n", num_points / (elapsed / 1000));
+        printf("predict_p50_latency: %f ms \n", batch_latency[(num_batches - 1) * 50 / 100]);
+        printf("predict_p99_latency: %f ms \n", batch_latency[(num_batches - 1) * 99 / 100]);
+        printf("ingest_time: %f ms \n", io_time.count());
+    }
+
+    free_points(points);
+    free(centroids);
+    return num_points;
+}
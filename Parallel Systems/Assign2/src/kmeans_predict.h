@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+
+#include "argparse.h"
+#include "helpers.h"
+#include "kmeans_sequential.h"
+#include "parallel.h"
+#include "kmeans_context.h"
+#include "point_blocks.h"
+
+// Nearest-centroid assignment with gemm for large dims and k and the blocked kernel
+// otherwise, split across num_workers threads. Both give the ids training would have given.
+void predict_clusters(struct kmeans_context_t *context, int num_clusters, int dims, int num_points, real *points, real *centroids,
+                      int *cluster_id_of_points, int num_workers);
+
+// Loads the model in opts->predict_model and assigns every point of opts->in_file to it,
+// opts->batch_size points at a time. Points cluster_id_of_points at the ids (held in
+// opts->context, one per point) and returns the number of points, or -1 if the model or input can't be read.
+int kmeans_predict(struct options_t *opts, int **cluster_id_of_points, double *per_batch_time);
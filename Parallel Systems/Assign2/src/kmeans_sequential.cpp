@@ -1,34 +1,17 @@
 #include "kmeans_sequential.h"
+#include "kmeans_metric.h"
+#include "cache_tiling.h"
+#include "cache_counters.h"
 
 using namespace std;
 
 extern bool debug;
+extern bool timer_debug;
 
-void assign_points_to_clusters(int num_clusters, int dims, int num_points, real* points, int* cluster_id_of_points, real *centroids){
-    for (int i = 0; i < num_points; i++) {
-        int best_centroid = -1;
-        real best_distance = DBL_MAX;
-
-        for (int c = 0; c < num_clusters; c++) {
-            real distance = 0.0;
-
-            for (int d = 0; d < dims; d++) {
-                real diff = points[i * dims + d] - centroids[c * dims + d];
-                distance += diff * diff;
-            }
-            if (distance < best_distance) {
-                best_distance = distance;
-                best_centroid = c;
-            }
-        }
-        cluster_id_of_points[i] = best_centroid;
-    }
-}
-
-void update_centroids(int num_clusters, int dims, int num_points, real* points, int* cluster_id_of_points, real *centroids){
+void update_centroids(int num_clusters, int dims, int num_points, real* points, int* cluster_id_of_points, real *centroids,
+                      int *cluster_sizes){
     memset(centroids, 0, num_clusters * dims * sizeof(real));
-
-    int *cluster_sizes = (int*)calloc(num_clusters, sizeof(int));
+    memset(cluster_sizes, 0, num_clusters * sizeof(int));
 
     for (int i = 0; i < num_points; i++) {
         int cluster_id = cluster_id_of_points[i];
@@ -46,7 +29,55 @@ void update_centroids(int num_clusters, int dims, int num_points, real* points,
             }
         }
     }
-    free(cluster_sizes);
+}
+
+void centroids_from_sums(int num_clusters, int dims, double *sums, int *counts, bool *touched, real *centroids) {
+    for (int c = 0; c < num_clusters; c++) {
+        if (touched && !touched[c])
+            continue;
+        // like update_centroids, an empty cluster keeps the zero sum
+        for (int d = 0; d < dims; d++)
+            centroids[c * dims + d] = counts[c] > 0 ? sums[c * dims + d] / counts[c] : 0.0;
+    }
+}
+
+void recompute_centroid_sums(int num_clusters, int dims, int num_points, real* points, int* cluster_id_of_points,
+                             double *sums, int *counts, real *centroids) {
+    memset(sums, 0, num_clusters * dims * sizeof(double));
+    memset(counts, 0, num_clusters * sizeof(int));
+
+    for (int i = 0; i < num_points; i++) {
+        int cluster_id = cluster_id_of_points[i];
+        counts[cluster_id]++;
+        for (int d = 0; d < dims; d++)
+            sums[cluster_id * dims + d] += points[i * dims + d];
+    }
+    centroids_from_sums(num_clusters, dims, sums, counts, NULL, centroids);
+}
+
+int update_centroids_delta(int num_clusters, int dims, int num_points, real* points, int* old_cluster_id_of_points,
+                           int* cluster_id_of_points, double *sums, int *counts, bool *touched, real *centroids) {
+    int moved = 0;
+    memset(touched, 0, num_clusters * sizeof(bool));
+
+    for (int i = 0; i < num_points; i++) {
+        int old_id = old_cluster_id_of_points[i];
+        int new_id = cluster_id_of_points[i];
+        if (old_id == new_id)
+            continue;
+
+        moved++;
+        counts[old_id]--;
+        counts[new_id]++;
+        touched[old_id] = true;
+        touched[new_id] = true;
+        for (int d = 0; d < dims; d++) {
+            sums[old_id * dims + d] -= points[i * dims + d];
+            sums[new_id * dims + d] += points[i * dims + d];
+        }
+    }
+    centroids_from_sums(num_clusters, dims, sums, counts, touched, centroids);
+    return moved;
 }
 
 bool converged(int num_clusters, int dims, real threshold, real *old_centroids, real *new_centroids) {
@@ -69,19 +100,103 @@ bool assignment_changed(int num_points, int dims, real threshold, int *old_clust
     return true;  // All centroids have converged
 }
 
-int kmeans_sequential(int num_points, real *points, struct options_t *opts, int *cluster_id_of_points, real *centroids){
+// Lloyd's iteration under Metric. Only euclidean_metric has the partial, blocked, tiled, gemm
+// and delta variants; argparse keeps the other metrics on the plain kernel.
+template <typename Metric>
+static int sequential_fit(int num_points, real *points, struct options_t *opts, int *cluster_id_of_points, real *centroids){
     int dims = opts->dims;
     int num_clusters = opts->num_clusters;
     int max_num_iters = opts->max_num_iter;
     real threshold = opts->threshold;
-    int *old_cluster_id_of_points;
-    real *old_centroids;
+    // only allocated for the modes that read them
+    int *old_cluster_id_of_points = NULL;
+    real *old_centroids = NULL;
     bool use_alternate_convergence = opts->avoid_floating_point_convergence;
+    // partial-distance search replaces the gemm path when asked for
+    bool use_partial = opts->partial_distance;
+    // so does the blocked layout, which context_fit has already built
+    bool use_blocked = !use_partial && opts->layout == LAYOUT_BLOCKED;
+    // and the cache-tiled direct kernel
+    bool use_tiled = !use_partial && opts->tiled;
+    bool use_gemm = Metric::id == METRIC_EUCLIDEAN && !use_partial && !use_blocked && !use_tiled &&
+                    use_gemm_assignment(dims, num_clusters);
+    cache_sizes_t caches;
+    assignment_tiles_t tiles;
+    real *tile_distances = NULL;
+    // -r counts the cache misses of the assignment, whichever kernel does it
+    cache_counters_t counters;
+    bool counting = timer_debug && open_cache_counters(&counters);
+    real *point_norms = NULL;
+    int *neighbours = NULL;
+    long total_dims_evaluated = 0;
+    // delta updates need the previous assignment, and the old centroids for the threshold check
+    int recompute_every = opts->delta_update;
+    bool use_delta = recompute_every > 0;
+    double *sums = NULL;
+    int *counts = NULL;
+    bool *touched = NULL;
+    real *gemm_workspace = NULL;
+    pair<real, int> *neighbour_scratch = NULL;
+    int *visited = NULL;
+    kmeans_context_t *context = opts->context;
+    int *cluster_sizes = context_array<int>(context, CONTEXT_SEQUENTIAL, SLOT_SEQUENTIAL_SIZES, num_clusters);
+    // telemetry counts the reassigned points against the previous assignment too, as do the
+    // -r lines of the other metrics
+    bool trace = telemetry_enabled(context);
+    phase_clock_t phases(trace);
+    bool report_metric = timer_debug && Metric::id != METRIC_EUCLIDEAN;
+    bool keep_old_ids = use_alternate_convergence || use_delta || trace || report_metric;
+    char backend[32] = "sequential";
+    if (Metric::id != METRIC_EUCLIDEAN)
+        snprintf(backend, sizeof(backend), "sequential_%s", metric_name(Metric::id));
+    metric_params_t params;
+    prepare_metric(num_points, points, opts, centroids, &params);
+    double *spherical_sums = NULL;
+    int *offsets = NULL, *next = NULL, *order = NULL;
+    real *values = NULL;
+    if (Metric::update == UPDATE_SPHERICAL)
+        spherical_sums = context_array<double>(context, CONTEXT_METRIC, SLOT_METRIC_SPHERICAL_SUMS, (size_t)num_clusters * dims);
+    if (Metric::update == UPDATE_MEDIAN) {
+        offsets = context_array<int>(context, CONTEXT_METRIC, SLOT_METRIC_MEDIAN_OFFSETS, num_clusters + 1);
+        next = context_array<int>(context, CONTEXT_METRIC, SLOT_METRIC_MEDIAN_NEXT, num_clusters);
+        order = context_array<int>(context, CONTEXT_METRIC, SLOT_METRIC_MEDIAN_ORDER, num_points);
+        values = context_array<real>(context, CONTEXT_METRIC, SLOT_METRIC_MEDIAN_VALUES, num_points);
+    }
+
+    if(use_gemm) {
+        point_norms = context_array<real>(context, CONTEXT_SEQUENTIAL, SLOT_SEQUENTIAL_POINT_NORMS, num_points);
+        gemm_workspace = context_array<real>(context, CONTEXT_SEQUENTIAL, SLOT_SEQUENTIAL_GEMM_WORKSPACE, gemm_workspace_size(num_clusters, dims));
+        compute_squared_norms(num_points, dims, points, point_norms);
+    }
+
+    if(use_tiled) {
+        detect_cache_sizes(&caches);
+        choose_assignment_tiles(num_clusters, dims, &caches, &tiles);
+        tile_distances = context_array<real>(context, CONTEXT_SEQUENTIAL, SLOT_SEQUENTIAL_TILE_DISTANCES, tiles.points);
+    }
+
+    if(use_partial || Metric::id != METRIC_EUCLIDEAN) {
+        // no previous assignment yet
+        for (int i = 0; i < num_points; i++)
+            cluster_id_of_points[i] = -1;
+    }
 
-    if(use_alternate_convergence)
-        old_cluster_id_of_points = (int *)malloc(num_points * sizeof(int));
-    else
-        old_centroids = (real *)malloc(num_clusters * dims * sizeof(real));
+    if(use_partial) {
+        neighbours = context_array<int>(context, CONTEXT_SEQUENTIAL, SLOT_SEQUENTIAL_NEIGHBOURS, num_clusters * PARTIAL_NEIGHBOURS);
+        neighbour_scratch = context_array<pair<real, int>>(context, CONTEXT_SEQUENTIAL, SLOT_SEQUENTIAL_NEIGHBOUR_SCRATCH, num_clusters);
+        visited = context_array<int>(context, CONTEXT_SEQUENTIAL, SLOT_SEQUENTIAL_VISITED, num_clusters);
+    }
+
+    if(use_delta) {
+        sums = context_array<double>(context, CONTEXT_SEQUENTIAL, SLOT_SEQUENTIAL_SUMS, num_clusters * dims);
+        counts = context_array<int>(context, CONTEXT_SEQUENTIAL, SLOT_SEQUENTIAL_COUNTS, num_clusters);
+        touched = context_array<bool>(context, CONTEXT_SEQUENTIAL, SLOT_SEQUENTIAL_TOUCHED, num_clusters);
+    }
+
+    if(keep_old_ids)
+        old_cluster_id_of_points = context_array<int>(context, CONTEXT_SEQUENTIAL, SLOT_SEQUENTIAL_OLD_IDS, num_points);
+    if(!use_alternate_convergence || use_delta)
+        old_centroids = context_array<real>(context, CONTEXT_SEQUENTIAL, SLOT_SEQUENTIAL_OLD_CENTROIDS, num_clusters * dims);
 
     if(debug){
         cout << "dims = " << dims << endl;
@@ -89,6 +204,8 @@ int kmeans_sequential(int num_points, real *points, struct options_t *opts, int
         cout << "max_num_iters = " << max_num_iters << endl;
         cout << "threshold = " << threshold << endl;
         cout << "num_points = " << num_points << endl;
+        if (Metric::id != METRIC_EUCLIDEAN)
+            cout << "metric = " << metric_name(Metric::id) << endl;
 
         cout << "*********** INITIAL CENTROIDS ***********" << endl;
         print_centroids(centroids, num_clusters, dims);
@@ -98,14 +215,62 @@ int kmeans_sequential(int num_points, real *points, struct options_t *opts, int
     int iterations = 0;
 
     while(!done) {
-        if(use_alternate_convergence)
+        phases.start();
+        if(keep_old_ids)
             memcpy(old_cluster_id_of_points, cluster_id_of_points, num_points * sizeof(int));
-        else
+        if(!use_alternate_convergence || use_delta)
             memcpy(old_centroids, centroids, num_clusters * dims * sizeof(real));
 
-        assign_points_to_clusters(num_clusters, dims, num_points, points, cluster_id_of_points, centroids);
+        long distances = (long)num_points * num_clusters;
+        if(counting)
+            start_cache_counters(&counters);
+        if(use_partial) {
+            compute_centroid_neighbours(num_clusters, dims, centroids, neighbours, neighbour_scratch);
+            long dims_evaluated = assign_points_to_clusters_partial(num_clusters, dims, num_points, points,
+                                                                    cluster_id_of_points, centroids, neighbours, visited);
+            total_dims_evaluated += dims_evaluated;
+            distances = dims_evaluated / dims;
+            if(timer_debug)
+                printf("partial_iteration: %d dims_evaluated_fraction: %f \n", iterations + 1,
+                       dims_evaluated / ((double)num_points * num_clusters * dims));
+        } else if(use_blocked)
+            assign_points_to_clusters_blocked(num_clusters, dims, &context->blocks, cluster_id_of_points, centroids);
+        else if(use_tiled)
+            assign_points_to_clusters_tiled(num_clusters, dims, num_points, points, cluster_id_of_points, centroids, &tiles,
+                                            tile_distances);
+        else if(use_gemm)
+            assign_points_to_clusters_gemm(num_clusters, dims, num_points, points, point_norms, cluster_id_of_points, centroids,
+                                           gemm_workspace);
+        else
+            assign_points_to_clusters<Metric>(num_clusters, dims, num_points, points, cluster_id_of_points, centroids, &params);
+
+        if(counting)
+            stop_cache_counters(&counters);
+        double assign_time = phases.lap();
 
-        update_centroids(num_clusters, dims, num_points, points, cluster_id_of_points, centroids);
+        // the objective against the centroids the points were just assigned to
+        double objective = 0.0;
+        if(report_metric)
+            objective = metric_objective<Metric>(context, num_points, dims, points, cluster_id_of_points, centroids, &params, 1);
+
+        if(Metric::update == UPDATE_SPHERICAL) {
+            update_centroids_spherical(num_clusters, dims, num_points, points, cluster_id_of_points, spherical_sums, centroids);
+        } else if(Metric::update == UPDATE_MEDIAN) {
+            update_centroids_median(num_clusters, dims, num_points, points, cluster_id_of_points, offsets, next, order, values,
+                                    centroids, 1);
+        } else if(!use_delta) {
+            update_centroids(num_clusters, dims, num_points, points, cluster_id_of_points, centroids, cluster_sizes);
+        } else if(iterations % recompute_every == 0) {
+            // periodic full rebuild bounds the drift the incremental sums pick up
+            recompute_centroid_sums(num_clusters, dims, num_points, points, cluster_id_of_points, sums, counts, centroids);
+        } else {
+            int moved = update_centroids_delta(num_clusters, dims, num_points, points, old_cluster_id_of_points,
+                                               cluster_id_of_points, sums, counts, touched, centroids);
+            if(timer_debug)
+                printf("delta_iteration: %d points_moved: %d \n", iterations + 1, moved);
+        }
+
+        double update_time = phases.lap();
 
         iterations++;
         bool is_converged;
@@ -117,17 +282,62 @@ int kmeans_sequential(int num_points, real *points, struct options_t *opts, int
 
         done = iterations > max_num_iters || is_converged;
 
+        if(trace || report_metric) {
+            double converge_time = phases.lap();
+            long reassigned = num_points;
+            if (iterations > 1) {
+                reassigned = 0;
+                for (int i = 0; i < num_points; i++)
+                    reassigned += old_cluster_id_of_points[i] != cluster_id_of_points[i];
+            }
+            if(trace) {
+                // the metric's own objective stands in for the inertia
+                iteration_telemetry_t stats = {iterations, assign_time, update_time, converge_time, reassigned, distances,
+                                               metric_objective<Metric>(context, num_points, dims, points, cluster_id_of_points,
+                                                                        centroids, &params, 1)};
+                write_iteration_telemetry(context->telemetry, backend, &stats);
+            }
+            if(report_metric)
+                printf("metric_iteration: %d objective: %f points_changed: %ld \n", iterations, objective, reassigned);
+        }
+
         if(debug){
             cout << "*********** CENTROIDS " << iterations << " ***********" << endl;
             print_centroids(centroids, num_clusters, dims);
         }
     }
 
-    if(use_alternate_convergence)
-        free(old_cluster_id_of_points);
-    else
-        free(old_centroids);
+    if(use_tiled && timer_debug) {
+        printf("cache_l1d: %ld cache_l2: %ld cache_llc: %ld \n", caches.l1d, caches.l2, caches.llc);
+        printf("assign_tile_points: %d assign_tile_centroids: %d \n", tiles.points, tiles.centroids);
+    }
+    if(timer_debug)
+        print_cache_misses(counting ? &counters : NULL);
+    if(counting)
+        close_cache_counters(&counters);
+
+    if(report_metric)
+        printf("metric: %s \n", metric_name(Metric::id));
+
+    if(use_partial && timer_debug) {
+        printf("partial_dims_evaluated: %ld \n", total_dims_evaluated);
+        printf("partial_dims_evaluated_fraction: %f \n", total_dims_evaluated / ((double)iterations * num_points * num_clusters * dims));
+    }
 
     return iterations;
 
 }
+
+int kmeans_sequential(int num_points, real *points, struct options_t *opts, int *cluster_id_of_points, real *centroids){
+    switch (opts->metric)
+    {
+        case METRIC_COSINE:
+            return sequential_fit<cosine_metric>(num_points, points, opts, cluster_id_of_points, centroids);
+        case METRIC_L1:
+            return sequential_fit<l1_metric>(num_points, points, opts, cluster_id_of_points, centroids);
+        case METRIC_MAHALANOBIS:
+            return sequential_fit<mahalanobis_metric>(num_points, points, opts, cluster_id_of_points, centroids);
+        default:
+            return sequential_fit<euclidean_metric>(num_points, points, opts, cluster_id_of_points, centroids);
+    }
+}
@@ -8,5 +8,55 @@
 #include "argparse.h"
 #include "seed.h"
 #include "helpers.h"
+#include "distance_metric.h"
+#include "distance_gemm.h"
+#include "partial_distance.h"
+#include "kmeans_context.h"
+
+// euclidean_metric's distance, kept under the name the euclidean-only backends use
+inline real squared_distance(const real *point, const real *centroid, int dims) {
+    return euclidean_metric::distance(point, 0, centroid, dims, NULL);
+}
+
+// Nearest centroid of each point under Metric, the first one on ties. params is only read by
+// the metrics that need it (mahalanobis).
+template <typename Metric = euclidean_metric>
+void assign_points_to_clusters(int num_clusters, int dims, int num_points, real* points, int* cluster_id_of_points, real *centroids,
+                               const metric_params_t *params = NULL) {
+    for (int i = 0; i < num_points; i++) {
+        const real *point = &points[(long)i * dims];
+        real term = Metric::point_term(point, dims);
+        int best_centroid = -1;
+        real best_distance = DBL_MAX;
+
+        for (int c = 0; c < num_clusters; c++) {
+            real distance = Metric::distance(point, term, &centroids[(long)c * dims], dims, params);
+            if (distance < best_distance) {
+                best_distance = distance;
+                best_centroid = c;
+            }
+        }
+        cluster_id_of_points[i] = best_centroid;
+    }
+}
+
+// cluster_sizes is num_clusters ints of scratch
+void update_centroids(int num_clusters, int dims, int num_points, real* points, int* cluster_id_of_points, real *centroids,
+                      int *cluster_sizes);
+
+// Rebuilds the persistent double sums and counts from every point, then the centroids from them.
+void recompute_centroid_sums(int num_clusters, int dims, int num_points, real* points, int* cluster_id_of_points,
+                             double *sums, int *counts, real *centroids);
+
+// Moves only the points whose assignment changed between the two id arrays from their old
+// cluster's sums to their new one, then refreshes the centroids of the clusters that were touched.
+// Returns the number of points moved.
+int update_centroids_delta(int num_clusters, int dims, int num_points, real* points, int* old_cluster_id_of_points,
+                           int* cluster_id_of_points, double *sums, int *counts, bool *touched, real *centroids);
+
+// centroids[c] = sums[c] / counts[c] for the selected clusters (all of them when touched is NULL)
+void centroids_from_sums(int num_clusters, int dims, double *sums, int *counts, bool *touched, real *centroids);
+
+bool converged(int num_clusters, int dims, real threshold, real *old_centroids, real *new_centroids);
 
 int kmeans_sequential(int num_points, real *points, struct options_t *opts, int* cluster_id_of_points, real* centroids);
\ No newline at end of file
@@ -0,0 +1,151 @@
+#include "kmeans_sparse.h"
+
+#include <algorithm>
+
+using namespace std;
+
+extern bool debug;
+extern bool timer_debug;
+
+void k_means_init_random_centroids_sparse(csr_points_t *csr, int num_clusters, real *centroids, int seed) {
+    int dims = csr->dims;
+    k_means_srand(seed);
+    memset(centroids, 0, (long)num_clusters * dims * sizeof(real));
+
+    for (int c = 0; c < num_clusters; c++) {
+        int index = k_means_rand() % csr->num_points;
+        for (long j = csr->row_start[index]; j < csr->row_start[index + 1]; j++)
+            centroids[(long)c * dims + csr->columns[j]] = csr->values[j];
+    }
+}
+
+// assigns points [begin, end), returns how many changed cluster
+static int assign_sparse_range(csr_points_t *csr, int num_clusters, int begin, int end, real *centroids_by_dim,
+                               double *centroid_norms, double *dots, int *cluster_id_of_points) {
+    int changed = 0;
+    for (int i = begin; i < end; i++) {
+        memset(dots, 0, num_clusters * sizeof(double));
+        for (long j = csr->row_start[i]; j < csr->row_start[i + 1]; j++) {
+            double value = csr->values[j];
+            real *column = &centroids_by_dim[(long)csr->columns[j] * num_clusters];
+            for (int c = 0; c < num_clusters; c++)
+                dots[c] += value * column[c];
+        }
+
+        int best_centroid = -1;
+        double best_distance = DBL_MAX;
+        for (int c = 0; c < num_clusters; c++) {
+            double distance = csr->norms[i] - 2 * dots[c] + centroid_norms[c];
+            if (distance < best_distance) {
+                best_distance = distance;
+                best_centroid = c;
+            }
+        }
+        if (cluster_id_of_points[i] != best_centroid)
+            changed++;
+        cluster_id_of_points[i] = best_centroid;
+    }
+    return changed;
+}
+
+int kmeans_sparse(csr_points_t *csr, struct options_t *opts, int *cluster_id_of_points, real *centroids) {
+    int num_points = csr->num_points;
+    int dims = csr->dims;
+    int num_clusters = opts->num_clusters;
+    int max_num_iters = opts->max_num_iter;
+    int num_workers = opts->workers;
+    real threshold = opts->threshold;
+    bool use_alternate_convergence = opts->avoid_floating_point_convergence;
+    long centroid_values = (long)num_clusters * dims;
+
+    kmeans_context_t *context = opts->context;
+    real *old_centroids = context_array<real>(context, CONTEXT_SPARSE, SLOT_SPARSE_OLD_CENTROIDS, centroid_values);
+    real *centroids_by_dim = context_array<real>(context, CONTEXT_SPARSE, SLOT_SPARSE_CENTROIDS_BY_DIM, centroid_values);
+    double *centroid_norms = context_array<double>(context, CONTEXT_SPARSE, SLOT_SPARSE_CENTROID_NORMS, num_clusters);
+    double *sums = context_array<double>(context, CONTEXT_SPARSE, SLOT_SPARSE_SUMS, centroid_values);
+    int *counts = context_array<int>(context, CONTEXT_SPARSE, SLOT_SPARSE_COUNTS, num_clusters);
+    double *dots = context_array<double>(context, CONTEXT_SPARSE, SLOT_SPARSE_DOTS, num_workers * num_clusters);
+    int *changed_by_worker = context_array<int>(context, CONTEXT_SPARSE, SLOT_SPARSE_CHANGED, num_workers);
+
+    for (int i = 0; i < num_points; i++)
+        cluster_id_of_points[i] = -1;
+
+    if(debug){
+        cout << "dims = " << dims << endl;
+        cout << "num_clusters = " << num_clusters << endl;
+        cout << "max_num_iters = " << max_num_iters << endl;
+        cout << "threshold = " << threshold << endl;
+        cout << "num_points = " << num_points << endl;
+        cout << "nnz = " << csr->nnz << endl;
+    }
+
+    bool done = false;
+    int iterations = 0;
+
+    while(!done) {
+        memcpy(old_centroids, centroids, centroid_values * sizeof(real));
+        fill(changed_by_worker, changed_by_worker + num_workers, 0);
+
+        // transposed copy so each non-zero reads its k centroid values contiguously
+        parallel_for(num_workers, num_clusters, [&](int begin, int end, int worker) {
+            for (int c = begin; c < end; c++) {
+                double norm = 0;
+                for (int d = 0; d < dims; d++) {
+                    real value = centroids[(long)c * dims + d];
+                    centroids_by_dim[(long)d * num_clusters + c] = value;
+                    norm += (double)value * value;
+                }
+                centroid_norms[c] = norm;
+            }
+        });
+
+        parallel_for(num_workers, num_points, [&](int begin, int end, int worker) {
+            changed_by_worker[worker] = assign_sparse_range(csr, num_clusters, begin, end, centroids_by_dim, centroid_norms,
+                                                            &dots[worker * num_clusters], cluster_id_of_points);
+        });
+
+        // each worker owns a range of clusters and scatters only their points, in point order
+        parallel_for(num_workers, num_clusters, [&](int begin, int end, int worker) {
+            memset(&sums[(long)begin * dims], 0, (long)(end - begin) * dims * sizeof(double));
+            memset(&counts[begin], 0, (end - begin) * sizeof(int));
+            for (int i = 0; i < num_points; i++) {
+                int cluster_id = cluster_id_of_points[i];
+                if (cluster_id < begin || cluster_id >= end)
+                    continue;
+                counts[cluster_id]++;
+                double *sum = &sums[(long)cluster_id * dims];
+                for (long j = csr->row_start[i]; j < csr->row_start[i + 1]; j++)
+                    sum[csr->columns[j]] += csr->values[j];
+            }
+            // like update_centroids, an empty cluster ends up at zero
+            for (long j = (long)begin * dims; j < (long)end * dims; j++) {
+                int size = counts[j / dims];
+                centroids[j] = size > 0 ? sums[j] / size : 0.0;
+            }
+        });
+
+        int changed = 0;
+        for (int w = 0; w < num_workers; w++)
+            changed += changed_by_worker[w];
+
+        iterations++;
+        bool is_converged;
+
+        if (use_alternate_convergence)
+            is_converged = changed == 0;
+        else
+            is_converged = converged(num_clusters, dims, threshold, old_centroids, centroids);
+
+        done = iterations > max_num_iters || is_converged;
+
+        if(timer_debug)
+            printf("sparse_iteration: %d points_changed: %d \n", iterations, changed);
+    }
+
+    if(timer_debug) {
+        printf("sparse_nnz: %ld \n", csr->nnz);
+        printf("sparse_density: %f \n", csr->nnz / ((double)num_points * dims));
+    }
+
+    return iterations;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+
+#include "argparse.h"
+#include "helpers.h"
+#include "seed.h"
+#include "kmeans_sequential.h"
+#include "parallel.h"
+#include "sparse_points.h"
+
+// the --init random pick of kmeans_sequential (same indices for the same seed), scattered into dense centroids
+void k_means_init_random_centroids_sparse(csr_points_t *csr, int num_clusters, real *centroids, int seed);
+
+// Lloyd's iterations on CSR points with dense centroids. Distances are ||x||^2 - 2 x.c + ||c||^2
+// with the dot products taken over the point's non-zeros against a transposed (dims x k) copy
+// of the centroids, and the update scatters each point's non-zeros into its cluster's sums.
+// -w workers split the points for assignment and the clusters for the update; the result
+// does not depend on the worker count. Per-iteration work is O(nnz * k + dims * k).
+int kmeans_sparse(csr_points_t *csr, struct options_t *opts, int* cluster_id_of_points, real* centroids);
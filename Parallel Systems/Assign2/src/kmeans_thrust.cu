@@ -5,6 +5,46 @@ using namespace std;
 extern bool debug;
 extern bool timer_debug;
 
+#if THRUST_DEVICE_SYSTEM == THRUST_DEVICE_SYSTEM_CUDA
+#include <cuda_runtime.h>
+#endif
+
+// Host clocks only mean something once the device has finished the queued work.
+static void synchronize_device() {
+#if THRUST_DEVICE_SYSTEM == THRUST_DEVICE_SYSTEM_CUDA
+    cudaDeviceSynchronize();
+#endif
+}
+
+static double elapsed_ms(chrono::high_resolution_clock::time_point since) {
+    synchronize_device();
+    return chrono::duration<double, milli>(chrono::high_resolution_clock::now() - since).count();
+}
+
+// atomicAdd only exists in CUDA device code; the host systems get the same effect from the
+// gcc __atomic builtins (a compare-and-swap loop for floats).
+__host__ __device__
+inline void atomic_add(real *address, real value) {
+#ifdef __CUDA_ARCH__
+    atomicAdd(address, value);
+#else
+    real expected;
+    __atomic_load(address, &expected, __ATOMIC_RELAXED);
+    real desired = expected + value;
+    while (!__atomic_compare_exchange(address, &expected, &desired, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        desired = expected + value;
+#endif
+}
+
+__host__ __device__
+inline void atomic_add(int *address, int value) {
+#ifdef __CUDA_ARCH__
+    atomicAdd(address, value);
+#else
+    __atomic_fetch_add(address, value, __ATOMIC_RELAXED);
+#endif
+}
+
 template <typename T>
 void print_thrust_real(thrust::device_vector<T> vec) {
     cout << "Size=" << vec.size() << endl;
@@ -15,21 +55,20 @@ void print_thrust_real(thrust::device_vector<T> vec) {
 }
 
 template <typename T>
-struct linear_index_to_row_index : public thrust::unary_function<T,T>
-{
+struct linear_index_to_row_index {
   T C; // number of columns
   
   __host__ __device__
   linear_index_to_row_index(T C) : C(C) {}
 
   __host__ __device__
-  T operator()(T i)
+  T operator()(T i) const
   {
     return i / C;
   }
 };
 
-struct euclidean_distance_functor : public thrust::unary_function< int, real > {
+struct euclidean_distance_functor {
     int num_clusters;
     int dims;
     real *d_centroids;
@@ -39,7 +78,7 @@ struct euclidean_distance_functor : public thrust::unary_function< int, real > {
         : num_clusters(_num_clusters), dims(_dims), d_centroids(_d_centroids), d_points(_d_points) {}
     
     __device__
-    real operator()(int idx) {
+    real operator()(int idx) const {
         int point_idx = (idx / dims) / num_clusters;
         int cluster_idx = (idx / dims) % num_clusters;
         int dim_idx = idx % dims;
@@ -48,7 +87,7 @@ struct euclidean_distance_functor : public thrust::unary_function< int, real > {
     }
 };
 
-struct assign_clusters : public thrust::unary_function< int, int > {
+struct assign_clusters {
     int num_clusters;
     real *d_point_to_centroid_distances;
 
@@ -56,7 +95,7 @@ struct assign_clusters : public thrust::unary_function< int, int > {
         : num_clusters(_num_clusters), d_point_to_centroid_distances(d_point_to_centroid_distances) {}
     
     __device__
-    real operator()(int idx) {
+    real operator()(int idx) const {
         real best_distance = INFINITY;
         int best_centroid = -1;
         for (int c=0; c<num_clusters; c++) {
@@ -70,7 +109,7 @@ struct assign_clusters : public thrust::unary_function< int, int > {
     }
 };
 
-struct compute_new_centroids : public thrust::unary_function<void, thrust::tuple<real, int>> {
+struct compute_new_centroids {
     int dims;
     int *d_cluster_id_of_points;
     real *centroids;
@@ -79,16 +118,16 @@ struct compute_new_centroids : public thrust::unary_function<void, thrust::tuple
         : dims(_dims), d_cluster_id_of_points(_d_point_cluster_ids), centroids(_centroids) {}
 
     __device__
-    void operator()(thrust::tuple<real, int> point_idx_tuple) {
+    void operator()(thrust::tuple<real, int> point_idx_tuple) const {
         real point_value = thrust::get<0>(point_idx_tuple);
         int idx = thrust::get<1>(point_idx_tuple);
         int assigned_centroid = d_cluster_id_of_points[idx / dims];
         int centroid_idx = assigned_centroid*dims + idx % dims;
-        atomicAdd(&centroids[centroid_idx], point_value);
+        atomic_add(&centroids[centroid_idx], point_value);
     }
 };
 
-struct compute_cluster_sizes : public thrust::unary_function<void, int> {
+struct compute_cluster_sizes {
     int num_points;
     int *d_cluster_sizes;
 
@@ -96,12 +135,12 @@ struct compute_cluster_sizes : public thrust::unary_function<void, int> {
         : num_points(_num_points), d_cluster_sizes(_d_cluster_sizes) {}
 
     __device__
-    void operator()(int value) {
-        atomicAdd(&d_cluster_sizes[value], 1);
+    void operator()(int value) const {
+        atomic_add(&d_cluster_sizes[value], 1);
     }
 };
 
-struct divide_centroids : public thrust::unary_function<real, thrust::tuple<int, int>> {
+struct divide_centroids {
     int dims;
     int *d_cluster_sizes;
 
@@ -109,7 +148,7 @@ struct divide_centroids : public thrust::unary_function<real, thrust::tuple<int,
         : dims(_dims), d_cluster_sizes(_d_cluster_sizes) {}
 
     __device__
-    real operator()(thrust::tuple<real, int> centroid_idx_tuple) {
+    real operator()(thrust::tuple<real, int> centroid_idx_tuple) const {
         real summed_centroid_value = thrust::get<0>(centroid_idx_tuple);
         int idx = thrust::get<1>(centroid_idx_tuple);
         int d_cluster_sizes_idx = idx / dims;
@@ -121,14 +160,14 @@ struct divide_centroids : public thrust::unary_function<real, thrust::tuple<int,
     }
 };
 
-struct converged : public thrust::unary_function<bool, thrust::tuple<real, real>>{
+struct converged {
     real threshold;
     int dims;
 
     converged(real _threshold, int _dims) : threshold(_threshold), dims(_dims) {}
 
     __device__
-    bool operator()(thrust::tuple<real, real> centroid_pair) {
+    bool operator()(thrust::tuple<real, real> centroid_pair) const {
         real new_centroid = thrust::get<0>(centroid_pair);
         real old_centroid = thrust::get<1>(centroid_pair);
         real diff = abs(new_centroid - old_centroid);
@@ -136,10 +175,10 @@ struct converged : public thrust::unary_function<bool, thrust::tuple<real, real>
     }
 };
 
-struct assignment_changed : public thrust::unary_function<bool, thrust::tuple<int, int>> {
+struct assignment_changed {
 
     __device__
-    bool operator()(thrust::tuple<int, int> cluster_id_pair) {
+    bool operator()(thrust::tuple<int, int> cluster_id_pair) const {
         real old_cluster_id = thrust::get<0>(cluster_id_pair);
         real new_cluster_id = thrust::get<1>(cluster_id_pair);
         real diff = (old_cluster_id - new_cluster_id);
@@ -158,16 +197,7 @@ int kmeans_thrust(int num_points, real *points, struct options_t *opts, int* clu
     bool use_alternate_convergence = opts->avoid_floating_point_convergence;
 
     //timers
-    cudaEvent_t start, stop, h2d_start, h2d_stop, d2h_start, d2h_stop;
-
-    cudaEventCreate(&start);
-    cudaEventCreate(&stop);
-    cudaEventCreate(&h2d_start);
-    cudaEventCreate(&h2d_stop);
-    cudaEventCreate(&d2h_start);
-    cudaEventCreate(&d2h_stop);
-
-    cudaEventRecord(start, 0);
+    auto start = chrono::high_resolution_clock::now();
 
     thrust::device_vector<int> d_cluster_id_of_points(num_points);
     thrust::device_vector<int> d_old_cluster_id_of_points(num_points);
@@ -177,7 +207,7 @@ int kmeans_thrust(int num_points, real *points, struct options_t *opts, int* clu
     thrust::device_vector<real> d_old_centroids(num_clusters * dims, 0.0f);
     thrust::device_vector<real> d_point_to_centroid_distances(num_points * num_clusters);
 
-    cudaEventRecord(h2d_start, 0);
+    auto h2d_start = chrono::high_resolution_clock::now();
 
     // Copy points from host to device
     thrust::copy(points, points + (num_points * dims), d_points.begin());
@@ -186,11 +216,7 @@ int kmeans_thrust(int num_points, real *points, struct options_t *opts, int* clu
     // Copy cluster IDs from host to device
     thrust::copy(cluster_id_of_points, cluster_id_of_points + num_points, d_cluster_id_of_points.begin());
 
-    cudaEventRecord(h2d_stop, 0);
-    cudaEventSynchronize(h2d_stop);
-
-    float h2d_elapsed_time = 0;
-    cudaEventElapsedTime(&h2d_elapsed_time, h2d_start, h2d_stop);
+    float h2d_elapsed_time = elapsed_ms(h2d_start);
 
     if(debug){
         cout << "dims = " << dims << endl;
@@ -214,8 +240,8 @@ int kmeans_thrust(int num_points, real *points, struct options_t *opts, int* clu
         euclidean_distance_functor euclidean_distance_functor(
             num_clusters, 
             dims, 
-            raw_pointer_cast(d_new_centroids.data()), 
-            raw_pointer_cast(d_points.data())
+            thrust::raw_pointer_cast(d_new_centroids.data()), 
+            thrust::raw_pointer_cast(d_points.data())
         );
 
         // Step 1: Compute distances between points and centroids
@@ -228,7 +254,7 @@ int kmeans_thrust(int num_points, real *points, struct options_t *opts, int* clu
         );
 
         // Step 2: Assign each point to the closest centroid
-        assign_clusters assign_clusters(num_clusters, raw_pointer_cast(d_point_to_centroid_distances.data()));
+        assign_clusters assign_clusters(num_clusters, thrust::raw_pointer_cast(d_point_to_centroid_distances.data()));
         
         thrust::transform (
             thrust::counting_iterator<int>(0),
@@ -242,8 +268,8 @@ int kmeans_thrust(int num_points, real *points, struct options_t *opts, int* clu
 
         compute_new_centroids compute_new_centroids(
             dims, 
-            raw_pointer_cast(d_cluster_id_of_points.data()), 
-            raw_pointer_cast(d_new_centroids.data())
+            thrust::raw_pointer_cast(d_cluster_id_of_points.data()), 
+            thrust::raw_pointer_cast(d_new_centroids.data())
         );
 
         thrust::for_each(
@@ -266,7 +292,7 @@ int kmeans_thrust(int num_points, real *points, struct options_t *opts, int* clu
         thrust::for_each(
             d_cluster_id_of_points.begin(),
             d_cluster_id_of_points.end(),
-            compute_cluster_sizes(num_clusters, raw_pointer_cast(d_cluster_sizes.data()))
+            compute_cluster_sizes(num_clusters, thrust::raw_pointer_cast(d_cluster_sizes.data()))
         );
 
         thrust::transform(
@@ -283,7 +309,7 @@ int kmeans_thrust(int num_points, real *points, struct options_t *opts, int* clu
                 )
             ),
             d_new_centroids.begin(),
-            divide_centroids(dims, raw_pointer_cast(d_cluster_sizes.data()))
+            divide_centroids(dims, thrust::raw_pointer_cast(d_cluster_sizes.data()))
         );
 
         bool is_converged;
@@ -315,22 +341,14 @@ int kmeans_thrust(int num_points, real *points, struct options_t *opts, int* clu
         done = (iterations > max_num_iters) || is_converged;
     }
 
-    cudaEventRecord(d2h_start, 0);
+    auto d2h_start = chrono::high_resolution_clock::now();
 
     thrust::copy(d_new_centroids.begin(), d_new_centroids.end(), centroids);
     thrust::copy(d_cluster_id_of_points.begin(), d_cluster_id_of_points.end(), cluster_id_of_points);
 
-    cudaEventRecord(d2h_stop, 0);
-    cudaEventSynchronize(d2h_stop);
-
-    float d2h_elapsed_time = 0;
-    cudaEventElapsedTime(&d2h_elapsed_time, d2h_start, d2h_stop);
-
-    cudaEventRecord(stop,0);
-    cudaEventSynchronize(stop);
+    float d2h_elapsed_time = elapsed_ms(d2h_start);
 
-    float elapsed_time = 0;
-    cudaEventElapsedTime(&elapsed_time, start, stop);
+    float elapsed_time = elapsed_ms(start);
 
     *per_iteration_time = elapsed_time/iterations;
 
@@ -1,9 +1,18 @@
 #pragma once
 
+// Builds for the CUDA device system with nvcc, or for the OpenMP/TBB device systems with a
+// plain host compiler (make thrust-omp / thrust-tbb), where the CUDA qualifiers mean nothing.
+#ifndef __CUDACC__
+#define __host__
+#define __device__
+#endif
+
 #include <thrust/functional.h>
 #include <thrust/host_vector.h>
 #include <thrust/device_vector.h>
 #include <thrust/transform.h>
+#include <thrust/fill.h>
+#include <thrust/for_each.h>
 #include <thrust/reduce.h>
 #include <thrust/sequence.h>
 #include <thrust/copy.h>
@@ -16,6 +25,7 @@
 #include <iostream>
 #include <cmath>
 #include <limits>
+#include <chrono>
 
 #include "argparse.h"
 #include "helpers.h"
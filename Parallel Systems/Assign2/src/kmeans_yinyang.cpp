@@ -0,0 +1,310 @@
+#include "kmeans_yinyang.h"
+
+using namespace std;
+
+extern bool debug;
+extern bool timer_debug;
+
+#define YINYANG_GROUPING_ITERS 5
+
+struct centroid_groups_t {
+    int num_groups;
+    int *group_of;        // group of each centroid
+    int *members;         // centroid ids sorted by group, then by id
+    int *group_start;     // members[group_start[g] .. group_start[g + 1]) belong to group g
+};
+
+// groups the initial centroids with a few lloyd iterations over the centroids themselves
+static void group_centroids(kmeans_context_t *context, int num_clusters, int dims, real *centroids, centroid_groups_t *groups) {
+    int num_groups = max(1, num_clusters / YINYANG_GROUP_SIZE);
+    double *group_centers = context_array<double>(context, CONTEXT_YINYANG, SLOT_YINYANG_GROUP_CENTERS, num_groups * dims);
+    int *group_sizes = context_array<int>(context, CONTEXT_YINYANG, SLOT_YINYANG_GROUP_SIZES, num_groups);
+
+    groups->num_groups = num_groups;
+    groups->group_of = context_array<int>(context, CONTEXT_YINYANG, SLOT_YINYANG_GROUP_OF, num_clusters);
+    groups->members = context_array<int>(context, CONTEXT_YINYANG, SLOT_YINYANG_MEMBERS, num_clusters);
+    groups->group_start = context_array<int>(context, CONTEXT_YINYANG, SLOT_YINYANG_GROUP_START, num_groups + 1);
+
+    for (int g = 0; g < num_groups; g++) {
+        int c = (int)((long)g * num_clusters / num_groups);
+        for (int d = 0; d < dims; d++)
+            group_centers[g * dims + d] = centroids[c * dims + d];
+    }
+
+    for (int iter = 0; iter < YINYANG_GROUPING_ITERS; iter++) {
+        for (int c = 0; c < num_clusters; c++) {
+            int best_group = 0;
+            double best_distance = DBL_MAX;
+            for (int g = 0; g < num_groups; g++) {
+                double distance = 0.0;
+                for (int d = 0; d < dims; d++) {
+                    double diff = centroids[c * dims + d] - group_centers[g * dims + d];
+                    distance += diff * diff;
+                }
+                if (distance < best_distance) {
+                    best_distance = distance;
+                    best_group = g;
+                }
+            }
+            groups->group_of[c] = best_group;
+        }
+
+        memset(group_sizes, 0, num_groups * sizeof(int));
+        memset(group_centers, 0, num_groups * dims * sizeof(double));
+        for (int c = 0; c < num_clusters; c++) {
+            int g = groups->group_of[c];
+            group_sizes[g]++;
+            for (int d = 0; d < dims; d++)
+                group_centers[g * dims + d] += centroids[c * dims + d];
+        }
+        for (int g = 0; g < num_groups; g++) {
+            if (group_sizes[g] > 0) {
+                for (int d = 0; d < dims; d++)
+                    group_centers[g * dims + d] /= group_sizes[g];
+            }
+        }
+    }
+
+    memset(groups->group_start, 0, (num_groups + 1) * sizeof(int));
+    for (int c = 0; c < num_clusters; c++)
+        groups->group_start[groups->group_of[c] + 1]++;
+    for (int g = 0; g < num_groups; g++)
+        groups->group_start[g + 1] += groups->group_start[g];
+    memset(group_sizes, 0, num_groups * sizeof(int));
+    for (int c = 0; c < num_clusters; c++) {
+        int g = groups->group_of[c];
+        groups->members[groups->group_start[g] + group_sizes[g]++] = c;
+    }
+}
+
+// first iteration: full scan, every group bound is the nearest non-assigned member
+static long initial_assignment(int num_clusters, int dims, int begin, int end, real *points, real *centroids, double slack,
+                               centroid_groups_t *groups, int *cluster_id_of_points, double *upper, double *lower, real *distances, int *changed) {
+    int num_groups = groups->num_groups;
+    for (int i = begin; i < end; i++) {
+        int best_centroid = -1;
+        real best_distance = DBL_MAX;
+        for (int c = 0; c < num_clusters; c++) {
+            distances[c] = squared_distance(&points[i * dims], &centroids[c * dims], dims);
+            if (distances[c] < best_distance) {
+                best_distance = distances[c];
+                best_centroid = c;
+            }
+        }
+
+        double *point_lower = &lower[(long)i * num_groups];
+        for (int g = 0; g < num_groups; g++)
+            point_lower[g] = DBL_MAX;
+        for (int c = 0; c < num_clusters; c++) {
+            if (c == best_centroid)
+                continue;
+            int g = groups->group_of[c];
+            point_lower[g] = min(point_lower[g], sqrt((double)distances[c]) * (1.0 - slack));
+        }
+
+        if (cluster_id_of_points[i] != best_centroid)
+            (*changed)++;
+        cluster_id_of_points[i] = best_centroid;
+        upper[i] = sqrt((double)best_distance) * (1.0 + slack);
+    }
+    return (long)(end - begin) * num_clusters;
+}
+
+static long yinyang_assignment(int dims, int begin, int end, real *points, real *centroids, double slack,
+                               centroid_groups_t *groups, double *drift, double *group_drift,
+                               int *cluster_id_of_points, double *upper, double *lower, int *changed) {
+    int num_groups = groups->num_groups;
+    long computed = 0;
+
+    for (int i = begin; i < end; i++) {
+        real *point = &points[i * dims];
+        double *point_lower = &lower[(long)i * num_groups];
+
+        double global_lower = DBL_MAX;
+        for (int g = 0; g < num_groups; g++)
+            global_lower = min(global_lower, point_lower[g]);
+
+        if (upper[i] < global_lower)
+            continue;
+
+        int old_centroid = cluster_id_of_points[i];
+        real old_distance = squared_distance(point, &centroids[old_centroid * dims], dims);
+        computed++;
+        upper[i] = sqrt((double)old_distance) * (1.0 + slack);
+        if (upper[i] < global_lower)
+            continue;
+
+        int best_centroid = old_centroid;
+        real best_distance = old_distance;
+        double best_upper = upper[i];
+
+        for (int g = 0; g < num_groups; g++) {
+            if (best_upper < point_lower[g])
+                continue;
+
+            // the group bound before this iteration's drift was applied
+            double previous_bound = point_lower[g] + group_drift[g];
+            double group_lower = DBL_MAX;
+
+            for (int m = groups->group_start[g]; m < groups->group_start[g + 1]; m++) {
+                int c = groups->members[m];
+                if (c == old_centroid || c == best_centroid)
+                    continue;
+
+                double local_bound = previous_bound - drift[c];
+                if (best_upper < local_bound) {
+                    group_lower = min(group_lower, local_bound);
+                    continue;
+                }
+
+                real distance = squared_distance(point, &centroids[c * dims], dims);
+                computed++;
+
+                // ties go to the lower index, matching the first-minimum rule of the exhaustive scan
+                if (distance < best_distance || (distance == best_distance && c < best_centroid)) {
+                    int demoted = best_centroid;
+                    double demoted_lower = sqrt((double)best_distance) * (1.0 - slack);
+                    if (demoted != old_centroid) {
+                        if (groups->group_of[demoted] == g)
+                            group_lower = min(group_lower, demoted_lower);
+                        else
+                            point_lower[groups->group_of[demoted]] = min(point_lower[groups->group_of[demoted]], demoted_lower);
+                    }
+                    best_distance = distance;
+                    best_centroid = c;
+                    best_upper = sqrt((double)distance) * (1.0 + slack);
+                } else {
+                    group_lower = min(group_lower, sqrt((double)distance) * (1.0 - slack));
+                }
+            }
+            point_lower[g] = group_lower;
+        }
+
+        if (best_centroid != old_centroid) {
+            int g = groups->group_of[old_centroid];
+            point_lower[g] = min(point_lower[g], sqrt((double)old_distance) * (1.0 - slack));
+            (*changed)++;
+        }
+        cluster_id_of_points[i] = best_centroid;
+        upper[i] = best_upper;
+    }
+    return computed;
+}
+
+int kmeans_yinyang(int num_points, real *points, struct options_t *opts, int *cluster_id_of_points, real *centroids) {
+    int dims = opts->dims;
+    int num_clusters = opts->num_clusters;
+    int max_num_iters = opts->max_num_iter;
+    int num_workers = opts->workers;
+    real threshold = opts->threshold;
+    bool use_alternate_convergence = opts->avoid_floating_point_convergence;
+    double slack = bound_slack(dims);
+
+    centroid_groups_t groups;
+    group_centroids(opts->context, num_clusters, dims, centroids, &groups);
+    int num_groups = groups.num_groups;
+
+    kmeans_context_t *context = opts->context;
+    int *cluster_sizes = context_array<int>(context, CONTEXT_YINYANG, SLOT_YINYANG_SIZES, num_clusters);
+    real *old_centroids = context_array<real>(context, CONTEXT_YINYANG, SLOT_YINYANG_OLD_CENTROIDS, num_clusters * dims);
+    double *upper = context_array<double>(context, CONTEXT_YINYANG, SLOT_YINYANG_UPPER, num_points);
+    double *lower = context_array<double>(context, CONTEXT_YINYANG, SLOT_YINYANG_LOWER, (long)num_points * num_groups);
+    double *drift = context_array<double>(context, CONTEXT_YINYANG, SLOT_YINYANG_DRIFT, num_clusters);
+    double *group_drift = context_array<double>(context, CONTEXT_YINYANG, SLOT_YINYANG_GROUP_DRIFT, num_groups);
+    real *scratch_distances = context_array<real>(context, CONTEXT_YINYANG, SLOT_YINYANG_SCRATCH_DISTANCES, num_workers * num_clusters);
+    long *computed_by_worker = context_array<long>(context, CONTEXT_YINYANG, SLOT_YINYANG_COMPUTED, num_workers);
+    int *changed_by_worker = context_array<int>(context, CONTEXT_YINYANG, SLOT_YINYANG_CHANGED, num_workers);
+    bool trace = telemetry_enabled(context);
+    phase_clock_t phases(trace);
+
+    if(debug){
+        cout << "dims = " << dims << endl;
+        cout << "num_clusters = " << num_clusters << endl;
+        cout << "num_groups = " << num_groups << endl;
+        cout << "max_num_iters = " << max_num_iters << endl;
+        cout << "threshold = " << threshold << endl;
+        cout << "num_points = " << num_points << endl;
+
+        cout << "*********** INITIAL CENTROIDS ***********" << endl;
+        print_centroids(centroids, num_clusters, dims);
+    }
+
+    bool done = false;
+    int iterations = 0;
+
+    while(!done) {
+        phases.start();
+        memset(computed_by_worker, 0, num_workers * sizeof(long));
+        memset(changed_by_worker, 0, num_workers * sizeof(int));
+
+        parallel_for(num_workers, num_points, [&](int begin, int end, int worker) {
+            if (iterations == 0)
+                computed_by_worker[worker] = initial_assignment(num_clusters, dims, begin, end, points, centroids, slack, &groups,
+                                                                cluster_id_of_points, upper, lower,
+                                                                &scratch_distances[worker * num_clusters], &changed_by_worker[worker]);
+            else
+                computed_by_worker[worker] = yinyang_assignment(dims, begin, end, points, centroids, slack, &groups, drift, group_drift,
+                                                                cluster_id_of_points, upper, lower, &changed_by_worker[worker]);
+        });
+
+        double assign_time = phases.lap();
+
+        memcpy(old_centroids, centroids, num_clusters * dims * sizeof(real));
+        update_centroids(num_clusters, dims, num_points, points, cluster_id_of_points, centroids, cluster_sizes);
+
+        compute_drift(num_clusters, dims, old_centroids, centroids, drift);
+        for (int g = 0; g < num_groups; g++)
+            group_drift[g] = 0.0;
+        for (int c = 0; c < num_clusters; c++)
+            group_drift[groups.group_of[c]] = max(group_drift[groups.group_of[c]], drift[c]);
+
+        parallel_for(num_workers, num_points, [&](int begin, int end, int worker) {
+            for (int i = begin; i < end; i++) {
+                upper[i] += drift[cluster_id_of_points[i]];
+                double *point_lower = &lower[(long)i * num_groups];
+                for (int g = 0; g < num_groups; g++)
+                    point_lower[g] -= group_drift[g];
+            }
+        });
+
+        double update_time = phases.lap();
+
+        long computed = 0;
+        int changed = 0;
+        for (int w = 0; w < num_workers; w++) {
+            computed += computed_by_worker[w];
+            changed += changed_by_worker[w];
+        }
+
+        iterations++;
+        bool is_converged;
+
+        if (use_alternate_convergence)
+            is_converged = changed == 0;
+        else
+            is_converged = converged(num_clusters, dims, threshold, old_centroids, centroids);
+
+        done = iterations > max_num_iters || is_converged;
+
+        if (trace) {
+            iteration_telemetry_t stats = {iterations, assign_time, update_time, phases.lap(), iterations == 1 ? num_points : changed,
+                                           computed,
+                                           assignment_inertia(context, num_points, dims, points, cluster_id_of_points, centroids,
+                                                              num_workers)};
+            write_iteration_telemetry(context->telemetry, "yinyang", &stats);
+        }
+
+        if(timer_debug) {
+            double total = (double)num_points * num_clusters;
+            printf("yinyang_iteration: %d skipped_fraction: %f \n", iterations, 1.0 - computed / total);
+        }
+
+        if(debug){
+            cout << "*********** CENTROIDS " << iterations << " ***********" << endl;
+            print_centroids(centroids, num_clusters, dims);
+        }
+    }
+
+
+    return iterations;
+}
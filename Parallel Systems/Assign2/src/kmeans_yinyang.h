@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+
+#include "argparse.h"
+#include "helpers.h"
+#include "kmeans_sequential.h"
+#include "kmeans_bounds.h"
+#include "parallel.h"
+
+// centroids per group, as suggested by the yinyang paper
+#define YINYANG_GROUP_SIZE 10
+
+int kmeans_yinyang(int num_points, real *points, struct options_t *opts, int* cluster_id_of_points, real* centroids);
@@ -3,70 +3,306 @@
 #include "argparse.h"
 #include "io.h"
 #include "seed.h"
-#include "kmeans_sequential.h"
-#include "kmeans_cuda.h"
-#include "kmeans_thrust.h"
+#include "kmeans_context.h"
+#include "kmeans_fused.h"
+#include "kmeans_minibatch.h"
+#include "kmeans_mpi.h"
+#include "kmeans_predict.h"
+#include "kmeans_multirun.h"
+#include "kmeans_sparse.h"
+#include "point_stream.h"
 #include "helpers.h"
 
 using namespace std;
 
 extern bool timer_debug;
 
-int main(int argc, char **argv) {
-  struct options_t opts;
-  get_opts(argc, argv, &opts);
+static void write_model(struct options_t *opts, real *centroids) {
+  if (opts->save_model && !save_model(opts->save_model, opts->num_clusters, opts->dims, centroids))
+    std::cerr << "cannot write model " << opts->save_model << std::endl;
+}
+
+// assigns points to a saved model instead of training, printing ids like the training run does
+static int run_predict(struct options_t *opts) {
+  int *cluster_id_of_points;
+  double per_batch_time = 0;
+
+  int n_points = kmeans_predict(opts, &cluster_id_of_points, &per_batch_time);
+  if (n_points < 0)
+    return 1;
 
+  int batch_size = std::max(1, opts->batch_size);
+  printf("%d,%lf\n", (n_points + batch_size - 1) / batch_size, per_batch_time);
+  print_clusters(n_points, cluster_id_of_points);
+  return 0;
+}
+
+// every (k, seed) run shares one load of the input; the best one is printed like a single run
+static int run_multirun(struct options_t *opts) {
   int n_points;
   real *points;
-  read_file(&opts, &n_points, &points);
+  auto io_start = std::chrono::high_resolution_clock::now();
+  read_file(opts, &n_points, &points);
+  auto io_time = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - io_start);
 
-  int *cluster_id_of_points = (int *)malloc(n_points * sizeof(int));
+  int *cluster_id_of_points = context_array<int>(opts->context, CONTEXT_RESULT, SLOT_RESULT_IDS, n_points);
+  real *centroids = context_array<real>(opts->context, CONTEXT_RESULT, SLOT_RESULT_CENTROIDS, (size_t)multirun_max_clusters(opts) * opts->dims);
 
-  real *centroids = (real *)malloc(opts.num_clusters * opts.dims * sizeof(real));
-  k_means_init_random_centroids(n_points, opts.dims, points, opts.num_clusters, centroids, opts.seed);
+  auto start = std::chrono::high_resolution_clock::now();
+  int iterations = kmeans_multirun(n_points, points, opts, cluster_id_of_points, centroids);
+  auto difference = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start);
 
-  int iterations = 0;
-  double per_iteration_time = 0;
+  if(timer_debug) {
+    printf("main_total: %f ms \n", difference.count());
+    printf("ingest_time: %f ms \n", io_time.count());
+  }
 
-  auto start = std::chrono::high_resolution_clock::now();
+  printf("%d,%lf\n", iterations, difference.count() / iterations);
+  write_model(opts, centroids);
 
-  switch (opts.algorithm)
-  {
-    case 0:
-      iterations = kmeans_sequential(n_points, points, &opts, cluster_id_of_points, centroids);
-      break;
-    case 1:
-      iterations = kmeans_cuda(n_points, points, &opts, cluster_id_of_points, centroids, false, &per_iteration_time);
-      break;
-    case 2:
-      iterations = kmeans_cuda(n_points, points, &opts, cluster_id_of_points, centroids, true, &per_iteration_time);
-      break;
-    case 3:
-      iterations = kmeans_thrust(n_points, points, &opts, cluster_id_of_points, centroids, &per_iteration_time);
-      break;
+  if (opts->show_centroids) {
+    print_centroids(centroids, opts->num_clusters, opts->dims);
+  } else {
+    print_clusters(n_points, cluster_id_of_points);
   }
 
-  auto end = chrono::high_resolution_clock::now();
-  auto difference = chrono::duration<double, milli>(end - start);
+  free_points(points);
+  return 0;
+}
 
-  if (opts.algorithm == 0) {
-    per_iteration_time = difference.count() / iterations;
+// CSR input (sparse_points.h); dense inputs are converted so the two paths can be compared
+static int run_sparse(struct options_t *opts) {
+  csr_points_t csr;
+  auto io_start = std::chrono::high_resolution_clock::now();
+  if (is_sparse_point_file(opts->in_file)) {
+    if (!read_sparse_points(opts->in_file, &csr)) {
+      std::cerr << "cannot read sparse points from " << opts->in_file << std::endl;
+      return 1;
+    }
+    opts->dims = csr.dims;
+  } else {
+    int n_points;
+    real *points;
+    read_file(opts, &n_points, &points);
+    dense_to_csr(n_points, opts->dims, points, &csr);
+    free_points(points);
   }
+  auto io_time = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - io_start);
+
+  if (opts->init != INIT_RANDOM)
+    std::cerr << "sparse input only supports --init random, using it" << std::endl;
+
+  int *cluster_id_of_points = context_array<int>(opts->context, CONTEXT_RESULT, SLOT_RESULT_IDS, csr.num_points);
+  real *centroids = context_array<real>(opts->context, CONTEXT_RESULT, SLOT_RESULT_CENTROIDS, (size_t)opts->num_clusters * opts->dims);
+  k_means_init_random_centroids_sparse(&csr, opts->num_clusters, centroids, opts->seed);
+
+  auto start = std::chrono::high_resolution_clock::now();
+  int iterations = kmeans_sparse(&csr, opts, cluster_id_of_points, centroids);
+  auto difference = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start);
 
   if(timer_debug) {
     printf("main_per_iteration: %f ms \n", difference.count() / iterations);
     printf("main_total: %f ms \n", difference.count());
+    printf("ingest_time: %f ms \n", io_time.count());
   }
 
-  printf("%d,%lf\n", iterations, per_iteration_time);
+  printf("%d,%lf\n", iterations, difference.count() / iterations);
+  write_model(opts, centroids);
 
-  if (opts.show_centroids) {
-    print_centroids(centroids, opts.num_clusters, opts.dims);
+  if (opts->show_centroids) {
+    print_centroids(centroids, opts->num_clusters, opts->dims);
   } else {
-    print_clusters(n_points, cluster_id_of_points);
+    print_clusters(csr.num_points, cluster_id_of_points);
+  }
+
+  free_sparse_points(&csr);
+  return 0;
+}
+
+// minibatch mode never holds the whole input, so it has its own driver
+static int run_minibatch(struct options_t *opts) {
+  real *centroids = context_array<real>(opts->context, CONTEXT_RESULT, SLOT_RESULT_CENTROIDS, (size_t)opts->num_clusters * opts->dims);
+  double per_batch_time = 0;
+
+  int batches = kmeans_minibatch(opts, centroids, &per_batch_time);
+
+  printf("%d,%lf\n", batches, per_batch_time);
+  write_model(opts, centroids);
+
+  if (opts->show_centroids) {
+    print_centroids(centroids, opts->num_clusters, opts->dims);
+  } else {
+    stream_assign_points(opts, centroids, true);
+  }
+  return 0;
+}
+
+#ifdef KMEANS_USE_MPI
+// Every rank reads its own contiguous shard and they seed together (mpi_init_centroids); rank 0
+// gathers the ids to print.
+static int run_mpi(int argc, char **argv, struct options_t *opts) {
+  MPI_Init(&argc, &argv);
+  int rank, num_ranks;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &num_ranks);
+
+  auto io_start = std::chrono::high_resolution_clock::now();
+  long first_point, total_points;
+  int n_points;
+  real *points;
+  n_points = read_point_shard(opts->in_file, opts->dims, rank, num_ranks, &first_point, &total_points, &points);
+  if (n_points < 0) {
+    std::cerr << "rank " << rank << " cannot read its shard of " << opts->in_file << std::endl;
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  auto io_time = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - io_start);
+
+  int *cluster_id_of_points = context_array<int>(opts->context, CONTEXT_RESULT, SLOT_RESULT_IDS, n_points);
+  real *centroids = context_array<real>(opts->context, CONTEXT_RESULT, SLOT_RESULT_CENTROIDS, (size_t)opts->num_clusters * opts->dims);
+
+  auto init_start = std::chrono::high_resolution_clock::now();
+  mpi_init_centroids(n_points, points, first_point, total_points, opts, centroids);
+  auto init_time = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - init_start);
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  auto start = std::chrono::high_resolution_clock::now();
+  int iterations = kmeans_mpi(n_points, points, opts, cluster_id_of_points, centroids);
+  auto difference = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start);
+
+  // shard sizes are implied by the split, so rank 0 can lay out the gather on its own
+  int *all_ids = NULL;
+  int *shard_sizes = NULL;
+  int *shard_offsets = NULL;
+  if (rank == 0 && !opts->show_centroids) {
+    all_ids = context_array<int>(opts->context, CONTEXT_RESULT, SLOT_RESULT_GATHERED_IDS, total_points);
+    shard_sizes = context_array<int>(opts->context, CONTEXT_RESULT, SLOT_RESULT_SHARD_SIZES, num_ranks);
+    shard_offsets = context_array<int>(opts->context, CONTEXT_RESULT, SLOT_RESULT_SHARD_OFFSETS, num_ranks);
+    for (int r = 0; r < num_ranks; r++) {
+      shard_offsets[r] = total_points * r / num_ranks;
+      shard_sizes[r] = total_points * (r + 1) / num_ranks - shard_offsets[r];
+    }
   }
+  if (!opts->show_centroids)
+    MPI_Gatherv(cluster_id_of_points, n_points, MPI_INT, all_ids, shard_sizes, shard_offsets, MPI_INT, 0, MPI_COMM_WORLD);
+
+  if (rank == 0) {
+    if(timer_debug) {
+      printf("main_per_iteration: %f ms \n", difference.count() / iterations);
+      printf("main_total: %f ms \n", difference.count());
+      printf("init_time: %f ms \n", init_time.count());
+      printf("ingest_time: %f ms \n", io_time.count());
+      printf("mpi_ranks: %d \n", num_ranks);
+    }
 
-  free(cluster_id_of_points);
+    printf("%d,%lf\n", iterations, difference.count() / iterations);
+    write_model(opts, centroids);
+
+    if (opts->show_centroids) {
+      print_centroids(centroids, opts->num_clusters, opts->dims);
+    } else {
+      print_clusters(total_points, all_ids);
+    }
+  }
   free(points);
-  free(centroids);
-}
\ No newline at end of file
+
+  MPI_Finalize();
+  return 0;
+}
+#endif
+
+// seeds and runs one of the in-memory backends through the context
+static int run_fit(struct options_t *opts) {
+  int n_points;
+  real *points;
+  auto io_start = std::chrono::high_resolution_clock::now();
+  read_file(opts, &n_points, &points);
+  auto io_time = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - io_start);
+
+  struct kmeans_context_t *context = opts->context;
+  telemetry_t telemetry;
+  if (opts->telemetry) {
+    if (!open_telemetry(opts->telemetry, &telemetry)) {
+      std::cerr << "cannot write telemetry to " << opts->telemetry << std::endl;
+      free_points(points);
+      return 1;
+    }
+    context->telemetry = &telemetry;
+  }
+  int iterations = context_fit(context, opts, n_points, points);
+  // only the fit itself is traced, not the storage report's rerun below
+  if (opts->telemetry) {
+    context->telemetry = NULL;
+    close_telemetry(&telemetry);
+  }
+  if (iterations < 0) {
+    free_points(points);
+    return 1;
+  }
+
+  if(timer_debug) {
+    printf("main_per_iteration: %f ms \n", context->fit_time / iterations);
+    printf("main_total: %f ms \n", context->fit_time);
+    printf("init_time: %f ms \n", context->init_time);
+    if (opts->init_assignments)
+      printf("warm_start_points: %d \n", context->warm_points);
+    if (opts->layout == LAYOUT_BLOCKED)
+      printf("layout_time: %f ms \n", context->layout_time);
+    printf("ingest_time: %f ms \n", io_time.count());
+    printf("context_allocations: %ld context_reserved_bytes: %zu \n", context->allocations, context->reserved_bytes);
+  }
+
+  // the accuracy report reruns the fused backend in fp32 from the same start
+  if (timer_debug && opts->algorithm == 7 && opts->storage != STORAGE_FP32)
+    report_storage_accuracy(n_points, points, opts, context->cluster_id_of_points, context->centroids, context->initial_centroids);
+
+  printf("%d,%lf\n", iterations, context->per_iteration_time);
+  write_model(opts, context->centroids);
+
+  if (opts->show_centroids) {
+    print_centroids(context->centroids, opts->num_clusters, opts->dims);
+  } else {
+    print_clusters(n_points, context->cluster_id_of_points);
+  }
+
+  free_points(points);
+  return 0;
+}
+
+static int run(int argc, char **argv, struct options_t *opts) {
+  if (opts->predict_model)
+    return run_predict(opts);
+
+  if (opts->algorithm == 8)
+    return run_minibatch(opts);
+
+  if (opts->algorithm == 10)
+    return run_multirun(opts);
+
+  if (opts->algorithm == 11)
+    return run_sparse(opts);
+
+  if (opts->algorithm == 9) {
+#ifdef KMEANS_USE_MPI
+    return run_mpi(argc, argv, opts);
+#else
+    std::cerr << "algorithm 9 needs the MPI build (make mpi)" << std::endl;
+    return 1;
+#endif
+  }
+
+  return run_fit(opts);
+}
+
+int main(int argc, char **argv) {
+  struct options_t opts;
+  get_opts(argc, argv, &opts);
+
+  // every buffer of the run comes from here and goes back in one place
+  struct kmeans_context_t context;
+  init_kmeans_context(&context);
+  opts.context = &context;
+
+  int status = run(argc, argv, &opts);
+  free_kmeans_context(&context);
+  return status;
+}
@@ -0,0 +1,94 @@
+#include "parallel.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// one call of parallel_run, on the caller's stack
+struct parallel_job_t {
+    int pending;                        // pool threads still running a range
+    std::condition_variable done;
+};
+
+struct pool_thread_t {
+    std::condition_variable wake;
+    parallel_job_t *job;                // NULL while idle
+    void (*body)(const void *, int, int, int);
+    const void *fn;
+    int begin;
+    int end;
+    int worker;
+};
+
+// Everything is handed over under lock. The pool is never destroyed, so idle threads can stay
+// blocked on it through exit.
+struct worker_pool_t {
+    std::mutex lock;
+    std::vector<pool_thread_t *> threads;
+    std::vector<pool_thread_t *> idle;  // capacity kept at threads.size(), so releasing never allocates
+};
+
+static worker_pool_t *worker_pool() {
+    static worker_pool_t *pool = new worker_pool_t;
+    return pool;
+}
+
+static void pool_thread_main(worker_pool_t *pool, pool_thread_t *self) {
+    std::unique_lock<std::mutex> hold(pool->lock);
+    while (true) {
+        self->wake.wait(hold, [&] { return self->job != NULL; });
+        hold.unlock();
+        self->body(self->fn, self->begin, self->end, self->worker);
+        hold.lock();
+        parallel_job_t *job = self->job;
+        self->job = NULL;
+        pool->idle.push_back(self);
+        if (--job->pending == 0)
+            job->done.notify_one();
+    }
+}
+
+// an idle thread, started if there is none; called with the pool locked
+static pool_thread_t *claim_pool_thread(worker_pool_t *pool) {
+    if (pool->idle.empty()) {
+        pool_thread_t *created = new pool_thread_t();
+        pool->threads.push_back(created);
+        pool->idle.reserve(pool->threads.size());
+        std::thread(pool_thread_main, pool, created).detach();
+        return created;
+    }
+    pool_thread_t *claimed = pool->idle.back();
+    pool->idle.pop_back();
+    return claimed;
+}
+
+void parallel_run(int num_workers, int n, void (*body)(const void *fn, int begin, int end, int worker), const void *fn) {
+    worker_pool_t *pool = worker_pool();
+    parallel_job_t job;
+    job.pending = 0;
+
+    int chunk = (n + num_workers - 1) / num_workers;
+    {
+        std::lock_guard<std::mutex> hold(pool->lock);
+        for (int w = 1; w < num_workers; w++) {
+            int begin = w * chunk;
+            int end = std::min(n, begin + chunk);
+            if (begin >= end)
+                break;
+            pool_thread_t *thread = claim_pool_thread(pool);
+            thread->body = body;
+            thread->fn = fn;
+            thread->begin = begin;
+            thread->end = end;
+            thread->worker = w;
+            thread->job = &job;
+            job.pending++;
+            thread->wake.notify_one();
+        }
+    }
+    body(fn, 0, std::min(n, chunk), 0);
+
+    std::unique_lock<std::mutex> hold(pool->lock);
+    job.done.wait(hold, [&] { return job.pending == 0; });
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <algorithm>
+
+// Runs body(fn, begin, end, worker) for worker 1.. of a parallel_for on threads of a process-wide
+// pool and worker 0 on the calling thread. A call takes as many idle pool threads as it needs and
+// starts new ones only when there are not enough, so once the widest (or most deeply nested)
+// split has run, later calls start no threads and allocate nothing.
+void parallel_run(int num_workers, int n, void (*body)(const void *fn, int begin, int end, int worker), const void *fn);
+
+// Splits [0, n) into num_workers contiguous ranges and runs fn(begin, end, worker_id) on
+// each one. Worker 0 runs on the calling thread; the call returns once every range is done.
+// fn may itself call parallel_for.
+template <typename F>
+void parallel_for(int num_workers, int n, const F &fn) {
+    if (num_workers <= 1 || n < num_workers) {
+        fn(0, n, 0);
+        return;
+    }
+    parallel_run(num_workers, n, [](const void *f, int begin, int end, int worker) { (*(const F *)f)(begin, end, worker); }, &fn);
+}
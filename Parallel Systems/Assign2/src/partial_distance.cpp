@@ -0,0 +1,86 @@
+#include "partial_distance.h"
+#include "kmeans_sequential.h"
+
+using namespace std;
+
+void compute_centroid_neighbours(int num_clusters, int dims, real *centroids, int *neighbours, pair<real, int> *others) {
+    int num_neighbours = min(PARTIAL_NEIGHBOURS, num_clusters - 1);
+
+    for (int c = 0; c < num_clusters; c++) {
+        int count = 0;
+        for (int other = 0; other < num_clusters; other++)
+            if (other != c)
+                others[count++] = make_pair(squared_distance(&centroids[c * dims], &centroids[other * dims], dims), other);
+        partial_sort(others, others + num_neighbours, others + count);
+
+        for (int j = 0; j < PARTIAL_NEIGHBOURS; j++)
+            neighbours[c * PARTIAL_NEIGHBOURS + j] = j < num_neighbours ? others[j].second : -1;
+    }
+}
+
+// Squared distance that stops at the first block boundary where it can no longer beat
+// (best_distance, best_centroid). The partial sums only grow, so stopping never drops a winner.
+static inline bool closer_than_best(const real *point, const real *centroid, int dims, int c,
+                                    real best_distance, int best_centroid, real *distance, long *dims_evaluated) {
+    real sum = 0.0;
+    int d = 0;
+    while (d < dims) {
+        int block_end = min(dims, d + PARTIAL_BLOCK_DIMS);
+        for (; d < block_end; d++) {
+            real diff = point[d] - centroid[d];
+            sum += diff * diff;
+        }
+        if (sum > best_distance || (sum == best_distance && c > best_centroid)) {
+            *dims_evaluated += d;
+            return false;
+        }
+    }
+    *dims_evaluated += dims;
+    *distance = sum;
+    return true;
+}
+
+long assign_points_to_clusters_partial(int num_clusters, int dims, int num_points, real *points,
+                                       int *cluster_id_of_points, real *centroids, int *neighbours, int *visited) {
+    long dims_evaluated = 0;
+    // visited[c] == i marks centroid c as already tried for point i
+    for (int c = 0; c < num_clusters; c++)
+        visited[c] = -1;
+
+    for (int i = 0; i < num_points; i++) {
+        real *point = &points[(long)i * dims];
+        int best_centroid = -1;
+        real best_distance = DBL_MAX;
+        real distance;
+
+        int previous = cluster_id_of_points[i];
+        if (previous >= 0 && previous < num_clusters) {
+            visited[previous] = i;
+            best_distance = squared_distance(point, &centroids[previous * dims], dims);
+            best_centroid = previous;
+            dims_evaluated += dims;
+
+            for (int j = 0; j < PARTIAL_NEIGHBOURS; j++) {
+                int c = neighbours[previous * PARTIAL_NEIGHBOURS + j];
+                if (c < 0)
+                    break;
+                visited[c] = i;
+                if (closer_than_best(point, &centroids[c * dims], dims, c, best_distance, best_centroid, &distance, &dims_evaluated)) {
+                    best_distance = distance;
+                    best_centroid = c;
+                }
+            }
+        }
+
+        for (int c = 0; c < num_clusters; c++) {
+            if (visited[c] == i)
+                continue;
+            if (closer_than_best(point, &centroids[c * dims], dims, c, best_distance, best_centroid, &distance, &dims_evaluated)) {
+                best_distance = distance;
+                best_centroid = c;
+            }
+        }
+        cluster_id_of_points[i] = best_centroid;
+    }
+    return dims_evaluated;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstring>
+#include <cfloat>
+#include <cstdlib>
+#include <algorithm>
+#include <utility>
+
+#include "helpers.h"
+
+// the running sum is compared with the best distance every PARTIAL_BLOCK_DIMS dimensions
+#define PARTIAL_BLOCK_DIMS 8
+// centroids tried right after a point's previous centroid, nearest first
+#define PARTIAL_NEIGHBOURS 8
+
+// neighbours[c * PARTIAL_NEIGHBOURS ..] = the centroids closest to centroid c, nearest first,
+// padded with -1 when num_clusters - 1 < PARTIAL_NEIGHBOURS; others is num_clusters entries of scratch
+void compute_centroid_neighbours(int num_clusters, int dims, real *centroids, int *neighbours, std::pair<real, int> *others);
+
+// Partial-distance search: tries each point's previous centroid, then that centroid's
+// neighbours, then the rest, and abandons a centroid as soon as the running squared distance
+// (checked at block boundaries) passes the best so far. Sums run in the same order as
+// assign_points_to_clusters and ties go to the lower index, so the ids are identical to it.
+// cluster_id_of_points holds the previous ids on entry (anything outside [0, num_clusters)
+// means none). visited is num_clusters ints of scratch. Returns the number of dimensions actually evaluated.
+long assign_points_to_clusters_partial(int num_clusters, int dims, int num_points, real *points,
+                                       int *cluster_id_of_points, real *centroids, int *neighbours, int *visited);
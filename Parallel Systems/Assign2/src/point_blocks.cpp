@@ -0,0 +1,57 @@
+#include "point_blocks.h"
+#include "parallel.h"
+
+#include <algorithm>
+
+using namespace std;
+
+int parse_point_layout(const char *name) {
+    if (strcmp(name, "rows") == 0)
+        return LAYOUT_ROWS;
+    if (strcmp(name, "blocked") == 0)
+        return LAYOUT_BLOCKED;
+    return -1;
+}
+
+const char *point_layout_name(int layout) {
+    return layout == LAYOUT_BLOCKED ? "blocked" : "rows";
+}
+
+long point_blocks_size(int num_points, int dims) {
+    long num_blocks = (num_points + POINT_BLOCK - 1) / POINT_BLOCK;
+    return num_blocks * dims * POINT_BLOCK;
+}
+
+void block_points(int num_points, int dims, real *points, real *data, int num_workers, point_blocks_t *blocks) {
+    blocks->num_points = num_points;
+    blocks->dims = dims;
+    blocks->num_blocks = (num_points + POINT_BLOCK - 1) / POINT_BLOCK;
+    blocks->data = data;
+
+    parallel_for(num_workers, blocks->num_blocks, [&](int begin, int end, int worker) {
+        for (int b = begin; b < end; b++) {
+            real *block = &data[(long)b * dims * POINT_BLOCK];
+            int first = b * POINT_BLOCK;
+            int count = min(POINT_BLOCK, num_points - first);
+            if (count < POINT_BLOCK)
+                memset(block, 0, (long)dims * POINT_BLOCK * sizeof(real));
+            for (int l = 0; l < count; l++) {
+                const real *point = &points[(long)(first + l) * dims];
+                for (int d = 0; d < dims; d++)
+                    block[d * POINT_BLOCK + l] = point[d];
+            }
+        }
+    });
+}
+
+void assign_points_to_clusters_blocked(int num_clusters, int dims, point_blocks_t *blocks, int *cluster_id_of_points,
+                                       real *centroids) {
+    int best_centroid[POINT_BLOCK];
+    real best_distance[POINT_BLOCK];
+    for (int b = 0; b < blocks->num_blocks; b++) {
+        nearest_in_block(&blocks->data[(long)b * dims * POINT_BLOCK], dims, num_clusters, centroids, best_centroid, best_distance);
+        int first = b * POINT_BLOCK;
+        int count = min(POINT_BLOCK, blocks->num_points - first);
+        memcpy(&cluster_id_of_points[first], best_centroid, count * sizeof(int));
+    }
+}
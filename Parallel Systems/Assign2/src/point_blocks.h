@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstring>
+#include <cfloat>
+#include <cstdlib>
+
+#include "helpers.h"
+
+#define LAYOUT_ROWS 0
+#define LAYOUT_BLOCKED 1
+
+// points per block: one 512-bit register of floats, or two 256-bit ones
+#define POINT_BLOCK 16
+
+// Dimension-blocked copy of row-major points: block b holds points [b * POINT_BLOCK,
+// (b + 1) * POINT_BLOCK) with dimension d of lane l at data[(b * dims + d) * POINT_BLOCK + l],
+// so one vector load reads one dimension of every point in the block. The last block is
+// padded with zero points that no kernel reports.
+struct point_blocks_t {
+    int num_points;
+    int dims;
+    int num_blocks;
+    real *data;
+};
+
+// "rows" or "blocked"; -1 when unknown
+int parse_point_layout(const char *name);
+
+const char *point_layout_name(int layout);
+
+// transposes points into blocks->data, which must hold point_blocks_size(num_points, dims) reals
+void block_points(int num_points, int dims, real *points, real *data, int num_workers, point_blocks_t *blocks);
+
+long point_blocks_size(int num_points, int dims);
+
+// A block is handled as BLOCK_VECTORS native vectors. GCC and clang map these types straight
+// onto registers, which keeps every lane's sum independent; left to itself the vectorizer
+// prefers to run across dimensions and spends the gain on shuffles.
+#if defined(__AVX512F__)
+#define BLOCK_VECTOR_BYTES 64
+#elif defined(__AVX__)
+#define BLOCK_VECTOR_BYTES 32
+#else
+#define BLOCK_VECTOR_BYTES 16
+#endif
+#define BLOCK_VECTOR_LANES (BLOCK_VECTOR_BYTES / (int)sizeof(real))
+#define BLOCK_VECTORS (POINT_BLOCK / BLOCK_VECTOR_LANES)
+
+typedef real block_lanes_t __attribute__((vector_size(BLOCK_VECTOR_BYTES)));
+typedef int block_ids_t __attribute__((vector_size(BLOCK_VECTOR_BYTES)));
+
+// Nearest centroid for every lane of one block. Each lane sums its squared differences in
+// dimension order and keeps the first centroid on ties, exactly as squared_distance and
+// assign_points_to_clusters do for a row, so the assignment does not depend on the layout.
+static inline void nearest_in_block(const real *block, int dims, int num_clusters, const real *centroids,
+                                    int *best_centroid, real *best_distance) {
+    block_ids_t best[BLOCK_VECTORS];
+    block_lanes_t nearest[BLOCK_VECTORS];
+    for (int v = 0; v < BLOCK_VECTORS; v++) {
+        best[v] = block_ids_t{} - 1;
+        nearest[v] = block_lanes_t{} + (real)DBL_MAX;
+    }
+    for (int c = 0; c < num_clusters; c++) {
+        const real *centroid = &centroids[(long)c * dims];
+        block_lanes_t distance[BLOCK_VECTORS] = {};
+        for (int d = 0; d < dims; d++) {
+            const real *lanes = &block[d * POINT_BLOCK];
+            for (int v = 0; v < BLOCK_VECTORS; v++) {
+                block_lanes_t point;
+                memcpy(&point, &lanes[v * BLOCK_VECTOR_LANES], sizeof(point));
+                block_lanes_t diff = point - centroid[d];
+                distance[v] += diff * diff;
+            }
+        }
+        for (int v = 0; v < BLOCK_VECTORS; v++) {
+            block_ids_t closer = distance[v] < nearest[v];
+            nearest[v] = closer ? distance[v] : nearest[v];
+            best[v] = closer ? c : best[v];
+        }
+    }
+    memcpy(best_centroid, best, sizeof(best));
+    memcpy(best_distance, nearest, sizeof(nearest));
+}
+
+// assign_points_to_clusters over the blocked layout
+void assign_points_to_clusters_blocked(int num_clusters, int dims, point_blocks_t *blocks, int *cluster_id_of_points,
+                                       real *centroids);
@@ -0,0 +1,139 @@
+#include "point_storage.h"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+static uint32_t float_to_bits(real value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+// round to nearest even, overflowing to infinity like a hardware conversion
+static uint16_t float_to_half(real value) {
+    uint32_t bits = float_to_bits(value);
+    uint16_t sign = (bits >> 16) & 0x8000;
+    uint32_t magnitude = bits & 0x7fffffff;
+
+    if (magnitude > 0x7f800000)
+        return sign | 0x7e00;
+    // 65520 and up round past the largest half (65504)
+    if (magnitude >= 0x477ff000)
+        return sign | 0x7c00;
+    // below 2^-14 the half is subnormal: an integer multiple of 2^-24
+    if (magnitude < 0x38800000)
+        return sign | (uint16_t)lrintf(bits_to_float(magnitude) * 0x1p24f);
+
+    magnitude += 0xfff + ((magnitude >> 13) & 1);
+    return sign | (uint16_t)((magnitude - 0x38000000) >> 13);
+}
+
+static uint16_t float_to_bfloat16(real value) {
+    uint32_t bits = float_to_bits(value);
+    if ((bits & 0x7fffffff) > 0x7f800000)
+        return (bits >> 16) | 0x40;
+    return (bits + 0x7fff + ((bits >> 16) & 1)) >> 16;
+}
+
+int parse_storage_format(const char *name) {
+    if (strcmp(name, "fp32") == 0)
+        return STORAGE_FP32;
+    if (strcmp(name, "fp16") == 0)
+        return STORAGE_FP16;
+    if (strcmp(name, "bf16") == 0)
+        return STORAGE_BF16;
+    if (strcmp(name, "int8") == 0)
+        return STORAGE_INT8;
+    return -1;
+}
+
+const char *storage_format_name(int format) {
+    switch (format)
+    {
+        case STORAGE_FP16:
+            return "fp16";
+        case STORAGE_BF16:
+            return "bf16";
+        case STORAGE_INT8:
+            return "int8";
+        default:
+            return "fp32";
+    }
+}
+
+int storage_bytes_per_value(int format) {
+    switch (format)
+    {
+        case STORAGE_FP16:
+        case STORAGE_BF16:
+            return 2;
+        case STORAGE_INT8:
+            return 1;
+        default:
+            return sizeof(real);
+    }
+}
+
+size_t point_storage_size(int num_points, int dims, int format) {
+    // int8 keeps its per-dimension scale and offset ahead of the codes
+    size_t header = format == STORAGE_INT8 ? 2 * dims * sizeof(real) : 0;
+    return format == STORAGE_FP32 ? 0 : header + (size_t)num_points * dims * storage_bytes_per_value(format);
+}
+
+void encode_point_storage(int num_points, int dims, real *points, int format, void *buffer, point_storage_t *storage) {
+    long num_values = (long)num_points * dims;
+    storage->format = format;
+    storage->num_points = num_points;
+    storage->dims = dims;
+    storage->scale = NULL;
+    storage->offset = NULL;
+
+    switch (format)
+    {
+        case STORAGE_FP16: {
+            uint16_t *data = (uint16_t *)buffer;
+            for (long j = 0; j < num_values; j++)
+                data[j] = float_to_half(points[j]);
+            storage->data = data;
+            break;
+        }
+        case STORAGE_BF16: {
+            uint16_t *data = (uint16_t *)buffer;
+            for (long j = 0; j < num_values; j++)
+                data[j] = float_to_bfloat16(points[j]);
+            storage->data = data;
+            break;
+        }
+        case STORAGE_INT8: {
+            // each dimension's [min, max] is split into 255 even steps
+            storage->scale = (real *)buffer;
+            storage->offset = storage->scale + dims;
+            uint8_t *data = (uint8_t *)(storage->offset + dims);
+            for (int d = 0; d < dims; d++) {
+                real low = num_points > 0 ? points[d] : 0;
+                real high = low;
+                for (long i = 0; i < num_points; i++) {
+                    low = min(low, points[i * dims + d]);
+                    high = max(high, points[i * dims + d]);
+                }
+                storage->offset[d] = low;
+                storage->scale[d] = (high - low) / 255;
+            }
+            for (long i = 0; i < num_points; i++) {
+                for (int d = 0; d < dims; d++) {
+                    real scale = storage->scale[d];
+                    long code = scale > 0 ? lrintf((points[i * dims + d] - storage->offset[d]) / scale) : 0;
+                    data[i * dims + d] = (uint8_t)max(0L, min(255L, code));
+                }
+            }
+            storage->data = data;
+            break;
+        }
+        default:
+            storage->format = STORAGE_FP32;
+            storage->data = points;
+            break;
+    }
+}
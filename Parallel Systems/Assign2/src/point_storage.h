@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+
+#include "helpers.h"
+
+// Compressed in-memory layouts for the points. Kernels templated on one of the *_rows
+// readers below decode a row into a per-worker scratch buffer right before using it, so the
+// points cross the memory bus at 2 (fp16, bf16) or 1 (int8) bytes per value.
+#define STORAGE_FP32 0
+#define STORAGE_FP16 1
+#define STORAGE_BF16 2
+#define STORAGE_INT8 3
+
+struct point_storage_t {
+    int format;
+    long num_points;
+    int dims;
+    void *data;
+    real *scale;    // int8 only: value = offset[d] + scale[d] * code
+    real *offset;
+};
+
+// returns one of the STORAGE_* values, or -1 for an unknown name
+int parse_storage_format(const char *name);
+
+const char *storage_format_name(int format);
+
+int storage_bytes_per_value(int format);
+
+// Encodes row-major fp32 points into `format` inside buffer, which must hold
+// point_storage_size(num_points, dims, format) bytes (cache-line aligned); STORAGE_FP32 keeps a
+// pointer to points without copying and needs no buffer.
+void encode_point_storage(int num_points, int dims, real *points, int format, void *buffer, point_storage_t *storage);
+
+size_t point_storage_size(int num_points, int dims, int format);
+
+static inline real bits_to_float(uint32_t bits) {
+    real value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// IEEE half to float: placing the 15 magnitude bits under the float exponent and scaling by
+// 2^112 rebases the exponent and handles subnormals in one multiply
+static inline real half_to_float(uint16_t half) {
+    uint32_t magnitude = (uint32_t)(half & 0x7fff) << 13;
+    real value = bits_to_float(magnitude) * 0x1p112f;
+    if ((half & 0x7c00) == 0x7c00)
+        value = bits_to_float(magnitude | 0x7f800000);
+    return (half & 0x8000) ? -value : value;
+}
+
+static inline real bfloat16_to_float(uint16_t value) {
+    return bits_to_float((uint32_t)value << 16);
+}
+
+struct fp32_rows {
+    const real *data;
+    int dims;
+    inline const real *row(long i, real *scratch) const { return &data[i * dims]; }
+};
+
+struct fp16_rows {
+    const uint16_t *data;
+    int dims;
+    inline const real *row(long i, real *scratch) const {
+        const uint16_t *src = &data[i * dims];
+        for (int d = 0; d < dims; d++)
+            scratch[d] = half_to_float(src[d]);
+        return scratch;
+    }
+};
+
+struct bf16_rows {
+    const uint16_t *data;
+    int dims;
+    inline const real *row(long i, real *scratch) const {
+        const uint16_t *src = &data[i * dims];
+        for (int d = 0; d < dims; d++)
+            scratch[d] = bfloat16_to_float(src[d]);
+        return scratch;
+    }
+};
+
+struct int8_rows {
+    const uint8_t *data;
+    const real *scale;
+    const real *offset;
+    int dims;
+    inline const real *row(long i, real *scratch) const {
+        const uint8_t *src = &data[i * dims];
+        for (int d = 0; d < dims; d++)
+            scratch[d] = offset[d] + scale[d] * src[d];
+        return scratch;
+    }
+};
@@ -0,0 +1,118 @@
+#include "point_stream.h"
+
+#include <algorithm>
+
+bool open_point_stream(point_stream_t *stream, const char *path, int dims) {
+    stream->binary = is_binary_point_file(path);
+    stream->in.open(path, std::ios::binary);
+    if (!stream->in.is_open())
+        return false;
+    stream->dims = dims;
+    stream->position = 0;
+
+    if (stream->binary) {
+        point_file_header_t header;
+        stream->in.read((char *)&header, sizeof(header));
+        stream->num_points = header.num_points;
+        stream->data_start = stream->in.tellg();
+        if (!stream->in.good() || (int)header.dims != dims)
+            return false;
+        stream->in.seekg(0, std::ios::end);
+        uint64_t size = stream->in.tellg();
+        stream->in.seekg(stream->data_start);
+        return size >= sizeof(header) + header.num_points * dims * sizeof(real);
+    }
+
+    const char *line;
+    do {
+        std::getline(stream->in, stream->line);
+        line = stream->line.data();
+    } while (stream->in && blank_text_line(line, line + stream->line.size()));
+    if (!stream->in || !parse_text_count(line, line + stream->line.size(), &stream->num_points))
+        return false;
+    // a count line without a newline leaves eof set
+    stream->in.clear();
+    stream->data_start = stream->in.tellg();
+    return true;
+}
+
+int read_points(point_stream_t *stream, real *buffer, int max_points) {
+    if (stream->binary) {
+        long count = std::min((long)max_points, stream->num_points - stream->position);
+        stream->in.read((char *)buffer, count * stream->dims * sizeof(real));
+        count = stream->in.gcount() / (stream->dims * sizeof(real));
+        stream->position += count;
+        return count;
+    }
+
+    int count = 0;
+    while (count < max_points && stream->position < stream->num_points && std::getline(stream->in, stream->line)) {
+        const char *line = stream->line.data();
+        const char *end = line + stream->line.size();
+        if (blank_text_line(line, end))
+            continue;
+        if (!parse_text_point(line, end, stream->dims, &buffer[(long)count * stream->dims]))
+            return -1;
+        count++;
+        stream->position++;
+    }
+    return count;
+}
+
+int read_random_points(point_stream_t *stream, real *buffer, int count, uint64_t *rng_state) {
+    size_t row_bytes = stream->dims * sizeof(real);
+    for (int i = 0; i < count; i++) {
+        // xorshift64*
+        *rng_state ^= *rng_state >> 12;
+        *rng_state ^= *rng_state << 25;
+        *rng_state ^= *rng_state >> 27;
+        long row = (long)((*rng_state * 0x2545F4914F6CDD1DULL) % (uint64_t)stream->num_points);
+        stream->in.seekg(stream->data_start + (std::streamoff)(row * row_bytes));
+        stream->in.read((char *)&buffer[(long)i * stream->dims], row_bytes);
+        if (!stream->in.good())
+            return i;
+    }
+    return count;
+}
+
+void skip_points(point_stream_t *stream, long count) {
+    count = std::min(count, stream->num_points - stream->position);
+    if (count <= 0)
+        return;
+    if (stream->binary) {
+        stream->in.seekg((std::streamoff)(count * stream->dims * sizeof(real)), std::ios::cur);
+    } else {
+        // blank lines are not points, so they don't count
+        for (long skipped = 0; skipped < count && std::getline(stream->in, stream->line);)
+            skipped += !blank_text_line(stream->line.data(), stream->line.data() + stream->line.size());
+    }
+    stream->position += count;
+}
+
+void rewind_point_stream(point_stream_t *stream) {
+    stream->in.clear();
+    stream->in.seekg(stream->data_start);
+    stream->position = 0;
+}
+
+void close_point_stream(point_stream_t *stream) {
+    stream->in.close();
+}
+
+int read_point_shard(const char *path, int dims, int shard, int num_shards, long *first_point,
+                     long *total_points, real **points) {
+    point_stream_t stream;
+    if (!open_point_stream(&stream, path, dims))
+        return -1;
+
+    long first = stream.num_points * shard / num_shards;
+    long last = stream.num_points * (shard + 1) / num_shards;
+    *first_point = first;
+    *total_points = stream.num_points;
+
+    *points = (real *)malloc((last - first) * dims * sizeof(real));
+    skip_points(&stream, first);
+    int count = read_points(&stream, *points, last - first);
+    close_point_stream(&stream);
+    return count == last - first ? count : -1;
+}
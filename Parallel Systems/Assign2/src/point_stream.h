@@ -0,0 +1,48 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <cstdint>
+#include <string>
+
+#include "helpers.h"
+#include "io.h"
+
+// Reads a point file a block at a time instead of loading it whole. Takes both formats
+// read_file() does: text, parsed a line at a time as strictly as parse_text_points does, and
+// the binary format of io.h, which also allows random access.
+struct point_stream_t {
+    std::ifstream in;
+    bool binary;
+    int dims;
+    long num_points;        // as declared in the header
+    long position;          // points returned in the current pass
+    std::streampos data_start;
+    std::string line;       // text only: the line being parsed, kept so its buffer is reused
+};
+
+// fails on a malformed count line, or a binary file shorter than its header says
+bool open_point_stream(point_stream_t *stream, const char *path, int dims);
+
+// Reads up to max_points points into buffer (row-major) and returns how many, 0 once the pass
+// is over or -1 at a text line that isn't a point. A text file with fewer lines than its count
+// ends the pass early, leaving position short of num_points.
+int read_points(point_stream_t *stream, real *buffer, int max_points);
+
+// binary files only: reads count rows picked uniformly at random (with replacement),
+// advancing the caller's generator state
+int read_random_points(point_stream_t *stream, real *buffer, int count, uint64_t *rng_state);
+
+// skips the next count points of the current pass
+void skip_points(point_stream_t *stream, long count);
+
+// starts a new pass from the first point
+void rewind_point_stream(point_stream_t *stream);
+
+// Reads shard `shard` of `num_shards` contiguous, near-equal slices of the file into a new
+// buffer. Sets the slice's first row and the file's total point count; returns the slice
+// length, or -1 if the file can't be read.
+int read_point_shard(const char *path, int dims, int shard, int num_shards, long *first_point,
+                     long *total_points, real **points);
+
+void close_point_stream(point_stream_t *stream);
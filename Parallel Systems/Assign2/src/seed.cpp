@@ -1,8 +1,23 @@
 #include "seed.h"
+#include "parallel.h"
+#include "io.h"
+
+#include <algorithm>
+#include <cfloat>
 
 static unsigned long int next = 1;
 static unsigned long kmeans_rmax = 32767;
 
+// points per block when summing sampling weights; fixed so the sums (and therefore the
+// picks) don't depend on how many workers share the blocks
+#define SEED_BLOCK_SIZE 4096
+#define KMEANS_PARALLEL_ROUNDS 5
+#define KMEANS_PARALLEL_LLOYD_ITERS 5
+// hashed_uniform streams used by k-means||: 0 for the first pick, 1..ROUNDS for the
+// oversampling rounds, then these two
+#define STREAM_TOP_UP (KMEANS_PARALLEL_ROUNDS + 1)
+#define STREAM_RECLUSTER (KMEANS_PARALLEL_ROUNDS + 2)
+
 int k_means_rand() {
   next = next * 1103515245 + 12345;
   return (unsigned int)(next/65536) % (kmeans_rmax+1);
@@ -19,4 +34,284 @@ void k_means_init_random_centroids(int num_points, int dims, real *points, int n
     int index = k_means_rand() % num_points;
     std::memcpy(&centroids[i * dims], &points[index * dims], dims * sizeof(real));
   }
-}
\ No newline at end of file
+}
+
+// Counter-based generator: the value for (seed, stream, index) never depends on which thread
+// asks for it or in what order, which is what keeps the parallel seeding deterministic.
+static double hashed_uniform(uint64_t seed, uint64_t stream, uint64_t index) {
+  uint64_t z = seed * 0x9E3779B97F4A7C15ULL + stream * 0xBF58476D1CE4E5B9ULL + index * 0x94D049BB133111EBULL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  z = z ^ (z >> 31);
+  return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double point_distance(real *a, real *b, int dims) {
+  double distance = 0.0;
+  for (int d = 0; d < dims; d++) {
+    double diff = (double)a[d] - b[d];
+    distance += diff * diff;
+  }
+  return distance;
+}
+
+// min_distances[i] = min(min_distances[i], d(point i, any of the new centers)) for every point,
+// and block_sums[b] = the sum of min_distances over block b. When nearest is given it tracks
+// the index of the closest center, numbering the new ones from first_center.
+static void update_min_distances(int num_points, int dims, real *points, real *new_centers, int num_new_centers,
+                                 double *min_distances, double *block_sums, int *nearest, int first_center, int num_workers) {
+  int num_blocks = (num_points + SEED_BLOCK_SIZE - 1) / SEED_BLOCK_SIZE;
+  parallel_for(num_workers, num_blocks, [&](int begin, int end, int worker) {
+    for (int b = begin; b < end; b++) {
+      double block_sum = 0.0;
+      int last = std::min(num_points, (b + 1) * SEED_BLOCK_SIZE);
+      for (int i = b * SEED_BLOCK_SIZE; i < last; i++) {
+        for (int c = 0; c < num_new_centers; c++) {
+          double distance = point_distance(&points[i * dims], &new_centers[c * dims], dims);
+          if (distance < min_distances[i]) {
+            min_distances[i] = distance;
+            if (nearest)
+              nearest[i] = first_center + c;
+          }
+        }
+        block_sum += min_distances[i];
+      }
+      block_sums[b] = block_sum;
+    }
+  });
+}
+
+static double sum_blocks(double *block_sums, int num_blocks) {
+  double total = 0.0;
+  for (int b = 0; b < num_blocks; b++)
+    total += block_sums[b];
+  return total;
+}
+
+// index whose cumulative weight first exceeds target, walking the block sums before the points
+static int sample_by_weight(int num_points, double *weights, double *block_sums, int num_blocks, double target) {
+  int b = 0;
+  while (b < num_blocks - 1 && target >= block_sums[b]) {
+    target -= block_sums[b];
+    b++;
+  }
+  int last = std::min(num_points, (b + 1) * SEED_BLOCK_SIZE);
+  for (int i = b * SEED_BLOCK_SIZE; i < last; i++) {
+    if (target < weights[i])
+      return i;
+    target -= weights[i];
+  }
+  return last - 1;
+}
+
+void k_means_init_plus_plus(struct kmeans_context_t *context, int num_points, int dims, real *points, int num_clusters, real *centroids,
+                            int seed, int num_workers) {
+  int num_blocks = (num_points + SEED_BLOCK_SIZE - 1) / SEED_BLOCK_SIZE;
+  double *min_distances = context_array<double>(context, CONTEXT_INIT, SLOT_INIT_MIN_DISTANCES, num_points);
+  double *block_sums = context_array<double>(context, CONTEXT_INIT, SLOT_INIT_BLOCK_SUMS, num_blocks);
+
+  for (int i = 0; i < num_points; i++)
+    min_distances[i] = DBL_MAX;
+
+  int first = (int)(hashed_uniform(seed, 0, 0) * num_points);
+  std::memcpy(&centroids[0], &points[first * dims], dims * sizeof(real));
+
+  for (int c = 1; c < num_clusters; c++) {
+    update_min_distances(num_points, dims, points, &centroids[(c - 1) * dims], 1, min_distances, block_sums, NULL, 0, num_workers);
+    double total = sum_blocks(block_sums, num_blocks);
+    int index;
+    if (total > 0.0)
+      index = sample_by_weight(num_points, min_distances, block_sums, num_blocks, hashed_uniform(seed, 0, c) * total);
+    else
+      index = (int)(hashed_uniform(seed, 0, c) * num_points);  // every point already coincides with a centroid
+    std::memcpy(&centroids[c * dims], &points[index * dims], dims * sizeof(real));
+  }
+}
+
+// weighted k-means++ followed by a few weighted lloyd iterations over the (small) candidate set
+static void recluster_candidates(struct kmeans_context_t *context, int num_candidates, int dims, real *candidates, double *weights,
+                                 int num_clusters, real *centroids, int seed) {
+  double *min_distances = context_array<double>(context, CONTEXT_INIT, SLOT_INIT_RECLUSTER_MIN_DISTANCES, num_candidates);
+  double *scores = context_array<double>(context, CONTEXT_INIT, SLOT_INIT_RECLUSTER_SCORES, num_candidates);
+  int *assignment = context_array<int>(context, CONTEXT_INIT, SLOT_INIT_RECLUSTER_ASSIGNMENT, num_candidates);
+  double *sums = context_array<double>(context, CONTEXT_INIT, SLOT_INIT_RECLUSTER_SUMS, num_clusters * dims);
+  double *totals = context_array<double>(context, CONTEXT_INIT, SLOT_INIT_RECLUSTER_TOTALS, num_clusters);
+
+  for (int i = 0; i < num_candidates; i++)
+    min_distances[i] = DBL_MAX;
+
+  int first;
+  double weight_total = 0.0;
+  for (int i = 0; i < num_candidates; i++)
+    weight_total += weights[i];
+  double target = hashed_uniform(seed, STREAM_RECLUSTER, 0) * weight_total;
+  for (first = 0; first < num_candidates - 1 && target >= weights[first]; first++)
+    target -= weights[first];
+  std::memcpy(&centroids[0], &candidates[first * dims], dims * sizeof(real));
+
+  for (int c = 1; c < num_clusters; c++) {
+    double total = 0.0;
+    for (int i = 0; i < num_candidates; i++) {
+      min_distances[i] = std::min(min_distances[i], point_distance(&candidates[i * dims], &centroids[(c - 1) * dims], dims));
+      scores[i] = weights[i] * min_distances[i];
+      total += scores[i];
+    }
+    target = hashed_uniform(seed, STREAM_RECLUSTER, c) * total;
+    int index = 0;
+    for (; index < num_candidates - 1 && target >= scores[index]; index++)
+      target -= scores[index];
+    std::memcpy(&centroids[c * dims], &candidates[index * dims], dims * sizeof(real));
+  }
+
+  for (int iter = 0; iter < KMEANS_PARALLEL_LLOYD_ITERS; iter++) {
+    for (int i = 0; i < num_candidates; i++) {
+      double best = DBL_MAX;
+      for (int c = 0; c < num_clusters; c++) {
+        double distance = point_distance(&candidates[i * dims], &centroids[c * dims], dims);
+        if (distance < best) {
+          best = distance;
+          assignment[i] = c;
+        }
+      }
+    }
+    std::memset(sums, 0, num_clusters * dims * sizeof(double));
+    std::memset(totals, 0, num_clusters * sizeof(double));
+    for (int i = 0; i < num_candidates; i++) {
+      totals[assignment[i]] += weights[i];
+      for (int d = 0; d < dims; d++)
+        sums[assignment[i] * dims + d] += weights[i] * candidates[i * dims + d];
+    }
+    for (int c = 0; c < num_clusters; c++) {
+      if (totals[c] > 0.0) {
+        for (int d = 0; d < dims; d++)
+          centroids[c * dims + d] = sums[c * dims + d] / totals[c];
+      }
+    }
+  }
+}
+
+// rows ids[0..count) of points, copied into the CONTEXT_INIT slot 9 buffer
+static real *gather_candidates(struct kmeans_context_t *context, int dims, real *points, int *ids, int count) {
+  real *rows = context_array<real>(context, CONTEXT_INIT, SLOT_INIT_CANDIDATE_ROWS, (size_t)count * dims);
+  for (int i = 0; i < count; i++)
+    std::memcpy(&rows[(long)i * dims], &points[(long)ids[i] * dims], dims * sizeof(real));
+  return rows;
+}
+
+void k_means_init_parallel(struct kmeans_context_t *context, int num_points, int dims, real *points, int num_clusters, real *centroids,
+                           int seed, int num_workers) {
+  int num_blocks = (num_points + SEED_BLOCK_SIZE - 1) / SEED_BLOCK_SIZE;
+  double oversampling = 2.0 * num_clusters;
+  double *min_distances = context_array<double>(context, CONTEXT_INIT, SLOT_INIT_MIN_DISTANCES, num_points);
+  double *block_sums = context_array<double>(context, CONTEXT_INIT, SLOT_INIT_BLOCK_SUMS, num_blocks);
+  int *nearest = context_array<int>(context, CONTEXT_INIT, SLOT_INIT_NEAREST, num_points);
+  // a sampled point is at distance 0 from then on, so no point is picked twice
+  int *candidate_ids = context_array<int>(context, CONTEXT_INIT, SLOT_INIT_CANDIDATE_IDS, num_points);
+  char *sampled = context_array<char>(context, CONTEXT_INIT, SLOT_INIT_SAMPLED, num_points);
+  int *block_first = context_array<int>(context, CONTEXT_INIT, SLOT_INIT_BLOCK_FIRST, num_blocks + 1);
+
+  for (int i = 0; i < num_points; i++)
+    min_distances[i] = DBL_MAX;
+
+  int num_candidates = 1;
+  candidate_ids[0] = (int)(hashed_uniform(seed, 0, 0) * num_points);
+  update_min_distances(num_points, dims, points, &points[candidate_ids[0] * dims], 1, min_distances, block_sums, nearest, 0, num_workers);
+
+  for (int round = 1; round <= KMEANS_PARALLEL_ROUNDS; round++) {
+    double cost = sum_blocks(block_sums, num_blocks);
+    if (cost <= 0.0)
+      break;
+
+    parallel_for(num_workers, num_blocks, [&](int begin, int end, int worker) {
+      for (int b = begin; b < end; b++) {
+        int count = 0;
+        int last = std::min(num_points, (b + 1) * SEED_BLOCK_SIZE);
+        for (int i = b * SEED_BLOCK_SIZE; i < last; i++) {
+          sampled[i] = hashed_uniform(seed, round, i) < oversampling * min_distances[i] / cost;
+          count += sampled[i];
+        }
+        block_first[b + 1] = count;
+      }
+    });
+
+    // appended in block order, so the candidate list is the same for any worker count
+    int first_new = num_candidates;
+    block_first[0] = first_new;
+    for (int b = 0; b < num_blocks; b++)
+      block_first[b + 1] += block_first[b];
+    parallel_for(num_workers, num_blocks, [&](int begin, int end, int worker) {
+      for (int b = begin; b < end; b++) {
+        int next_id = block_first[b];
+        int last = std::min(num_points, (b + 1) * SEED_BLOCK_SIZE);
+        for (int i = b * SEED_BLOCK_SIZE; i < last; i++) {
+          if (sampled[i])
+            candidate_ids[next_id++] = i;
+        }
+      }
+    });
+    num_candidates = block_first[num_blocks];
+    int num_new = num_candidates - first_new;
+    real *new_centers = gather_candidates(context, dims, points, &candidate_ids[first_new], num_new);
+    update_min_distances(num_points, dims, points, new_centers, num_new, min_distances, block_sums, nearest, first_new, num_workers);
+  }
+
+  if (num_candidates <= num_clusters) {
+    // too few distinct candidates to recluster; top up with uniformly drawn points
+    for (int c = 0; c < num_clusters; c++) {
+      int index = c < num_candidates ? candidate_ids[c] : (int)(hashed_uniform(seed, STREAM_TOP_UP, c) * num_points);
+      std::memcpy(&centroids[c * dims], &points[index * dims], dims * sizeof(real));
+    }
+  } else {
+    // weight every candidate by the number of points closest to it, already tracked by the rounds
+    double *weights = context_array<double>(context, CONTEXT_INIT, SLOT_INIT_WEIGHTS, num_candidates);
+    std::fill(weights, weights + num_candidates, 0.0);
+    for (int i = 0; i < num_points; i++)
+      weights[nearest[i]] += 1.0;
+
+    real *candidates = gather_candidates(context, dims, points, candidate_ids, num_candidates);
+    recluster_candidates(context, num_candidates, dims, candidates, weights, num_clusters, centroids, seed);
+  }
+}
+
+bool k_means_init_from_model(const char *path, int num_clusters, int dims, real *centroids) {
+  return read_model(path, num_clusters, dims, centroids);
+}
+
+int k_means_init_from_assignments(int num_points, int dims, real *points, int num_clusters, int *prior_ids, int num_prior,
+                                  real *centroids, double *sums, int *counts) {
+  std::memset(sums, 0, (long)num_clusters * dims * sizeof(double));
+  std::memset(counts, 0, num_clusters * sizeof(int));
+  int used = 0;
+  for (int i = 0; i < std::min(num_points, num_prior); i++) {
+    int c = prior_ids[i];
+    if (c < 0 || c >= num_clusters)
+      continue;
+    counts[c]++;
+    for (int d = 0; d < dims; d++)
+      sums[(long)c * dims + d] += points[(long)i * dims + d];
+    used++;
+  }
+  for (int c = 0; c < num_clusters; c++) {
+    if (counts[c] == 0)
+      continue;
+    for (int d = 0; d < dims; d++)
+      centroids[(long)c * dims + d] = sums[(long)c * dims + d] / counts[c];
+  }
+  return used;
+}
+
+void k_means_init_centroids(struct kmeans_context_t *context, int num_points, int dims, real *points, int num_clusters, real *centroids,
+                            int seed, int init, int num_workers) {
+  switch (init)
+  {
+    case INIT_KMEANS_PLUS_PLUS:
+      k_means_init_plus_plus(context, num_points, dims, points, num_clusters, centroids, seed, num_workers);
+      break;
+    case INIT_KMEANS_PARALLEL:
+      k_means_init_parallel(context, num_points, dims, points, num_clusters, centroids, seed, num_workers);
+      break;
+    default:
+      k_means_init_random_centroids(num_points, dims, points, num_clusters, centroids, seed);
+      break;
+  }
+}
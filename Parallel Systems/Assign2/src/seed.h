@@ -2,9 +2,44 @@
 
 #include <cstring>
 #include <cstdlib>
+#include <cstdint>
 
 #include "helpers.h"
+#include "kmeans_context.h"
+
+#define INIT_RANDOM 0
+#define INIT_KMEANS_PLUS_PLUS 1
+#define INIT_KMEANS_PARALLEL 2
 
 int k_means_rand();
 
-void k_means_init_random_centroids(int n_points, int dims, real *points, int num_clusters, real *centroids, int seed);
\ No newline at end of file
+void k_means_srand(unsigned int seed);
+
+void k_means_init_random_centroids(int n_points, int dims, real *points, int num_clusters, real *centroids, int seed);
+
+// D^2 sampling; each new centroid is drawn with probability proportional to its squared
+// distance from the nearest centroid picked so far. Its scratch is CONTEXT_INIT slots 3 and 4 of context.
+void k_means_init_plus_plus(struct kmeans_context_t *context, int n_points, int dims, real *points, int num_clusters, real *centroids,
+                            int seed, int num_workers);
+
+// k-means|| (Bahmani et al.): a few oversampling rounds pick ~2k candidates per round in
+// parallel, which are then weighted by the points they attract and reclustered to k. Its
+// scratch is CONTEXT_INIT slots 3 to 15 of context.
+void k_means_init_parallel(struct kmeans_context_t *context, int n_points, int dims, real *points, int num_clusters, real *centroids,
+                           int seed, int num_workers);
+
+// Warm start from the centroids of a model written by --save-model, which must have
+// num_clusters rows of dims. Returns false if the file can't be read or has another shape.
+bool k_means_init_from_model(const char *path, int num_clusters, int dims, real *centroids);
+
+// Moves every centroid to the mean of the points carrying its id among the first num_prior
+// entries of prior_ids, so a changed dataset starts from its own means under the previous
+// partition. Ids outside [0, num_clusters) are skipped and centroids left without points keep
+// their position. sums and counts are num_clusters x dims doubles and num_clusters ints of
+// scratch. Returns the number of points used.
+int k_means_init_from_assignments(int num_points, int dims, real *points, int num_clusters, int *prior_ids, int num_prior,
+                                  real *centroids, double *sums, int *counts);
+
+// dispatches on one of the INIT_* values
+void k_means_init_centroids(struct kmeans_context_t *context, int n_points, int dims, real *points, int num_clusters, real *centroids,
+                            int seed, int init, int num_workers);
@@ -0,0 +1,152 @@
+#include "sparse_points.h"
+
+#include <charconv>
+#include <vector>
+
+using namespace std;
+
+static const char *skip_blanks(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        p++;
+    return p;
+}
+
+static void compute_norms(csr_points_t *csr) {
+    csr->norms = (double *)malloc(csr->num_points * sizeof(double));
+    for (int i = 0; i < csr->num_points; i++) {
+        double norm = 0;
+        for (long j = csr->row_start[i]; j < csr->row_start[i + 1]; j++)
+            norm += (double)csr->values[j] * csr->values[j];
+        csr->norms[i] = norm;
+    }
+}
+
+bool is_sparse_point_file(const char *path) {
+    ifstream in(path, ios::binary);
+    char magic[4] = {0, 0, 0, 0};
+    in.read(magic, sizeof(magic));
+    return in.good() && memcmp(magic, SPARSE_FILE_MAGIC, sizeof(magic)) == 0;
+}
+
+bool read_sparse_points(const char *path, csr_points_t *csr) {
+    ifstream in(path, ios::binary | ios::ate);
+    if (!in.is_open())
+        return false;
+    size_t size = in.tellg();
+    vector<char> text(size);
+    in.seekg(0);
+    in.read(text.data(), size);
+
+    const char *p = text.data();
+    const char *end = p + size;
+    if (size < 4 || memcmp(p, SPARSE_FILE_MAGIC, 4) != 0)
+        return false;
+    from_chars_result parsed = from_chars(skip_blanks(p + 4, end), end, csr->num_points);
+    if (parsed.ec != errc() || csr->num_points < 0)
+        return false;
+    parsed = from_chars(skip_blanks(parsed.ptr, end), end, csr->dims);
+    if (parsed.ec != errc() || csr->dims <= 0)
+        return false;
+    p = parsed.ptr;
+
+    vector<long> row_start(1, 0);
+    vector<int> columns;
+    vector<real> values;
+    row_start.reserve(csr->num_points + 1);
+
+    while (p < end && (int)row_start.size() <= csr->num_points) {
+        // to the start of the next non-empty line
+        while (p < end && (*p == '\n' || *p == '\r' || *p == ' ' || *p == '\t'))
+            p++;
+        if (p >= end)
+            break;
+
+        int index;
+        parsed = from_chars(p, end, index);
+        if (parsed.ec != errc())
+            return false;
+        p = parsed.ptr;
+        while (true) {
+            p = skip_blanks(p, end);
+            if (p >= end || *p == '\n')
+                break;
+            int column;
+            real value;
+            parsed = from_chars(p, end, column);
+            if (parsed.ec != errc() || parsed.ptr >= end || *parsed.ptr != ':')
+                return false;
+            parsed = from_chars(parsed.ptr + 1, end, value);
+            if (parsed.ec != errc() || column < 0 || column >= csr->dims)
+                return false;
+            p = parsed.ptr;
+            columns.push_back(column);
+            values.push_back(value);
+        }
+        row_start.push_back(columns.size());
+    }
+
+    if ((int)row_start.size() != csr->num_points + 1)
+        return false;
+
+    csr->nnz = columns.size();
+    csr->row_start = (long *)malloc(row_start.size() * sizeof(long));
+    csr->columns = (int *)malloc(csr->nnz * sizeof(int));
+    csr->values = (real *)malloc(csr->nnz * sizeof(real));
+    memcpy(csr->row_start, row_start.data(), row_start.size() * sizeof(long));
+    memcpy(csr->columns, columns.data(), csr->nnz * sizeof(int));
+    memcpy(csr->values, values.data(), csr->nnz * sizeof(real));
+    compute_norms(csr);
+    return true;
+}
+
+bool write_sparse_points(const char *path, csr_points_t *csr) {
+    FILE *out = fopen(path, "w");
+    if (!out)
+        return false;
+    fprintf(out, "%s %d %d\n", SPARSE_FILE_MAGIC, csr->num_points, csr->dims);
+    for (int i = 0; i < csr->num_points; i++) {
+        fprintf(out, "%d", i + 1);
+        for (long j = csr->row_start[i]; j < csr->row_start[i + 1]; j++)
+            fprintf(out, " %d:%.9g", csr->columns[j], csr->values[j]);
+        fprintf(out, "\n");
+    }
+    return fclose(out) == 0;
+}
+
+void dense_to_csr(int num_points, int dims, real *points, csr_points_t *csr) {
+    csr->num_points = num_points;
+    csr->dims = dims;
+    csr->nnz = 0;
+    for (long j = 0; j < (long)num_points * dims; j++)
+        if (points[j] != 0)
+            csr->nnz++;
+
+    csr->row_start = (long *)malloc((num_points + 1) * sizeof(long));
+    csr->columns = (int *)malloc(csr->nnz * sizeof(int));
+    csr->values = (real *)malloc(csr->nnz * sizeof(real));
+    long next = 0;
+    for (int i = 0; i < num_points; i++) {
+        csr->row_start[i] = next;
+        for (int d = 0; d < dims; d++) {
+            real value = points[(long)i * dims + d];
+            if (value != 0) {
+                csr->columns[next] = d;
+                csr->values[next] = value;
+                next++;
+            }
+        }
+    }
+    csr->row_start[num_points] = next;
+    compute_norms(csr);
+}
+
+void free_sparse_points(csr_points_t *csr) {
+    free(csr->row_start);
+    free(csr->columns);
+    free(csr->values);
+    free(csr->norms);
+    csr->row_start = NULL;
+    csr->columns = NULL;
+    csr->values = NULL;
+    csr->norms = NULL;
+}
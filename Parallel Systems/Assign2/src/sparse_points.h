@@ -0,0 +1,35 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
+
+#include "helpers.h"
+
+// Sparse point file (text): a "KMS1 <num_points> <dims>" header line, then one line per
+// point, "index col:value col:value ...", columns 0-based and increasing. Zeros are omitted.
+#define SPARSE_FILE_MAGIC "KMS1"
+
+// compressed sparse rows: the non-zeros of point i are columns/values[row_start[i] .. row_start[i + 1])
+struct csr_points_t {
+    int num_points;
+    int dims;
+    long nnz;
+    long *row_start;
+    int *columns;
+    real *values;
+    double *norms;      // ||x||^2 per point
+};
+
+bool is_sparse_point_file(const char *path);
+
+// Returns false if the file can't be read or is not in the sparse format.
+bool read_sparse_points(const char *path, csr_points_t *csr);
+
+bool write_sparse_points(const char *path, csr_points_t *csr);
+
+// builds the CSR form of row-major dense points, dropping zeros
+void dense_to_csr(int num_points, int dims, real *points, csr_points_t *csr);
+
+void free_sparse_points(csr_points_t *csr);
@@ -0,0 +1,41 @@
+#include "telemetry.h"
+#include "kmeans_context.h"
+#include "kmeans_sequential.h"
+#include "parallel.h"
+
+bool open_telemetry(const char *path, telemetry_t *telemetry) {
+    telemetry->out = fopen(path, "w");
+    telemetry->fit = 0;
+    return telemetry->out != NULL;
+}
+
+void close_telemetry(telemetry_t *telemetry) {
+    if (telemetry->out)
+        fclose(telemetry->out);
+    telemetry->out = NULL;
+}
+
+void write_iteration_telemetry(telemetry_t *telemetry, const char *backend, const iteration_telemetry_t *stats) {
+    fprintf(telemetry->out,
+            "{\"fit\": %d, \"backend\": \"%s\", \"iteration\": %d, \"assign_ms\": %.6f, \"update_ms\": %.6f, "
+            "\"converge_ms\": %.6f, \"reassigned\": %ld, \"distances\": %ld, \"inertia\": %.9g}\n",
+            telemetry->fit, backend, stats->iteration, stats->assign_time, stats->update_time, stats->converge_time,
+            stats->reassigned, stats->distances, stats->inertia);
+}
+
+double assignment_inertia(struct kmeans_context_t *context, int num_points, int dims, real *points, int *cluster_id_of_points,
+                          real *centroids, int num_workers) {
+    double *partial = context_array<double>(context, CONTEXT_TELEMETRY, SLOT_TELEMETRY_PARTIAL, num_workers);
+    memset(partial, 0, num_workers * sizeof(double));
+    parallel_for(num_workers, num_points, [&](int begin, int end, int worker) {
+        double inertia = 0.0;
+        for (int i = begin; i < end; i++)
+            inertia += squared_distance(&points[(long)i * dims], &centroids[(long)cluster_id_of_points[i] * dims], dims);
+        partial[worker] = inertia;
+    });
+
+    double inertia = 0.0;
+    for (int w = 0; w < num_workers; w++)
+        inertia += partial[w];
+    return inertia;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdio>
+#include <chrono>
+
+#include "helpers.h"
+
+struct kmeans_context_t;
+
+// What a backend measured over one iteration, written as one JSON object per line to the
+// --telemetry file. The backends only read the clock and compute the inertia when that file
+// is open; otherwise each phase costs them a flag test.
+struct iteration_telemetry_t {
+    int iteration;
+    double assign_time;     // ms, with whatever the backend does alongside the assignment
+    double update_time;     // ms, the centroids and any bounds that follow them
+    double converge_time;   // ms
+    long reassigned;        // points whose cluster changed; every point on the first iteration
+    long distances;         // point-centroid distances computed; partial ones count as their share of dims
+    double inertia;         // of the assignment, against the updated centroids
+};
+
+struct telemetry_t {
+    FILE *out;
+    int fit;                // fits on the context so far, to tell the lines of several fits apart
+};
+
+// returns false when the file can't be opened
+bool open_telemetry(const char *path, telemetry_t *telemetry);
+
+void close_telemetry(telemetry_t *telemetry);
+
+void write_iteration_telemetry(telemetry_t *telemetry, const char *backend, const iteration_telemetry_t *stats);
+
+// sum of squared distances of the points to their clusters' centroids, accumulated in double
+double assignment_inertia(struct kmeans_context_t *context, int num_points, int dims, real *points, int *cluster_id_of_points,
+                          real *centroids, int num_workers);
+
+// Times consecutive phases, reading the clock only when enabled.
+struct phase_clock_t {
+    bool enabled;
+    std::chrono::high_resolution_clock::time_point last;
+
+    explicit phase_clock_t(bool enabled) : enabled(enabled), last() {}
+
+    inline void start() {
+        if (enabled)
+            last = std::chrono::high_resolution_clock::now();
+    }
+
+    // ms since start() or the previous lap()
+    inline double lap() {
+        if (!enabled)
+            return 0.0;
+        auto now = std::chrono::high_resolution_clock::now();
+        double elapsed = std::chrono::duration<double, std::milli>(now - last).count();
+        last = now;
+        return elapsed;
+    }
+};
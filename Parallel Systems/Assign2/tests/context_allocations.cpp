@@ -0,0 +1,281 @@
+// Checks that a context which has already fitted a dataset fits and predicts it again without
+// allocating: malloc and its family (and with them operator new, which libstdc++ builds on
+// malloc, replaced here as well) are swapped for counting versions, and every configuration
+// below is fitted twice untimed, then fitted and predicted CHECK_REPEATS more times while the
+// allocations on every thread are counted. Exits 1 if any configuration allocated.
+//
+//   make test
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdint>
+#include <new>
+#include <unistd.h>
+
+#include "kmeans_context.h"
+#include "distance_metric.h"
+#include "kmeans_bisect.h"
+#include "point_storage.h"
+#include "seed.h"
+#include "io.h"
+
+#define CHECK_POINTS 6000
+#define CHECK_REPEATS 3
+
+static std::atomic<bool> counting(false);
+static std::atomic<long> allocations(0);
+
+static void count_allocation() {
+    if (counting.load(std::memory_order_relaxed))
+        allocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+// glibc's own allocator, under the names it exports for exactly this
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *pointer);
+
+void *malloc(size_t size) noexcept {
+    count_allocation();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) noexcept {
+    count_allocation();
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) noexcept {
+    count_allocation();
+    return __libc_realloc(pointer, size);
+}
+
+int posix_memalign(void **pointer, size_t alignment, size_t size) noexcept {
+    count_allocation();
+    *pointer = __libc_memalign(alignment, size);
+    return *pointer ? 0 : ENOMEM;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) noexcept {
+    count_allocation();
+    return __libc_memalign(alignment, size);
+}
+
+void *memalign(size_t alignment, size_t size) noexcept {
+    count_allocation();
+    return __libc_memalign(alignment, size);
+}
+
+void free(void *pointer) noexcept {
+    __libc_free(pointer);
+}
+}
+
+static void *counted_new(size_t size, size_t alignment) {
+    void *pointer;
+    if (alignment <= alignof(std::max_align_t))
+        pointer = malloc(size ? size : 1);
+    else
+        pointer = aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    if (!pointer)
+        throw std::bad_alloc();
+    return pointer;
+}
+
+void *operator new(size_t size) { return counted_new(size, 0); }
+void *operator new[](size_t size) { return counted_new(size, 0); }
+void *operator new(size_t size, std::align_val_t alignment) { return counted_new(size, (size_t)alignment); }
+void *operator new[](size_t size, std::align_val_t alignment) { return counted_new(size, (size_t)alignment); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept { return malloc(size ? size : 1); }
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { return malloc(size ? size : 1); }
+void operator delete(void *pointer) noexcept { free(pointer); }
+void operator delete[](void *pointer) noexcept { free(pointer); }
+void operator delete(void *pointer, size_t) noexcept { free(pointer); }
+void operator delete[](void *pointer, size_t) noexcept { free(pointer); }
+void operator delete(void *pointer, std::align_val_t) noexcept { free(pointer); }
+void operator delete[](void *pointer, std::align_val_t) noexcept { free(pointer); }
+void operator delete(void *pointer, size_t, std::align_val_t) noexcept { free(pointer); }
+void operator delete[](void *pointer, size_t, std::align_val_t) noexcept { free(pointer); }
+
+struct check_case_t {
+    const char *name;
+    int algorithm;
+    int dims;
+    int num_clusters;
+    int init;
+    int metric;
+    int layout;
+    bool tiled;
+    bool partial_distance;
+    int delta_update;
+    int storage;
+    int bisect_split;
+    bool refine;
+    bool warm_start;
+};
+
+// dims 16 and k 24 stay under the gemm thresholds, dims 64 and k 32 reach them
+static const check_case_t check_cases[] = {
+    {"sequential", 0, 16, 24, INIT_RANDOM, METRIC_EUCLIDEAN, LAYOUT_ROWS, false, false, 0, STORAGE_FP32, BISECT_SPLIT_LARGEST, false, false},
+    {"sequential gemm", 0, 64, 32, INIT_RANDOM, METRIC_EUCLIDEAN, LAYOUT_ROWS, false, false, 0, STORAGE_FP32, BISECT_SPLIT_LARGEST, false, false},
+    {"sequential kmeans++", 0, 16, 24, INIT_KMEANS_PLUS_PLUS, METRIC_EUCLIDEAN, LAYOUT_ROWS, false, false, 0, STORAGE_FP32, BISECT_SPLIT_LARGEST, false, false},
+    {"sequential kmeans||", 0, 16, 24, INIT_KMEANS_PARALLEL, METRIC_EUCLIDEAN, LAYOUT_ROWS, false, false, 0, STORAGE_FP32, BISECT_SPLIT_LARGEST, false, false},
+    {"sequential partial", 0, 16, 24, INIT_RANDOM, METRIC_EUCLIDEAN, LAYOUT_ROWS, false, true, 0, STORAGE_FP32, BISECT_SPLIT_LARGEST, false, false},
+    {"sequential delta", 0, 16, 24, INIT_RANDOM, METRIC_EUCLIDEAN, LAYOUT_ROWS, false, false, 4, STORAGE_FP32, BISECT_SPLIT_LARGEST, false, false},
+    {"sequential blocked", 0, 16, 24, INIT_RANDOM, METRIC_EUCLIDEAN, LAYOUT_BLOCKED, false, false, 0, STORAGE_FP32, BISECT_SPLIT_LARGEST, false, false},
+    {"sequential tiled", 0, 64, 32, INIT_RANDOM, METRIC_EUCLIDEAN, LAYOUT_ROWS, true, false, 0, STORAGE_FP32, BISECT_SPLIT_LARGEST, false, false},
+    {"sequential warm start", 0, 16, 24, INIT_RANDOM, METRIC_EUCLIDEAN, LAYOUT_ROWS, false, false, 0, STORAGE_FP32, BISECT_SPLIT_LARGEST, false, true},
+    {"sequential cosine", 0, 16, 24, INIT_RANDOM, METRIC_COSINE, LAYOUT_ROWS, false, false, 0, STORAGE_FP32, BISECT_SPLIT_LARGEST, false, false},
+    {"sequential l1", 0, 16, 24, INIT_RANDOM, METRIC_L1, LAYOUT_ROWS, false, false, 0, STORAGE_FP32, BISECT_SPLIT_LARGEST, false, false},
+    {"sequential mahalanobis", 0, 16, 24, INIT_RANDOM, METRIC_MAHALANOBIS, LAYOUT_ROWS, false, false, 0, STORAGE_FP32, BISECT_SPLIT_LARGEST, false, false},
+    {"elkan", 4, 16, 24, INIT_RANDOM, METRIC_EUCLIDEAN, LAYOUT_ROWS, false, false, 0, STORAGE_FP32, BISECT_SPLIT_LARGEST, false, false},
+    {"hamerly", 5, 16, 24, INIT_RANDOM, METRIC_EUCLIDEAN, LAYOUT_ROWS, false, false, 0, STORAGE_FP32, BISECT_SPLIT_LARGEST, false, false},
+    {"yinyang", 6, 16, 24, INIT_RANDOM, METRIC_EUCLIDEAN, LAYOUT_ROWS, false, false, 0, STORAGE_FP32, BISECT_SPLIT_LARGEST, false, false},
+    {"fused", 7, 16, 24, INIT_RANDOM, METRIC_EUCLIDEAN, LAYOUT_ROWS, false, false, 0, STORAGE_FP32, BISECT_SPLIT_LARGEST, false, false},
+    {"fused fp16", 7, 16, 24, INIT_RANDOM, METRIC_EUCLIDEAN, LAYOUT_ROWS, false, false, 0, STORAGE_FP16, BISECT_SPLIT_LARGEST, false, false},
+    {"fused bf16", 7, 16, 24, INIT_RANDOM, METRIC_EUCLIDEAN, LAYOUT_ROWS, false, false, 0, STORAGE_BF16, BISECT_SPLIT_LARGEST, false, false},
+    {"fused int8", 7, 16, 24, INIT_RANDOM, METRIC_EUCLIDEAN, LAYOUT_ROWS, false, false, 0, STORAGE_INT8, BISECT_SPLIT_LARGEST, false, false},
+    {"fused blocked", 7, 16, 24, INIT_RANDOM, METRIC_EUCLIDEAN, LAYOUT_BLOCKED, false, false, 0, STORAGE_FP32, BISECT_SPLIT_LARGEST, false, false},
+    {"fused tiled", 7, 64, 32, INIT_RANDOM, METRIC_EUCLIDEAN, LAYOUT_ROWS, true, false, 0, STORAGE_FP32, BISECT_SPLIT_LARGEST, false, false},
+    {"fused cosine", 7, 16, 24, INIT_RANDOM, METRIC_COSINE, LAYOUT_ROWS, false, false, 0, STORAGE_FP32, BISECT_SPLIT_LARGEST, false, false},
+    {"fused l1", 7, 16, 24, INIT_RANDOM, METRIC_L1, LAYOUT_ROWS, false, false, 0, STORAGE_FP32, BISECT_SPLIT_LARGEST, false, false},
+    {"fused mahalanobis fp16", 7, 16, 24, INIT_RANDOM, METRIC_MAHALANOBIS, LAYOUT_ROWS, false, false, 0, STORAGE_FP16, BISECT_SPLIT_LARGEST, false, false},
+    {"kdtree", 12, 16, 24, INIT_RANDOM, METRIC_EUCLIDEAN, LAYOUT_ROWS, false, false, 0, STORAGE_FP32, BISECT_SPLIT_LARGEST, false, false},
+    {"ivf", 13, 16, 24, INIT_RANDOM, METRIC_EUCLIDEAN, LAYOUT_ROWS, false, false, 0, STORAGE_FP32, BISECT_SPLIT_LARGEST, false, false},
+    {"bisect", 14, 16, 24, INIT_RANDOM, METRIC_EUCLIDEAN, LAYOUT_ROWS, false, false, 0, STORAGE_FP32, BISECT_SPLIT_LARGEST, false, false},
+    {"bisect sse refine", 14, 16, 24, INIT_RANDOM, METRIC_EUCLIDEAN, LAYOUT_ROWS, false, false, 0, STORAGE_FP32, BISECT_SPLIT_SSE, true, false},
+};
+
+static const int check_workers[] = {1, 4};
+
+// loose gaussian-ish blobs from a fixed xorshift stream, so every run checks the same points
+static void generate_points(int num_points, int dims, int num_blobs, real *points) {
+    uint64_t state = 0x2545f4914f6cdd1dULL;
+    auto next = [&]() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return ((state * 0x2545f4914f6cdd1dULL) >> 40) * (1.0 / 16777216.0);
+    };
+    for (int i = 0; i < num_points; i++) {
+        int blob = (int)(next() * num_blobs);
+        for (int d = 0; d < dims; d++)
+            points[(long)i * dims + d] = (real)(blob * 0.37 * ((blob + d) % 5) + next() + next() + next() - 1.5);
+    }
+}
+
+// a model and an assignment file from a plain fit, for the warm start cases
+static bool write_warm_start(const char *model_path, const char *ids_path, int num_points, int dims, real *points, int num_clusters) {
+    struct options_t opts;
+    set_default_opts(&opts);
+    opts.num_clusters = num_clusters;
+    opts.dims = dims;
+    opts.in_file = NULL;
+    opts.max_num_iter = 5;
+    opts.threshold = 1e-6;
+    opts.seed = 3;
+
+    struct kmeans_context_t context;
+    init_kmeans_context(&context);
+    bool written = context_fit(&context, &opts, num_points, points) > 0 && save_model(model_path, num_clusters, dims, context.centroids);
+    FILE *ids = fopen(ids_path, "w");
+    if (ids) {
+        fprintf(ids, "clusters:");
+        for (int i = 0; i < num_points; i++)
+            fprintf(ids, " %d", context.cluster_id_of_points[i]);
+        fprintf(ids, "\n");
+        written = fclose(ids) == 0 && written;
+    }
+    free_kmeans_context(&context);
+    return written && ids;
+}
+
+int main(int argc, char **argv) {
+    char model_path[] = "/tmp/context_allocations_model_XXXXXX";
+    char ids_path[] = "/tmp/context_allocations_ids_XXXXXX";
+    int model_fd = mkstemp(model_path);
+    int ids_fd = mkstemp(ids_path);
+    if (model_fd < 0 || ids_fd < 0) {
+        fprintf(stderr, "%s: cannot create the warm start files\n", argv[0]);
+        return 1;
+    }
+    close(model_fd);
+    close(ids_fd);
+
+    int failures = 0;
+    for (int dims : {16, 64}) {
+        real *points = (real *)malloc((size_t)CHECK_POINTS * dims * sizeof(real));
+        int *predicted = (int *)malloc(CHECK_POINTS * sizeof(int));
+        generate_points(CHECK_POINTS, dims, 12, points);
+        if (!write_warm_start(model_path, ids_path, CHECK_POINTS, dims, points, 24)) {
+            fprintf(stderr, "%s: cannot write the warm start files\n", argv[0]);
+            return 1;
+        }
+
+        for (const check_case_t &check : check_cases) {
+            if (check.dims != dims)
+                continue;
+            for (int workers : check_workers) {
+                struct options_t opts;
+                set_default_opts(&opts);
+                opts.num_clusters = check.num_clusters;
+                opts.dims = dims;
+                opts.in_file = NULL;
+                opts.max_num_iter = 20;
+                opts.threshold = 1e-6;
+                opts.seed = 11;
+                opts.algorithm = check.algorithm;
+                opts.workers = workers;
+                opts.init = check.init;
+                opts.metric = check.metric;
+                opts.layout = check.layout;
+                opts.tiled = check.tiled;
+                opts.partial_distance = check.partial_distance;
+                opts.delta_update = check.delta_update;
+                opts.storage = check.storage;
+                opts.bisect_split = check.bisect_split;
+                opts.refine = check.refine;
+                if (check.warm_start) {
+                    opts.init_from = model_path;
+                    opts.init_assignments = ids_path;
+                }
+
+                struct kmeans_context_t context;
+                init_kmeans_context(&context);
+                // the untimed fits grow the workspaces and start the pool threads
+                bool fitted = true;
+                for (int r = 0; r < 2; r++) {
+                    fitted = context_fit(&context, &opts, CHECK_POINTS, points) > 0 && fitted;
+                    context_predict(&context, &opts, CHECK_POINTS, points, predicted);
+                }
+
+                allocations = 0;
+                counting = true;
+                for (int r = 0; r < CHECK_REPEATS; r++) {
+                    fitted = context_fit(&context, &opts, CHECK_POINTS, points) > 0 && fitted;
+                    context_predict(&context, &opts, CHECK_POINTS, points, predicted);
+                }
+                counting = false;
+                free_kmeans_context(&context);
+
+                long counted = allocations;
+                bool passed = fitted && counted == 0;
+                printf("%s %s -w %d: %ld allocations over %d fits and predicts%s\n", passed ? "PASS" : "FAIL", check.name, workers,
+                       counted, CHECK_REPEATS, fitted ? "" : ", and a fit failed");
+                failures += passed ? 0 : 1;
+            }
+        }
+        free(points);
+        free(predicted);
+    }
+
+    unlink(model_path);
+    unlink(ids_path);
+    if (failures > 0)
+        printf("%d configurations allocated after their workspaces were grown\n", failures);
+    return failures > 0 ? 1 : 0;
+}
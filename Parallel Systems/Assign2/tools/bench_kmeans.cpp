@@ -0,0 +1,359 @@
+// Benchmarks the in-memory CPU backends on generated gaussian blobs and writes one CSV row per
+// dataset and backend.
+//
+//   bin/bench_kmeans [-n <n1,n2,..>] [-d <d1,..>] [-k <k1,..>] [-S <separation1,..>] [-a <algorithms>]
+//                    [-D <metrics>] [-W <warmups>] [-R <repeats>] [-w <workers>] [-m <max iters>] [-t <threshold>]
+//                    [-s <seed>] [-x <memory limit in GB>] [-o <csv file>]
+//
+// Every combination of n, d, k and separation is generated once, in memory, as k blobs whose
+// centers are drawn from N(0, separation^2) in each dimension and whose points have unit
+// variance around them, so separation is the spread of the centers in cluster widths. The
+// points only depend on the seed, not on the worker count. Each backend then fits the dataset
+// -W times untimed and -R times timed from the same seeding, in a context of its own, and the
+// row reports the median of the timed fits. Combinations whose estimated footprint passes -x
+// are skipped with a note on stderr, as are fits that fail. Algorithms 0 and 7 run once per -D
+// metric (all four by default), the others with euclidean only. Bisect rows leave the iteration count,
+// time per iteration and throughput as N/A, since what it counts are split rounds.
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <getopt.h>
+#include <sys/resource.h>
+#include <vector>
+
+#include "argparse.h"
+#include "kmeans_context.h"
+#include "distance_metric.h"
+#include "kmeans_yinyang.h"
+#include "parallel.h"
+
+using namespace std;
+
+// points generated from one random stream, so the data does not depend on how it is split
+#define BLOB_CHUNK 65536
+
+// splitmix64, which turns the seed, chunk and stream into independent starting states
+static uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// xorshift64* with Box-Muller on top, spelled out so the blobs are the same with any standard library
+struct blob_rng_t {
+    uint64_t state;
+    bool has_spare;
+    double spare;
+
+    double uniform() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return ((state * 0x2545f4914f6cdd1dULL) >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    double normal() {
+        if (has_spare) {
+            has_spare = false;
+            return spare;
+        }
+        double u = 1.0 - uniform();
+        double v = uniform();
+        double r = sqrt(-2.0 * log(u));
+        spare = r * sin(2.0 * M_PI * v);
+        has_spare = true;
+        return r * cos(2.0 * M_PI * v);
+    }
+};
+
+static blob_rng_t blob_rng(uint64_t seed, uint64_t stream) {
+    blob_rng_t rng = {mix(mix(seed) ^ stream) | 1, false, 0.0};
+    return rng;
+}
+
+static void generate_blobs(int num_points, int dims, int num_blobs, double separation, int seed, int num_workers,
+                           real *centers, real *points) {
+    blob_rng_t rng = blob_rng(seed, 0);
+    for (long j = 0; j < (long)num_blobs * dims; j++)
+        centers[j] = separation * rng.normal();
+
+    int num_chunks = (num_points + BLOB_CHUNK - 1) / BLOB_CHUNK;
+    parallel_for(num_workers, num_chunks, [&](int begin, int end, int worker) {
+        for (int chunk = begin; chunk < end; chunk++) {
+            blob_rng_t chunk_rng = blob_rng(seed, chunk + 1);
+            int last = min(num_points, (chunk + 1) * BLOB_CHUNK);
+            for (int i = chunk * BLOB_CHUNK; i < last; i++) {
+                int blob = (int)(chunk_rng.uniform() * num_blobs);
+                for (int d = 0; d < dims; d++)
+                    points[(long)i * dims + d] = centers[(long)blob * dims + d] + chunk_rng.normal();
+            }
+        }
+    });
+}
+
+static const char *backend_name(int algorithm) {
+    switch (algorithm) {
+        case 0: return "sequential";
+        case 4: return "elkan";
+        case 5: return "hamerly";
+        case 6: return "yinyang";
+        case 7: return "fused";
+        case 12: return "kdtree";
+        case 13: return "ivf";
+        case 14: return "bisect";
+    }
+    return "unknown";
+}
+
+// the points and result, plus the per-point state of the backends that keep some
+static double estimated_bytes(int algorithm, int metric, long num_points, int dims, int num_clusters) {
+    double bytes = (double)num_points * dims * sizeof(real) + num_points * 2.0 * sizeof(int);
+    // the median update buckets the points
+    if (metric == METRIC_L1)
+        bytes += num_points * (double)(sizeof(int) + sizeof(real));
+    switch (algorithm) {
+        case 4: return bytes + num_points * (num_clusters + 1.0) * sizeof(double);
+        case 5: return bytes + num_points * 2.0 * sizeof(double);
+        case 6: return bytes + num_points * (max(1, num_clusters / YINYANG_GROUP_SIZE) + 1.0) * sizeof(double);
+        case 12: return bytes + (double)num_points * dims * sizeof(real);
+    }
+    return bytes;
+}
+
+// Peak resident set since the last reset_peak_rss, in KB. Linux resets VmHWM through
+// clear_refs; elsewhere this is the peak of the whole process so far.
+static void reset_peak_rss() {
+    FILE *f = fopen("/proc/self/clear_refs", "w");
+    if (f) {
+        fputs("5", f);
+        fclose(f);
+    }
+}
+
+static long peak_rss_kb() {
+    FILE *f = fopen("/proc/self/status", "r");
+    if (f) {
+        char line[256];
+        long kb = -1;
+        while (fgets(line, sizeof(line), f))
+            if (sscanf(line, "VmHWM: %ld kB", &kb) == 1)
+                break;
+        fclose(f);
+        if (kb >= 0)
+            return kb;
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+template <typename T>
+static vector<T> parse_list(const char *list, T (*parse)(const char *)) {
+    vector<T> values;
+    char *copy = strdup(list);
+    for (char *token = strtok(copy, ","); token; token = strtok(NULL, ","))
+        values.push_back(parse(token));
+    free(copy);
+    return values;
+}
+
+static long parse_long(const char *s) { return (long)atof(s); }
+static int parse_int(const char *s) { return atoi(s); }
+static double parse_double(const char *s) { return atof(s); }
+
+int main(int argc, char **argv) {
+    vector<long> ns = {10000, 100000, 1000000};
+    vector<int> dimss = {2, 16, 128};
+    vector<int> ks = {4, 64, 1024};
+    vector<double> separations = {2.0, 8.0};
+    vector<int> algorithms = {0, 4, 5, 6, 7, 12, 13, 14};
+    vector<int> metrics = {METRIC_EUCLIDEAN, METRIC_COSINE, METRIC_L1, METRIC_MAHALANOBIS};
+    int warmups = 1;
+    int repeats = 3;
+    int workers = 1;
+    int max_iters = 100;
+    double threshold = 1e-6;
+    int seed = 8675309;
+    double memory_limit = 8.0;
+    char *out_file = NULL;
+
+    int c;
+    while ((c = getopt(argc, argv, "n:d:k:S:a:D:W:R:w:m:t:s:x:o:h")) != -1) {
+        switch (c)
+        {
+            case 'n':
+                ns = parse_list(optarg, parse_long);
+                break;
+            case 'd':
+                dimss = parse_list(optarg, parse_int);
+                break;
+            case 'k':
+                ks = parse_list(optarg, parse_int);
+                break;
+            case 'S':
+                separations = parse_list(optarg, parse_double);
+                break;
+            case 'a':
+                algorithms = parse_list(optarg, parse_int);
+                break;
+            case 'D':
+                metrics = parse_list(optarg, parse_metric);
+                break;
+            case 'W':
+                warmups = atoi(optarg);
+                break;
+            case 'R':
+                repeats = atoi(optarg);
+                break;
+            case 'w':
+                workers = atoi(optarg);
+                break;
+            case 'm':
+                max_iters = atoi(optarg);
+                break;
+            case 't':
+                threshold = atof(optarg);
+                break;
+            case 's':
+                seed = atoi(optarg);
+                break;
+            case 'x':
+                memory_limit = atof(optarg);
+                break;
+            case 'o':
+                out_file = optarg;
+                break;
+            default:
+                cout << "Usage: " << argv[0] << " [-n <n1,n2,..>] [-d <d1,..>] [-k <k1,..>] [-S <separation1,..>] [-a <algorithms>]"
+                     << " [-D <metrics>] [-W <warmups>] [-R <repeats>] [-w <workers>] [-m <max iters>] [-t <threshold>] [-s <seed>]"
+                     << " [-x <memory limit in GB>] [-o <csv file>]" << endl;
+                return c == 'h' ? 0 : 1;
+        }
+    }
+    repeats = max(1, repeats);
+    if (workers < 1) {
+        cerr << "-w needs at least 1 worker" << endl;
+        return 1;
+    }
+    for (int algorithm : algorithms) {
+        if (strcmp(backend_name(algorithm), "unknown") == 0) {
+            cerr << "algorithm " << algorithm << " is not an in-memory CPU backend" << endl;
+            return 1;
+        }
+    }
+    for (int metric : metrics) {
+        if (metric < 0) {
+            cerr << "-D takes euclidean, cosine, l1 and mahalanobis" << endl;
+            return 1;
+        }
+    }
+
+    FILE *out = out_file ? fopen(out_file, "w") : stdout;
+    if (!out) {
+        cerr << "cannot write " << out_file << endl;
+        return 1;
+    }
+    fprintf(out, "n,d,k,separation,backend,metric,workers,repeats,iterations,time_per_iteration_ms,fit_time_ms,"
+                 "point_centroid_dims_per_s,peak_rss_kb\n");
+    fflush(out);
+
+    for (long n : ns)
+    for (int dims : dimss)
+    for (int k : ks)
+    for (double separation : separations) {
+        // the backends index points with int
+        if (n * dims > INT32_MAX || k > n) {
+            cerr << "skipping n=" << n << " d=" << dims << " k=" << k << " separation=" << separation
+                 << ": outside what the backends take" << endl;
+            continue;
+        }
+        double base_bytes = estimated_bytes(0, METRIC_EUCLIDEAN, n, dims, k);
+        if (base_bytes > memory_limit * 1e9) {
+            cerr << "skipping n=" << n << " d=" << dims << " k=" << k << " separation=" << separation
+                 << ": needs about " << base_bytes / 1e9 << " GB" << endl;
+            continue;
+        }
+
+        real *centers = (real *)malloc((size_t)k * dims * sizeof(real));
+        real *points = (real *)malloc((size_t)n * dims * sizeof(real));
+        generate_blobs(n, dims, k, separation, seed, workers, centers, points);
+        free(centers);
+
+        for (int algorithm : algorithms)
+        for (int metric : metrics) {
+            // the other backends are euclidean only
+            if (metric != METRIC_EUCLIDEAN && algorithm != 0 && algorithm != 7)
+                continue;
+            double bytes = estimated_bytes(algorithm, metric, n, dims, k);
+            if (bytes > memory_limit * 1e9) {
+                cerr << "skipping " << backend_name(algorithm) << " (" << metric_name(metric) << ") on n=" << n << " d=" << dims << " k=" << k
+                     << ": needs about " << bytes / 1e9 << " GB" << endl;
+                continue;
+            }
+
+            struct options_t opts;
+            set_default_opts(&opts);
+            opts.num_clusters = k;
+            opts.dims = dims;
+            opts.in_file = NULL;
+            opts.max_num_iter = max_iters;
+            opts.threshold = threshold;
+            opts.seed = seed;
+            opts.algorithm = algorithm;
+            opts.workers = workers;
+            opts.metric = metric;
+
+            struct kmeans_context_t context;
+            init_kmeans_context(&context);
+            reset_peak_rss();
+
+            // the warm-up fits also grow the context's workspaces to size
+            int iterations = 0;
+            for (int r = 0; r < warmups && iterations >= 0; r++)
+                iterations = context_fit(&context, &opts, n, points);
+            vector<double> fit_times;
+            vector<double> iteration_times;
+            for (int r = 0; r < repeats && iterations >= 0; r++) {
+                iterations = context_fit(&context, &opts, n, points);
+                fit_times.push_back(context.fit_time);
+                iteration_times.push_back(context.fit_time / iterations);
+            }
+            long peak_rss = peak_rss_kb();
+            free_kmeans_context(&context);
+            if (iterations < 0) {
+                cerr << "skipping " << backend_name(algorithm) << " (" << metric_name(metric) << ") on n=" << n << " d=" << dims << " k=" << k
+                     << ": the fit failed" << endl;
+                continue;
+            }
+
+            sort(fit_times.begin(), fit_times.end());
+            sort(iteration_times.begin(), iteration_times.end());
+            double fit_time = fit_times[repeats / 2];
+            double iteration_time = iteration_times[repeats / 2];
+            // the work of a plain scan, whatever the backend skipped
+            double throughput = (double)n * k * dims / (iteration_time / 1000.0);
+
+            // bisect counts split rounds, not passes over the points, so it has no per-iteration figures
+            char iterations_text[32] = "N/A";
+            char iteration_time_text[32] = "N/A";
+            char throughput_text[32] = "N/A";
+            if (algorithm != 14) {
+                snprintf(iterations_text, sizeof(iterations_text), "%d", iterations);
+                snprintf(iteration_time_text, sizeof(iteration_time_text), "%f", iteration_time);
+                snprintf(throughput_text, sizeof(throughput_text), "%e", throughput);
+            }
+
+            fprintf(out, "%ld,%d,%d,%g,%s,%s,%d,%d,%s,%s,%f,%s,%ld\n", n, dims, k, separation, backend_name(algorithm),
+                    metric_name(metric), workers, repeats, iterations_text, iteration_time_text, fit_time, throughput_text, peak_rss);
+            fflush(out);
+        }
+        free(points);
+    }
+
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
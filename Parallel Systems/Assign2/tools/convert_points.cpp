@@ -0,0 +1,92 @@
+// Converts k-means point files between the text format and the binary format of io.h.
+//
+//   bin/convert_points -d <dims> -i <input> -o <output> [-w <workers>] [-s]
+//
+// The direction follows the input: text inputs are written as binary and binary inputs as text.
+// -s writes either one in the sparse (CSR) text format of sparse_points.h instead.
+
+#include <chrono>
+#include <getopt.h>
+
+#include "io.h"
+#include "sparse_points.h"
+
+using namespace std;
+
+static bool write_sparse(const char *path, int num_points, int dims, real *points) {
+    csr_points_t csr;
+    dense_to_csr(num_points, dims, points, &csr);
+    bool ok = write_sparse_points(path, &csr);
+    free_sparse_points(&csr);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    int dims = 0;
+    int workers = 1;
+    bool sparse = false;
+    char *in_file = NULL;
+    char *out_file = NULL;
+
+    int c;
+    while ((c = getopt(argc, argv, "d:i:o:w:s")) != -1) {
+        switch (c)
+        {
+            case 'd':
+                dims = atoi(optarg);
+                break;
+            case 'i':
+                in_file = optarg;
+                break;
+            case 'o':
+                out_file = optarg;
+                break;
+            case 'w':
+                workers = atoi(optarg);
+                break;
+            case 's':
+                sparse = true;
+                break;
+        }
+    }
+
+    if (dims <= 0 || workers < 1 || !in_file || !out_file) {
+        cout << "Usage: " << argv[0] << " -d <dims> -i <input> -o <output> [-w <workers>] [-s]" << endl;
+        return 1;
+    }
+
+    auto start = chrono::high_resolution_clock::now();
+    bool ok;
+    int num_points;
+
+    if (is_binary_point_file(in_file)) {
+        mapped_points_t mapped;
+        if (!map_point_file(in_file, &mapped) || mapped.dims != dims) {
+            cerr << "cannot map " << in_file << " as a " << dims << "-dimensional point file" << endl;
+            return 1;
+        }
+        num_points = mapped.num_points;
+        ok = sparse ? write_sparse(out_file, num_points, dims, mapped.points)
+                    : write_text_points(out_file, num_points, dims, mapped.points);
+        unmap_point_file(&mapped);
+    } else {
+        real *points;
+        num_points = parse_text_points(in_file, dims, workers, &points);
+        if (num_points < 0) {
+            cerr << "cannot read " << in_file << endl;
+            return 1;
+        }
+        ok = sparse ? write_sparse(out_file, num_points, dims, points)
+                    : write_binary_points(out_file, num_points, dims, points);
+        free(points);
+    }
+
+    if (!ok) {
+        cerr << "cannot write " << out_file << endl;
+        return 1;
+    }
+
+    auto difference = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start);
+    printf("converted %d points in %f ms\n", num_points, difference.count());
+    return 0;
+}